@@ -0,0 +1,370 @@
+//=====================================================================
+//
+// EnvMap.h - 立方体贴图和基于图像的光照 (Image Based Lighting)
+//
+// Created by agent on 2026/10/19
+//
+// - CubeMap：六个面的浮点立方体贴图，带一圈从相邻面复制的边框，
+//   双线性采样跨越面的边界时没有接缝
+// - EnvironmentMap：加载时对环境贴图进行预滤波，漫反射部分投影到
+//   三阶球谐函数 (9 个系数)，高光部分按照粗糙度生成多级 mip，
+//   PS 里计算漫反射不需要采样，高光只需要两次立方体贴图采样。
+//   预滤波多线程计算，结果可以缓存到磁盘文件
+//
+//=====================================================================
+#ifndef _ENV_MAP_H_
+#define _ENV_MAP_H_
+
+#include <stdio.h>
+#include <vector>
+#include <functional>
+
+#include "RenderHelp.h"
+
+
+//---------------------------------------------------------------------
+// 立方体贴图
+//---------------------------------------------------------------------
+class CubeMap
+{
+public:
+	// 面的顺序：+X, -X, +Y, -Y, +Z, -Z，每个面 size x size 个浮点 RGB 像素
+	inline CubeMap(int size = 1) { Resize(size); }
+
+	inline void Resize(int size) {
+		_size = Max(1, size);
+		_stride = _size + 2;
+		_texels.assign(6 * _stride * _stride, Vec3f());
+	}
+
+	inline int GetSize() const { return _size; }
+
+	// 读写面内的像素，x/y 范围 [0, size)
+	inline Vec3f& At(int face, int x, int y) {
+		return _texels[(face * _stride + y + 1) * _stride + x + 1];
+	}
+
+	inline const Vec3f& At(int face, int x, int y) const {
+		return _texels[(face * _stride + y + 1) * _stride + x + 1];
+	}
+
+	// 面坐标到方向：u/v 范围 [-1, 1]，u 向右 v 向下，和 D3D 的立方体贴图一致
+	inline static Vec3f FaceToDirection(int face, float u, float v) {
+		switch (face) {
+		case 0: return Vec3f( 1.0f, -v, -u);
+		case 1: return Vec3f(-1.0f, -v,  u);
+		case 2: return Vec3f( u,  1.0f,  v);
+		case 3: return Vec3f( u, -1.0f, -v);
+		case 4: return Vec3f( u, -v,  1.0f);
+		default: return Vec3f(-u, -v, -1.0f);
+		}
+	}
+
+	// 方向到面坐标：取绝对值最大的分量决定在哪个面
+	inline static int DirectionToFace(const Vec3f& d, float& u, float& v) {
+		float ax = Abs(d.x), ay = Abs(d.y), az = Abs(d.z);
+		if (ax >= ay && ax >= az) {
+			if (ax == 0.0f) { u = v = 0.0f; return 0; }
+			if (d.x > 0.0f) { u = -d.z / ax; v = -d.y / ax; return 0; }
+			u = d.z / ax; v = -d.y / ax; return 1;
+		}
+		if (ay >= az) {
+			if (d.y > 0.0f) { u = d.x / ay; v = d.z / ay; return 2; }
+			u = d.x / ay; v = -d.z / ay; return 3;
+		}
+		if (d.z > 0.0f) { u = d.x / az; v = -d.y / az; return 4; }
+		u = -d.x / az; v = -d.y / az; return 5;
+	}
+
+	// 某个像素中心对应的方向
+	inline Vec3f TexelDirection(int face, int x, int y) const {
+		float u = (x + 0.5f) * 2.0f / _size - 1.0f;
+		float v = (y + 0.5f) * 2.0f / _size - 1.0f;
+		return FaceToDirection(face, u, v);
+	}
+
+	// 单位立方体上某个像素所占的立体角
+	inline float TexelSolidAngle(int x, int y) const {
+		float u = (x + 0.5f) * 2.0f / _size - 1.0f;
+		float v = (y + 0.5f) * 2.0f / _size - 1.0f;
+		float t = 1.0f + u * u + v * v;
+		return 4.0f / (_size * _size * t * sqrtf(t));
+	}
+
+	// 用函数生成每个像素的颜色，参数是像素中心的单位方向
+	inline void Generate(const std::function<Vec3f(const Vec3f& dir)>& func) {
+		for (int face = 0; face < 6; face++) {
+			for (int y = 0; y < _size; y++) {
+				for (int x = 0; x < _size; x++)
+					At(face, x, y) = func(vector_normalize(TexelDirection(face, x, y)));
+			}
+		}
+		UpdateBorder();
+	}
+
+	// 从经纬度展开 (equirectangular) 的全景图生成，y 轴向上
+	inline void LoadEquirect(const Bitmap& bmp) {
+		Generate([&] (const Vec3f& d) -> Vec3f {
+				float u = atan2f(d.x, -d.z) / (2.0f * 3.1415926f) + 0.5f;
+				float v = acosf(Between(-1.0f, 1.0f, d.y)) / 3.1415926f;
+				return bmp.Sample2D(u, v).xyz();
+			});
+	}
+
+	// 修改像素以后需要调用：把相邻面的像素复制到每个面的边框上
+	inline void UpdateBorder() {
+		for (int face = 0; face < 6; face++) {
+			for (int y = -1; y <= _size; y++) {
+				for (int x = -1; x <= _size; x++) {
+					if (x >= 0 && x < _size && y >= 0 && y < _size) continue;
+					// 边框像素中心的方向落在相邻面上，取最近的像素
+					Vec3f d = TexelDirection(face, x, y);
+					float u, v;
+					int f = DirectionToFace(d, u, v);
+					int sx = Between(0, _size - 1, (int)((u + 1.0f) * 0.5f * _size));
+					int sy = Between(0, _size - 1, (int)((v + 1.0f) * 0.5f * _size));
+					_texels[(face * _stride + y + 1) * _stride + x + 1] = At(f, sx, sy);
+				}
+			}
+		}
+	}
+
+	// 双线性采样，方向不需要归一化
+	inline Vec3f Sample(const Vec3f& dir) const {
+		float u, v;
+		int face = DirectionToFace(dir, u, v);
+		// 像素中心对齐，边框保证 x0/y0 在 [-1, size - 1] 范围内都能安全读取
+		float fx = Between(-0.5f, _size - 0.5f, (u + 1.0f) * 0.5f * _size - 0.5f);
+		float fy = Between(-0.5f, _size - 0.5f, (v + 1.0f) * 0.5f * _size - 0.5f);
+		int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+		float dx = fx - x0, dy = fy - y0;
+		const Vec3f *p = &_texels[(face * _stride + y0 + 1) * _stride + x0 + 1];
+		Vec3f c0 = p[0] + (p[1] - p[0]) * dx;
+		Vec3f c1 = p[_stride] + (p[_stride + 1] - p[_stride]) * dx;
+		return c0 + (c1 - c0) * dy;
+	}
+
+	// 缩小一半，2x2 像素取平均
+	inline CubeMap Downsample() const {
+		CubeMap out(Max(1, _size / 2));
+		int scale = (_size > 1)? 2 : 1;
+		for (int face = 0; face < 6; face++) {
+			for (int y = 0; y < out._size; y++) {
+				for (int x = 0; x < out._size; x++) {
+					Vec3f c;
+					for (int j = 0; j < scale; j++) {
+						for (int i = 0; i < scale; i++)
+							c += At(face, x * scale + i, y * scale + j);
+					}
+					out.At(face, x, y) = c / (float)(scale * scale);
+				}
+			}
+		}
+		out.UpdateBorder();
+		return out;
+	}
+
+	// 计算所有像素的 FNV-1a 哈希，用于判断磁盘缓存是否过期
+	inline uint64_t Hash() const {
+		uint64_t h = 14695981039346656037ull;
+		for (int face = 0; face < 6; face++) {
+			for (int y = 0; y < _size; y++) {
+				const uint8_t *p = (const uint8_t*)&At(face, 0, y);
+				for (size_t i = 0; i < sizeof(Vec3f) * _size; i++) {
+					h ^= p[i];
+					h *= 1099511628211ull;
+				}
+			}
+		}
+		return h;
+	}
+
+protected:
+	int _size;
+	int _stride;
+	std::vector<Vec3f> _texels;
+};
+
+
+//---------------------------------------------------------------------
+// 预滤波的环境光照
+//---------------------------------------------------------------------
+class EnvironmentMap
+{
+public:
+	// source 为原始环境贴图，levels 为高光 mip 层数（对应粗糙度 0 到 1），
+	// cache 不为 NULL 时先尝试从该文件加载，失败则计算完保存到该文件
+	inline EnvironmentMap(const CubeMap& source, int levels = 5, const char *cache = NULL,
+			int threads = ParallelDefaultThreads()) {
+		_levels = Max(1, levels);
+		uint64_t hash = source.Hash() ^ (uint64_t)_levels;
+		_from_cache = (cache != NULL) && LoadCache(cache, hash, source.GetSize());
+		if (!_from_cache) {
+			Prefilter(source, threads);
+			if (cache) SaveCache(cache, hash);
+		}
+	}
+
+public:
+
+	// 漫反射辐照度：法向 n 方向半球的余弦加权积分，直接用球谐系数计算
+	inline Vec3f Irradiance(const Vec3f& n) const {
+		// Ramamoorthi & Hanrahan, An Efficient Representation for Irradiance Environment Maps
+		const float c1 = 0.429043f, c2 = 0.511664f, c3 = 0.743125f, c4 = 0.886227f, c5 = 0.247708f;
+		const Vec3f *L = _sh;
+		float x = n.x, y = n.y, z = n.z;
+		Vec3f e = L[0] * c4 + L[6] * (c3 * z * z) - L[6] * c5
+			+ (L[3] * x + L[1] * y + L[2] * z) * (2.0f * c2)
+			+ L[8] * (c1 * (x * x - y * y))
+			+ (L[4] * (x * y) + L[7] * (x * z) + L[5] * (y * z)) * (2.0f * c1);
+		return vector_max(e, Vec3f()) * (1.0f / 3.1415926f);
+	}
+
+	// 高光：沿反射方向 r 采样对应粗糙度的 mip，在相邻两层之间线性插值
+	inline Vec3f Specular(const Vec3f& r, float roughness) const {
+		float level = Saturate(roughness) * (_levels - 1);
+		int l0 = (int)level;
+		int l1 = Min(l0 + 1, _levels - 1);
+		Vec3f c0 = _mips[l0].Sample(r);
+		if (l1 == l0) return c0;
+		return vector_lerp(c0, _mips[l1].Sample(r), level - l0);
+	}
+
+	inline int GetLevels() const { return _levels; }
+	inline const CubeMap& GetLevel(int level) const { return _mips[level]; }
+
+	// 是否是从磁盘缓存加载的
+	inline bool IsFromCache() const { return _from_cache; }
+
+protected:
+
+	// 预滤波时积分用的源贴图尺寸
+	static const int PREFILTER_SOURCE_SIZE = 32;
+
+	inline void Prefilter(const CubeMap& source, int threads) {
+		// 降采样出一个小的源贴图，用于球谐投影和高光卷积
+		CubeMap small = source;
+		while (small.GetSize() > PREFILTER_SOURCE_SIZE) small = small.Downsample();
+		int ss = small.GetSize();
+
+		// 预先计算源贴图每个像素的方向和立体角
+		std::vector<Vec3f> dirs, colors;
+		std::vector<float> weights;
+		for (int face = 0; face < 6; face++) {
+			for (int y = 0; y < ss; y++) {
+				for (int x = 0; x < ss; x++) {
+					dirs.push_back(vector_normalize(small.TexelDirection(face, x, y)));
+					colors.push_back(small.At(face, x, y));
+					weights.push_back(small.TexelSolidAngle(x, y));
+				}
+			}
+		}
+
+		// 球谐投影：按立体角加权求和
+		for (int i = 0; i < 9; i++) _sh[i] = Vec3f();
+		for (size_t i = 0; i < dirs.size(); i++) {
+			const Vec3f& d = dirs[i];
+			Vec3f c = colors[i] * weights[i];
+			_sh[0] += c * 0.282095f;
+			_sh[1] += c * (0.488603f * d.y);
+			_sh[2] += c * (0.488603f * d.z);
+			_sh[3] += c * (0.488603f * d.x);
+			_sh[4] += c * (1.092548f * d.x * d.y);
+			_sh[5] += c * (1.092548f * d.y * d.z);
+			_sh[6] += c * (0.315392f * (3.0f * d.z * d.z - 1.0f));
+			_sh[7] += c * (1.092548f * d.x * d.z);
+			_sh[8] += c * (0.546274f * (d.x * d.x - d.y * d.y));
+		}
+
+		// 高光 mip：第 0 层直接使用原图，其他层按照粗糙度对应的 Phong 波瓣卷积，
+		// 假设视线方向等于法向等于反射方向 (N = V = R)
+		_mips.clear();
+		_mips.push_back(source);
+		int size = source.GetSize();
+		for (int level = 1; level < _levels; level++) {
+			size = Max(1, size / 2);
+			CubeMap mip(size);
+			float roughness = level / (float)(_levels - 1);
+			float alpha = Max(roughness * roughness, 0.001f);
+			float power = 2.0f / (alpha * alpha) - 2.0f;
+			// 每个任务处理一个面的一行
+			ParallelFor(6 * size, threads, [&] (int task) {
+					int face = task / size, y = task % size;
+					for (int x = 0; x < size; x++) {
+						Vec3f n = vector_normalize(mip.TexelDirection(face, x, y));
+						Vec3f sum;
+						float total = 0.0f;
+						for (size_t i = 0; i < dirs.size(); i++) {
+							float d = vector_dot(n, dirs[i]);
+							if (d <= 0.0f) continue;
+							float w = powf(d, power) * weights[i];
+							sum += colors[i] * w;
+							total += w;
+						}
+						mip.At(face, x, y) = (total > 0.0f)? sum / total : small.Sample(n);
+					}
+				});
+			mip.UpdateBorder();
+			_mips.push_back(mip);
+		}
+	}
+
+	// 缓存文件格式：魔数，哈希，层数，原图尺寸，9 个球谐系数，各层像素
+	inline bool LoadCache(const char *filename, uint64_t hash, int size) {
+		FILE *fp = fopen(filename, "rb");
+		if (fp == NULL) return false;
+		uint32_t head[4];
+		uint64_t h = 0;
+		bool ok = (fread(head, sizeof(head), 1, fp) == 1) && (fread(&h, sizeof(h), 1, fp) == 1);
+		ok = ok && head[0] == CACHE_MAGIC && h == hash;
+		ok = ok && (int)head[1] == _levels && (int)head[2] == size;
+		ok = ok && fread(_sh, sizeof(Vec3f), 9, fp) == 9;
+		_mips.clear();
+		for (int level = 0; ok && level < _levels; level++) {
+			CubeMap mip(size);
+			for (int face = 0; ok && face < 6; face++) {
+				for (int y = 0; ok && y < size; y++)
+					ok = fread(&mip.At(face, 0, y), sizeof(Vec3f), size, fp) == (size_t)size;
+			}
+			mip.UpdateBorder();
+			_mips.push_back(mip);
+			size = Max(1, size / 2);
+		}
+		fclose(fp);
+		if (!ok) _mips.clear();
+		return ok;
+	}
+
+	inline bool SaveCache(const char *filename, uint64_t hash) const {
+		FILE *fp = fopen(filename, "wb");
+		if (fp == NULL) return false;
+		uint32_t head[4] = { CACHE_MAGIC, (uint32_t)_levels, (uint32_t)_mips[0].GetSize(), 0 };
+		bool ok = fwrite(head, sizeof(head), 1, fp) == 1 &&
+			fwrite(&hash, sizeof(hash), 1, fp) == 1 &&
+			fwrite(_sh, sizeof(Vec3f), 9, fp) == 9;
+		for (auto &mip: _mips) {
+			size_t size = (size_t)mip.GetSize();
+			for (int face = 0; ok && face < 6; face++) {
+				for (int y = 0; ok && y < mip.GetSize(); y++)
+					ok = fwrite(&mip.At(face, 0, y), sizeof(Vec3f), size, fp) == size;
+			}
+		}
+		// 写了一半的缓存下次加载时会被当成有效数据，失败时删掉
+		if (fclose(fp) != 0) ok = false;
+		if (!ok) remove(filename);
+		return ok;
+	}
+
+	static const uint32_t CACHE_MAGIC = 0x43564e45;   // "ENVC"
+
+protected:
+	int _levels;
+	bool _from_cache;
+	Vec3f _sh[9];                  // 辐照度的球谐系数
+	std::vector<CubeMap> _mips;    // 按粗糙度预滤波的高光 mip
+};
+
+
+#endif
+
+
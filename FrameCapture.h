@@ -0,0 +1,555 @@
+//=====================================================================
+//
+// FrameCapture.h - 帧捕获和重放
+//
+// Created by agent on 2026/10/19
+//
+// - FrameCapture 挂到 RenderHelp::SetCapture 上，记录一帧里每次清屏和
+//   绘制的渲染状态，VS 对每个顶点的输出 (裁剪空间坐标和 varying)，
+//   精灵和光线投射的网格，用到的纹理按哈希去重后保存一份
+// - 像素着色器如果是 ShaderProgram，保存源代码和 uniform，重放时重新
+//   编译；C++ 写的 PS 无法保存，重放时输出白色
+// - Replay 在任意渲染模式下 (光栅化算法，线程数，逐像素或者像素包)
+//   重新执行这一帧，分别统计各阶段的耗时和硬件计数，并和捕获时的画面比较
+//
+//=====================================================================
+#ifndef _FRAME_CAPTURE_H_
+#define _FRAME_CAPTURE_H_
+
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "RenderHelp.h"
+#include "ShaderDSL.h"
+#include "PerfCounter.h"
+
+
+//---------------------------------------------------------------------
+// 捕获的数据
+//---------------------------------------------------------------------
+
+// VS 对一个顶点的输出
+struct CapturedVertex {
+	int index;               // VS 的 index
+	Vec4f pos;               // 裁剪空间坐标
+	ShaderContext context;   // varying
+};
+
+enum CaptureCommandType {
+	CAPTURE_CLEAR = 0,
+	CAPTURE_DRAW = 1,        // DrawPrimitive / DrawIndexedPrimitive
+	CAPTURE_SPRITES = 2,     // DrawSprites
+	CAPTURE_RAYCAST = 3,     // RayCastPrimitive
+	CAPTURE_TYPE_COUNT,
+};
+
+struct CaptureCommand {
+	int type;
+	RenderState state;
+	int program;                 // 着色程序编号，-1 表示 C++ 写的 PS
+	int topology;
+	int count;
+	std::vector<int> indices;    // 索引数组，为空时 VS 的 index 依次为 0 到 count - 1
+	std::vector<CapturedVertex> vertices;    // 用到的顶点，按 index 从小到大排列
+	std::vector<Sprite> sprites;
+	int texture;                 // 精灵纹理编号，-1 表示没有纹理
+	std::vector<Vec3f> mesh;     // 光线投射的三角形，每三个顶点一组
+	Mat4x4f mvp;
+};
+
+// 重放选项：负数或者 0 表示沿用捕获时的设置
+struct ReplayOptions {
+	int rasterizer;          // RasterizerMode
+	int threads;             // 线程数
+	bool packet;             // 着色程序按像素包执行 (PixelPacketShader)，否则逐像素执行
+	PerfCounters *perf;      // CAPTURE_TYPE_COUNT 个计数器，按命令类型分别累加，NULL 表示不统计
+
+	inline ReplayOptions(): rasterizer(-1), threads(0), packet(true), perf(NULL) {}
+};
+
+// 重放结果：各阶段的耗时 (毫秒)，以及和捕获画面的差异
+struct ReplayStats {
+	double clear;
+	double triangles;
+	double sprites;
+	double raycast;
+	double total;
+	int commands;
+	int unreplayable;        // 使用 C++ PS 的绘制次数，这些绘制的颜色和捕获时不同
+	int diff_pixels;         // 和捕获画面不同的像素数
+	int max_diff;            // 单个颜色分量的最大差值
+};
+
+
+//---------------------------------------------------------------------
+// FrameCapture
+//---------------------------------------------------------------------
+class FrameCapture: public CaptureSink
+{
+public:
+	inline FrameCapture(): _program(NULL), _width(0), _height(0) {}
+
+	// 设置之后的绘制使用的着色程序，uniform 的值在每次绘制时保存；
+	// PS 是 C++ 函数时设置为 NULL
+	inline void SetProgram(const ShaderProgram *program) { _program = program; }
+
+	inline void Reset() {
+		_commands.clear();
+		_textures.clear();
+		_texture_hash.clear();
+		_texture_index.clear();
+		_programs.clear();
+		_reference.reset();
+		_program = NULL;
+	}
+
+	inline int GetCommandCount() const { return (int)_commands.size(); }
+	inline const CaptureCommand& GetCommand(int index) const { return _commands[index]; }
+	inline int GetTextureCount() const { return (int)_textures.size(); }
+	inline int GetProgramCount() const { return (int)_programs.size(); }
+	inline int GetWidth() const { return _width; }
+	inline int GetHeight() const { return _height; }
+
+	// 捕获的顶点总数
+	inline int GetVertexCount() const {
+		int count = 0;
+		for (const CaptureCommand& cmd: _commands) count += (int)cmd.vertices.size();
+		return count;
+	}
+
+public:
+
+	inline virtual void OnClear(const RenderHelp& rh) {
+		NewCommand(rh, CAPTURE_CLEAR);
+	}
+
+	inline virtual void OnDraw(const RenderHelp& rh, PrimitiveTopology topology, const int *indices, int count) {
+		CaptureCommand& cmd = NewCommand(rh, CAPTURE_DRAW);
+		cmd.topology = topology;
+		cmd.count = count;
+		std::vector<int> used;
+		if (indices) {
+			cmd.indices.assign(indices, indices + count);
+			for (int i = 0; i < count; i++)
+				if (indices[i] >= 0) used.push_back(indices[i]);
+			std::sort(used.begin(), used.end());
+			used.erase(std::unique(used.begin(), used.end()), used.end());
+		}
+		else {
+			for (int i = 0; i < count; i++) used.push_back(i);
+		}
+		CaptureVertices(rh, used, cmd);
+	}
+
+	inline virtual void OnSprites(const RenderHelp& rh, const Sprite *sprites, int count, const Bitmap *texture) {
+		CaptureCommand& cmd = NewCommand(rh, CAPTURE_SPRITES);
+		cmd.sprites.assign(sprites, sprites + count);
+		cmd.texture = AddTexture(texture);
+	}
+
+	inline virtual void OnRayCast(const RenderHelp& rh, const MeshBVH& bvh, const Mat4x4f& mvp) {
+		CaptureCommand& cmd = NewCommand(rh, CAPTURE_RAYCAST);
+		cmd.mvp = mvp;
+		std::vector<int> used;
+		for (int i = 0; i < bvh.GetTriangleCount(); i++) {
+			for (int k = 0; k < 3; k++) {
+				cmd.mesh.push_back(bvh.GetVertex(i, k));
+				used.push_back(i * 3 + k);
+			}
+		}
+		CaptureVertices(rh, used, cmd);
+	}
+
+public:
+
+	// 保存到文件，同时保存 rh 当前的画面，重放时用来比较
+	inline bool Save(const char *filename, const RenderHelp& rh) {
+		_reference = std::make_shared<Bitmap>(*rh.GetFrame());
+		std::ofstream out(filename, std::ios::binary);
+		if (out.fail()) return false;
+		int32_t head[6] = { CAPTURE_MAGIC, CAPTURE_VERSION, _width, _height,
+			(int32_t)_textures.size(), (int32_t)_programs.size() };
+		out.write((const char*)head, sizeof(head));
+		for (int i = 0; i < (int)_textures.size(); i++) {
+			Write(out, _texture_hash[i]);
+			WriteBitmap(out, *_textures[i]);
+		}
+		for (const std::string& program: _programs) WriteVector(out, std::vector<char>(program.begin(), program.end()));
+		WriteBitmap(out, *_reference);
+		Write(out, (int32_t)_commands.size());
+		for (const CaptureCommand& cmd: _commands) {
+			int32_t info[5] = { cmd.type, cmd.program, cmd.topology, cmd.count, cmd.texture };
+			out.write((const char*)info, sizeof(info));
+			Write(out, cmd.state);
+			Write(out, cmd.mvp);
+			WriteVector(out, cmd.indices);
+			WriteVector(out, cmd.sprites);
+			WriteVector(out, cmd.mesh);
+			Write(out, (int32_t)cmd.vertices.size());
+			for (const CapturedVertex& v: cmd.vertices) {
+				Write(out, (int32_t)v.index);
+				Write(out, v.pos);
+				WriteMap(out, v.context.varying_float);
+				WriteMap(out, v.context.varying_vec2f);
+				WriteMap(out, v.context.varying_vec3f);
+				WriteMap(out, v.context.varying_vec4f);
+			}
+		}
+		return (bool)out;
+	}
+
+	inline bool Load(const char *filename) {
+		Reset();
+		std::ifstream in(filename, std::ios::binary);
+		if (in.fail()) return false;
+		int32_t head[6];
+		in.read((char*)head, sizeof(head));
+		if (!in || head[0] != CAPTURE_MAGIC || head[1] != CAPTURE_VERSION) return false;
+		_width = head[2];
+		_height = head[3];
+		for (int i = 0; in && i < head[4]; i++) {
+			uint64_t hash = 0;
+			Read(in, hash);
+			_texture_index[hash] = (int)_textures.size();
+			_texture_hash.push_back(hash);
+			_textures.push_back(ReadBitmap(in));
+		}
+		for (int i = 0; in && i < head[5]; i++) {
+			std::vector<char> data;
+			ReadVector(in, data);
+			_programs.push_back(std::string(data.begin(), data.end()));
+		}
+		_reference = ReadBitmap(in);
+		int32_t count = 0;
+		Read(in, count);
+		for (int i = 0; in && i < count; i++) {
+			_commands.push_back(CaptureCommand());
+			CaptureCommand& cmd = _commands.back();
+			int32_t info[5];
+			in.read((char*)info, sizeof(info));
+			cmd.type = info[0];
+			cmd.program = info[1];
+			cmd.topology = info[2];
+			cmd.count = info[3];
+			cmd.texture = info[4];
+			Read(in, cmd.state);
+			Read(in, cmd.mvp);
+			ReadVector(in, cmd.indices);
+			ReadVector(in, cmd.sprites);
+			ReadVector(in, cmd.mesh);
+			int32_t nverts = 0;
+			Read(in, nverts);
+			if (nverts < 0) in.setstate(std::ios::failbit);
+			for (int j = 0; in && j < nverts; j++) {
+				CapturedVertex v;
+				int32_t index = 0;
+				Read(in, index);
+				v.index = index;
+				Read(in, v.pos);
+				ReadMap(in, v.context.varying_float);
+				ReadMap(in, v.context.varying_vec2f);
+				ReadMap(in, v.context.varying_vec3f);
+				ReadMap(in, v.context.varying_vec4f);
+				cmd.vertices.push_back(v);
+			}
+			if (in && !IsValidCommand(cmd)) in.setstate(std::ios::failbit);
+		}
+		if (!in || _reference == NULL) {
+			Reset();
+			return false;
+		}
+		return true;
+	}
+
+	// 在 rh 上重放捕获的一帧，rh 会被重新初始化为捕获时的尺寸。
+	// 着色程序不能被多个线程同时执行，光线投射的绘制固定使用单线程
+	inline bool Replay(RenderHelp& rh, const ReplayOptions& options, ReplayStats& stats) const {
+		memset(&stats, 0, sizeof(stats));
+		if (_width <= 0 || _height <= 0) return false;
+		rh.Init(_width, _height);
+		rh.SetCapture(NULL);
+		int threads = (options.threads > 0)? options.threads : rh.GetThreads();
+		rh.SetThreads(threads);
+
+		// 重新编译着色程序
+		std::vector<std::unique_ptr<ShaderProgram>> programs;
+		for (const std::string& data: _programs) {
+			programs.push_back(std::unique_ptr<ShaderProgram>(new ShaderProgram()));
+			std::istringstream in(data);
+			if (!programs.back()->Load(in, [this] (int id) -> const Bitmap* {
+					return (id >= 0 && id < (int)_textures.size())? _textures[id].get() : NULL;
+				})) return false;
+		}
+
+		// VS 直接返回捕获的输出
+		const CaptureCommand *current = NULL;
+		std::vector<int> lookup;
+		rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+				const CapturedVertex& v = current->vertices[lookup[index]];
+				output.varying_float = v.context.varying_float;
+				output.varying_vec2f = v.context.varying_vec2f;
+				output.varying_vec3f = v.context.varying_vec3f;
+				output.varying_vec4f = v.context.varying_vec4f;
+				return v.pos;
+			});
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (const CaptureCommand& cmd: _commands) {
+			RenderState state = cmd.state;
+			if (options.rasterizer >= 0) state.rasterizer = (RasterizerMode)options.rasterizer;
+			rh.SetState(state);
+			current = &cmd;
+			lookup.assign(cmd.vertices.empty()? 0 : cmd.vertices.back().index + 1, 0);
+			for (int i = 0; i < (int)cmd.vertices.size(); i++) lookup[cmd.vertices[i].index] = i;
+			if (cmd.type == CAPTURE_DRAW || cmd.type == CAPTURE_RAYCAST) {
+				if (cmd.program >= 0 && cmd.program < (int)programs.size()) {
+					ShaderProgram *program = programs[cmd.program].get();
+					rh.SetPixelShader(program->GetPixelShader());
+					rh.SetPixelPacketShader(options.packet? program->GetShader() : NULL);
+				}
+				else {
+					rh.SetPixelShader([] (ShaderContext&) -> Vec4f { return Vec4f(1, 1, 1, 1); });
+					rh.SetPixelPacketShader(NULL);
+					stats.unreplayable++;
+				}
+			}
+			// 计数器只包含命令本身，和下面的耗时统计范围相同
+			PerfCounters *perf = (options.perf && cmd.type < CAPTURE_TYPE_COUNT)? &options.perf[cmd.type] : NULL;
+			auto ts = std::chrono::high_resolution_clock::now();
+			if (perf) perf->Start();
+			double *stage = &stats.clear;
+			if (cmd.type == CAPTURE_CLEAR) {
+				rh.Clear();
+			}
+			else if (cmd.type == CAPTURE_DRAW) {
+				stage = &stats.triangles;
+				if (cmd.indices.empty())
+					rh.DrawPrimitive((PrimitiveTopology)cmd.topology, cmd.count);
+				else
+					rh.DrawIndexedPrimitive((PrimitiveTopology)cmd.topology, &cmd.indices[0], cmd.count);
+			}
+			else if (cmd.type == CAPTURE_SPRITES) {
+				stage = &stats.sprites;
+				const Bitmap *texture = (cmd.texture >= 0)? _textures[cmd.texture].get() : NULL;
+				rh.DrawSprites(&cmd.sprites[0], (int)cmd.sprites.size(), texture);
+			}
+			else if (cmd.type == CAPTURE_RAYCAST) {
+				stage = &stats.raycast;
+				// 建立 BVH 不算在重放时间里
+				if (perf) perf->Stop();
+				auto tb = std::chrono::high_resolution_clock::now();
+				MeshBVH bvh(cmd.mesh);
+				ts += std::chrono::high_resolution_clock::now() - tb;
+				if (perf) perf->Start();
+				if (cmd.program >= 0) rh.SetThreads(1);
+				rh.RayCastPrimitive(bvh, cmd.mvp);
+				rh.SetThreads(threads);
+			}
+			if (perf) perf->Stop();
+			auto te = std::chrono::high_resolution_clock::now();
+			*stage += std::chrono::duration<double, std::milli>(te - ts).count();
+			stats.commands++;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		stats.total = std::chrono::duration<double, std::milli>(end - start).count();
+
+		// 和捕获时的画面比较
+		if (_reference) {
+			SharedBitmap frame = rh.GetFrame();
+			for (int y = 0; y < _height; y++) {
+				const uint8_t *a = frame->GetLine(y);
+				const uint8_t *b = _reference->GetLine(y);
+				for (int x = 0; x < _width; x++, a += 4, b += 4) {
+					int diff = 0;
+					for (int k = 0; k < 4; k++) diff = Max(diff, Abs(a[k] - b[k]));
+					if (diff > 0) stats.diff_pixels++;
+					stats.max_diff = Max(stats.max_diff, diff);
+				}
+			}
+		}
+		rh.SetVertexShader(NULL);
+		rh.SetPixelShader(NULL);
+		rh.SetPixelPacketShader(NULL);
+		return true;
+	}
+
+protected:
+
+	enum { CAPTURE_MAGIC = 0x43464852, CAPTURE_VERSION = 2 };    // "RHFC"
+
+	inline CaptureCommand& NewCommand(const RenderHelp& rh, int type) {
+		_width = rh.GetWidth();
+		_height = rh.GetHeight();
+		_commands.push_back(CaptureCommand());
+		CaptureCommand& cmd = _commands.back();
+		cmd.type = type;
+		cmd.state = rh.GetState();
+		// 只有三角形和光线投射会执行 PS，清屏和精灵不需要保存着色程序
+		cmd.program = (type == CAPTURE_DRAW || type == CAPTURE_RAYCAST)? AddProgram() : -1;
+		cmd.topology = TOPOLOGY_TRIANGLE_LIST;
+		cmd.count = 0;
+		cmd.texture = -1;
+		cmd.mvp = matrix_set_identity();
+		return cmd;
+	}
+
+	// 检查读入的命令，重放时直接用这些序号访问数组。顶点按序号严格递增，
+	// 绘制用到的每个顶点都必须被捕获过
+	inline bool IsValidCommand(const CaptureCommand& cmd) const {
+		if (cmd.type < 0 || cmd.type >= CAPTURE_TYPE_COUNT) return false;
+		if (cmd.program < -1 || cmd.program >= (int)_programs.size()) return false;
+		if (cmd.texture < -1 || cmd.texture >= (int)_textures.size()) return false;
+		for (int i = 0; i < (int)cmd.vertices.size(); i++) {
+			if (cmd.vertices[i].index < 0) return false;
+			if (i > 0 && cmd.vertices[i].index <= cmd.vertices[i - 1].index) return false;
+		}
+		auto captured = [&] (int index) -> bool {
+			auto it = std::lower_bound(cmd.vertices.begin(), cmd.vertices.end(), index,
+				[] (const CapturedVertex& v, int index) { return v.index < index; });
+			return it != cmd.vertices.end() && it->index == index;
+		};
+		// 序号从 0 开始连续时，最后一个顶点的序号等于个数减一
+		int nverts = (int)cmd.vertices.size();
+		bool sequential = (nverts == 0 || cmd.vertices.back().index == nverts - 1);
+		if (cmd.type == CAPTURE_DRAW) {
+			if (cmd.count < 0 || cmd.topology < TOPOLOGY_TRIANGLE_LIST || cmd.topology > TOPOLOGY_TRIANGLE_FAN)
+				return false;
+			if (cmd.indices.empty())
+				return cmd.count == nverts && sequential;
+			if ((int)cmd.indices.size() != cmd.count) return false;
+			for (int index: cmd.indices)
+				if (index >= 0 && !captured(index)) return false;
+		}
+		else if (cmd.type == CAPTURE_SPRITES) {
+			if (cmd.sprites.empty()) return false;
+		}
+		else if (cmd.type == CAPTURE_RAYCAST) {
+			if (cmd.mesh.size() % 3 != 0 || (int)cmd.mesh.size() != nverts || !sequential) 
+				return false;
+		}
+		return true;
+	}
+
+	// 对用到的每个顶点执行一次 VS，保存输出
+	inline void CaptureVertices(const RenderHelp& rh, const std::vector<int>& used, CaptureCommand& cmd) {
+		const VertexShader& vs = rh.GetVertexShader();
+		cmd.vertices.resize(used.size());
+		for (int i = 0; i < (int)used.size(); i++) {
+			CapturedVertex& v = cmd.vertices[i];
+			v.index = used[i];
+			v.pos = vs(used[i], v.context);
+		}
+	}
+
+	// 纹理按内容的哈希去重，保存一份拷贝。同一个纹理对象在两次绘制之间
+	// 可能被修改，所以每次都重新计算哈希，不能按地址缓存
+	inline int AddTexture(const Bitmap *texture) {
+		if (texture == NULL) return -1;
+		uint64_t hash = texture->Hash();
+		auto it = _texture_index.find(hash);
+		if (it != _texture_index.end()) return it->second;
+		int index = (int)_textures.size();
+		_textures.push_back(std::make_shared<Bitmap>(*texture));
+		_texture_hash.push_back(hash);
+		_texture_index[hash] = index;
+		return index;
+	}
+
+	// 保存当前着色程序，内容相同的程序只保存一份
+	inline int AddProgram() {
+		if (_program == NULL) return -1;
+		std::ostringstream out;
+		_program->Save(out, [this] (const Bitmap *texture) { return AddTexture(texture); });
+		std::string data = out.str();
+		for (int i = (int)_programs.size() - 1; i >= 0; i--) {
+			if (_programs[i] == data) return i;
+		}
+		_programs.push_back(data);
+		return (int)_programs.size() - 1;
+	}
+
+	template <typename T> inline static void Write(std::ostream& out, const T& value) {
+		out.write((const char*)&value, sizeof(T));
+	}
+
+	template <typename T> inline static void Read(std::istream& in, T& value) {
+		in.read((char*)&value, sizeof(T));
+	}
+
+	template <typename T> inline static void WriteVector(std::ostream& out, const std::vector<T>& data) {
+		Write(out, (int32_t)data.size());
+		if (!data.empty()) out.write((const char*)&data[0], sizeof(T) * data.size());
+	}
+
+	template <typename T> inline static void ReadVector(std::istream& in, std::vector<T>& data) {
+		int32_t size = 0;
+		Read(in, size);
+		if (!in || size < 0 || size > (1 << 28)) {
+			in.setstate(std::ios::failbit);
+			return;
+		}
+		data.resize(size);
+		if (size > 0) in.read((char*)&data[0], sizeof(T) * size);
+	}
+
+	template <typename T> inline static void WriteMap(std::ostream& out, const std::map<int, T>& data) {
+		Write(out, (int32_t)data.size());
+		for (auto &it: data) {
+			Write(out, (int32_t)it.first);
+			Write(out, it.second);
+		}
+	}
+
+	template <typename T> inline static void ReadMap(std::istream& in, std::map<int, T>& data) {
+		int32_t size = 0;
+		Read(in, size);
+		for (int i = 0; in && i < size; i++) {
+			int32_t key = 0;
+			T value;
+			Read(in, key);
+			Read(in, value);
+			data[key] = value;
+		}
+	}
+
+	inline static void WriteBitmap(std::ostream& out, const Bitmap& bmp) {
+		Write(out, (int32_t)bmp.GetW());
+		Write(out, (int32_t)bmp.GetH());
+		for (int y = 0; y < bmp.GetH(); y++)
+			out.write((const char*)bmp.GetLine(y), bmp.GetW() * 4);
+	}
+
+	inline static std::shared_ptr<Bitmap> ReadBitmap(std::istream& in) {
+		int32_t w = 0, h = 0;
+		Read(in, w);
+		Read(in, h);
+		if (!in || w <= 0 || h <= 0 || w > 65536 || h > 65536) {
+			in.setstate(std::ios::failbit);
+			return NULL;
+		}
+		std::shared_ptr<Bitmap> bmp = std::make_shared<Bitmap>(w, h, false);
+		for (int y = 0; y < h; y++)
+			in.read((char*)bmp->GetLine(y), w * 4);
+		return bmp;
+	}
+
+protected:
+	std::vector<CaptureCommand> _commands;
+	std::vector<std::shared_ptr<Bitmap>> _textures;     // 纹理的拷贝
+	std::vector<uint64_t> _texture_hash;
+	std::map<uint64_t, int> _texture_index;             // 纹理哈希对应的编号
+	std::vector<std::string> _programs;                 // ShaderProgram::Save 的内容
+	const ShaderProgram *_program;
+	int _width;
+	int _height;
+	std::shared_ptr<Bitmap> _reference;                 // 捕获时的画面
+};
+
+
+#endif
+
+
@@ -19,18 +19,18 @@
 //---------------------------------------------------------------------
 // model
 //---------------------------------------------------------------------
+
+// 模型数据使用的数组，占用的内存计入 MEMORY_MESH：顶点属性这类大数组用
+// MemoryAlloc 分配，和 BVH 一样可以使用大页，每个面的小数组只计数
+template <typename T> using MeshArray = std::vector<T, MemoryAllocator<T, MEMORY_MESH>>;
+template <typename T> using MeshVector = std::vector<T, TrackedAllocator<T, MEMORY_MESH>>;
+
 class Model {
 public:
-	inline virtual ~Model() {
-		if (_diffusemap) delete _diffusemap;
-		if (_normalmap) delete _normalmap;
-		if (_specularmap) delete _specularmap;
-	}
+	inline virtual ~Model() {}
 
 	inline Model(const char *filename) {
-		_diffusemap = NULL;
-		_normalmap = NULL;
-		_specularmap = NULL;
+		_filename = filename;
 		std::ifstream in;
 		in.open(filename, std::ifstream::in);
 		if (in.fail()) return;
@@ -58,7 +58,7 @@ public:
 				_uv.push_back(uv);
 			}
 			else if (line.compare(0, 2, "f ") == 0) {
-				std::vector<Vec3i> f;
+				MeshVector<Vec3i> f;
 				Vec3i tmp;
 				iss >> trash;
 				while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
@@ -87,7 +87,7 @@ public:
 	}
 
 	inline Vec3f vert(int i) const { return _verts[i]; }
-	inline Vec3f vert(int iface, int nthvert) { return _verts[_faces[iface][nthvert][0]]; }
+	inline Vec3f vert(int iface, int nthvert) const { return _verts[_faces[iface][nthvert][0]]; }
 
 	inline Vec2f uv(int iface, int nthvert) const {
 		return _uv[_faces[iface][nthvert][1]];
@@ -110,31 +110,205 @@ public:
 		return {color[0], color[1], color[2]};
 	}
 
-	inline float Specular(Vec2f uv) {
+	// 复制模型时贴图只增加引用计数，不复制像素；移动时整个接管
+	inline Model(const Model& src) = default;
+	inline Model(Model&& src) noexcept = default;
+	inline Model& operator = (const Model& src) = default;
+	inline Model& operator = (Model&& src) noexcept = default;
+
+	// 取得贴图
+	inline const Bitmap *diffusemap() const { return _diffusemap.Get(); }
+	inline const Bitmap *normalmap() const { return _normalmap.Get(); }
+	inline const Bitmap *specularmap() const { return _specularmap.Get(); }
+
+	// 取得贴图的共享句柄，可以交给其他模型或者线程使用
+	inline SharedBitmap diffusemap_shared() const { return _diffusemap; }
+	inline SharedBitmap normalmap_shared() const { return _normalmap; }
+	inline SharedBitmap specularmap_shared() const { return _specularmap; }
+
+	inline float Specular(Vec2f uv) const {
 		Vec4f color = _specularmap->Sample2D(uv);
 		return color.b;
 	}
 
+	// 烘焙后的环境光遮蔽：1 表示完全不被遮挡，没有烘焙时返回 1
+	inline float ao(int iface, int nthvert) const {
+		return _ao.empty()? 1.0f : _ao[_faces[iface][nthvert][0]];
+	}
+
+	// 占用的内存：顶点，面，AO 和 BVH 计入 MEMORY_MESH，三张贴图计入
+	// MEMORY_TEXTURE。贴图可能和其他模型共享，这里按完整大小计算
+	inline MemoryUsage GetMemoryUsage() const {
+		MemoryUsage usage;
+		int64_t mesh = sizeof(Model);
+		mesh += _verts.capacity() * sizeof(Vec3f) + _norms.capacity() * sizeof(Vec3f);
+		mesh += _uv.capacity() * sizeof(Vec2f) + _ao.capacity() * sizeof(float);
+		mesh += _faces.capacity() * sizeof(MeshVector<Vec3i>);
+		for (const auto& f: _faces) mesh += f.capacity() * sizeof(Vec3i);
+		mesh += _bvh.GetMemorySize();
+		usage.bytes[MEMORY_MESH] = mesh;
+		const SharedBitmap *maps[3] = { &_diffusemap, &_normalmap, &_specularmap };
+		for (int i = 0; i < 3; i++) {
+			if (maps[i]->Get()) usage.bytes[MEMORY_TEXTURE] += maps[i]->Get()->GetMemorySize();
+		}
+		return usage;
+	}
+
+	// 取得网格的 BVH，第 i 个三角形对应第 i 个面的前三个顶点，第一次调用时建立
+	inline const MeshBVH& bvh() {
+		if (_bvh.GetTriangleCount() == 0 && !_faces.empty()) {
+			std::vector<Vec3f> verts;
+			for (int i = 0; i < nfaces(); i++) {
+				for (int j = 0; j < 3; j++) verts.push_back(vert(i, j));
+			}
+			_bvh.Build(verts);
+		}
+		return _bvh;
+	}
+
+	// 加载时烘焙逐顶点环境光遮蔽：从每个顶点沿法向半球按余弦分布发射 samples
+	// 条光线，统计 radius 距离内没有被网格挡住的比例，radius 为 0 时取包围盒
+	// 对角线的 0.2 倍。结果保存在模型同名的 _ao.cache 文件里，参数和网格内容
+	// 都相同时下次直接读取，渲染时通过 ao() 作为普通顶点属性传给着色器，没有额外开销
+	inline bool BakeAO(int samples = 64, float radius = 0.0f, int threads = ParallelDefaultThreads()) {
+		int count = nverts();
+		if (count == 0 || samples <= 0) return false;
+		const MeshBVH& mesh = bvh();
+		Vec3f bmin, bmax;
+		if (!mesh.GetBounds(bmin, bmax)) return false;
+		float diagonal = vector_length(bmax - bmin);
+		if (radius <= 0.0f) radius = diagonal * 0.2f;
+		std::string cache = cache_name("_ao.cache");
+		if (load_ao(cache, samples, radius)) return true;
+
+		// 顶点法向：相邻三角形面积加权的面法向之和
+		std::vector<Vec3f> normals(count);
+		for (int i = 0; i < nfaces(); i++) {
+			const MeshVector<Vec3i>& f = _faces[i];
+			Vec3f n = vector_cross(_verts[f[1][0]] - _verts[f[0][0]], _verts[f[2][0]] - _verts[f[0][0]]);
+			for (int j = 0; j < 3; j++) normals[f[j][0]] += n;
+		}
+
+		_ao.assign(count, 1.0f);
+		float offset = diagonal * 1e-4f;
+		ParallelFor(count, threads, [&] (int index) {
+				if (vector_length_square(normals[index]) == 0.0f) return;
+				Vec3f n = vector_normalize(normals[index]);
+				// 构造切线空间
+				Vec3f up = (Abs(n.x) < 0.9f)? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+				Vec3f t = vector_normalize(vector_cross(up, n));
+				Vec3f b = vector_cross(n, t);
+				// Hammersley 点集加上每个顶点不同的随机偏移，结果是确定的
+				uint32_t seed = (uint32_t)index * 2654435761u;
+				float shift = (seed >> 8) * (1.0f / 16777216.0f);
+				Ray ray;
+				ray.origin = _verts[index] + n * offset;
+				ray.tmax = radius;
+				int visible = 0;
+				for (int i = 0; i < samples; i++) {
+					float e1 = (i + 0.5f) / samples;
+					float e2 = radical_inverse(i) + shift;
+					if (e2 >= 1.0f) e2 -= 1.0f;
+					float r = sqrtf(e1);
+					float phi = 2.0f * 3.1415926f * e2;
+					ray.dir = t * (r * cosf(phi)) + b * (r * sinf(phi)) + n * sqrtf(1.0f - e1);
+					if (!mesh.Occluded(ray)) visible++;
+				}
+				_ao[index] = visible / (float)samples;
+			});
+
+		save_ao(cache, samples, radius);
+		return true;
+	}
+
 protected:
-	Bitmap *load_texture(std::string filename, const char *suffix) {
+	SharedBitmap load_texture(std::string filename, const char *suffix) {
 		std::string texfile(filename);
 		size_t dot = texfile.find_last_of(".");
-		if (dot == std::string::npos) return NULL;
+		if (dot == std::string::npos) return SharedBitmap();
 		texfile = texfile.substr(0, dot) + std::string(suffix);
-		Bitmap *texture = Bitmap::LoadFile(texfile.c_str());
+		std::unique_ptr<Bitmap> texture = Bitmap::LoadFile(texfile.c_str());
 		std::cout << "loading: " << texfile << ((texture)? " OK" : " failed") << "\n";
+		if (texture == NULL) return SharedBitmap();
 		texture->FlipVertical();
-		return texture;
+		return SharedBitmap(std::shared_ptr<Bitmap>(std::move(texture)));
+	}
+
+	// 和模型文件同名，后缀替换为 suffix 的缓存文件
+	std::string cache_name(const char *suffix) const {
+		size_t dot = _filename.find_last_of(".");
+		return _filename.substr(0, dot) + std::string(suffix);
+	}
+
+	// 以 2 为底的 radical inverse，用于生成 Hammersley 点集
+	inline static float radical_inverse(uint32_t bits) {
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return bits * (1.0f / 4294967296.0f);
+	}
+
+	// 顶点坐标和面的顶点索引的 FNV-1a 哈希，OBJ 修改以后 AO 缓存随之失效
+	uint64_t mesh_hash() const {
+		uint64_t h = 14695981039346656037ull;
+		auto feed = [&h] (const void *data, size_t size) {
+				const uint8_t *p = (const uint8_t*)data;
+				for (size_t i = 0; i < size; i++) {
+					h ^= p[i];
+					h *= 1099511628211ull;
+				}
+			};
+		if (!_verts.empty()) feed(&_verts[0], sizeof(Vec3f) * _verts.size());
+		for (const auto& f: _faces) {
+			for (const Vec3i& v: f) feed(&v[0], sizeof(int));
+		}
+		return h;
+	}
+
+	// AO 缓存格式：顶点数，采样数，半径，网格哈希，然后是每个顶点的遮蔽值
+	bool load_ao(const std::string& filename, int samples, float radius) {
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (in.fail()) return false;
+		int32_t head[2];
+		float r;
+		uint64_t hash;
+		in.read((char*)head, sizeof(head));
+		in.read((char*)&r, sizeof(r));
+		in.read((char*)&hash, sizeof(hash));
+		if (!in || head[0] != nverts() || head[1] != samples || r != radius) return false;
+		if (hash != mesh_hash()) return false;
+		MeshArray<float> ao(head[0]);
+		in.read((char*)&ao[0], sizeof(float) * ao.size());
+		if (!in) return false;
+		_ao.swap(ao);
+		return true;
+	}
+
+	bool save_ao(const std::string& filename, int samples, float radius) const {
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		if (out.fail()) return false;
+		int32_t head[2] = { nverts(), samples };
+		out.write((const char*)head, sizeof(head));
+		uint64_t hash = mesh_hash();
+		out.write((const char*)&radius, sizeof(radius));
+		out.write((const char*)&hash, sizeof(hash));
+		out.write((const char*)&_ao[0], sizeof(float) * _ao.size());
+		return (bool)out;
 	}
 
 protected:
-	std::vector<Vec3f> _verts;
-	std::vector<std::vector<Vec3i> > _faces;
-	std::vector<Vec3f> _norms;
-	std::vector<Vec2f> _uv;
-	Bitmap *_diffusemap;
-	Bitmap *_normalmap;
-	Bitmap *_specularmap;
+	MeshArray<Vec3f> _verts;
+	MeshVector<MeshVector<Vec3i> > _faces;
+	MeshArray<Vec3f> _norms;
+	MeshArray<Vec2f> _uv;
+	SharedBitmap _diffusemap;
+	SharedBitmap _normalmap;
+	SharedBitmap _specularmap;
+	std::string _filename;
+	MeshArray<float> _ao;       // 逐顶点环境光遮蔽
+	MeshBVH _bvh;
 };
 
 
@@ -0,0 +1,224 @@
+//=====================================================================
+//
+// PerfCounter.h - 硬件性能计数器，用于各个例子里的性能测试
+//
+// Created by agent on 2026/10/19
+//
+// Linux 下用 perf_event_open 读取当前线程以及之后创建的工作线程的
+// 周期数，指令数，L1D/LLC 缺失，dTLB 缺失，分支预测失败和缺页次数。
+// 计数器不允许使用时 (容器，虚拟机，perf_event_paranoid 限制，或者
+// 其他平台)，对应的值为 -1，报告里显示 n/a，测试照常进行
+//
+//=====================================================================
+#ifndef _PERF_COUNTER_H_
+#define _PERF_COUNTER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <sstream>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+//---------------------------------------------------------------------
+// 计数器
+//---------------------------------------------------------------------
+enum PerfEvent {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_PAGE_FAULTS,
+	PERF_EVENT_COUNT,
+};
+
+class PerfCounters
+{
+public:
+	inline PerfCounters() {
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			_fd[i] = -1;
+			_value[i] = 0;
+		}
+		_error = "not supported on this platform";
+	#if defined(__linux__)
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			_fd[i] = Open((PerfEvent)i);
+			if (_fd[i] < 0 && i == PERF_CYCLES) _error = strerror(errno);
+		}
+		if (_fd[PERF_CYCLES] >= 0) _error.clear();
+	#endif
+	}
+
+	inline virtual ~PerfCounters() {
+	#if defined(__linux__)
+		for (int i = 0; i < PERF_EVENT_COUNT; i++)
+			if (_fd[i] >= 0) close(_fd[i]);
+	#endif
+	}
+
+	// 计数器是否可用
+	inline bool IsAvailable(PerfEvent event) const { return _fd[event] >= 0; }
+
+	// 硬件计数器不可用的原因，可用时为空
+	inline const std::string& GetError() const { return _error; }
+
+	// 开始计数，Start/Stop 之间的计数会累加
+	inline void Start() {
+	#if defined(__linux__)
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			if (_fd[i] < 0) continue;
+			ReadCounter(i, _begin[i]);
+			ioctl(_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	#endif
+	}
+
+	inline void Stop() {
+	#if defined(__linux__)
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+			if (_fd[i] < 0) continue;
+			ioctl(_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+			Sample end;
+			ReadCounter(i, end);
+			// 计数器数量超过硬件支持时内核会轮流计数，按照实际计数的时间比例放大
+			uint64_t value = end.value - _begin[i].value;
+			uint64_t enabled = end.enabled - _begin[i].enabled;
+			uint64_t running = end.running - _begin[i].running;
+			if (running > 0 && running < enabled)
+				value = (uint64_t)((double)value * enabled / running);
+			_value[i] += (int64_t)value;
+		}
+	#endif
+	}
+
+	inline void Reset() {
+		for (int i = 0; i < PERF_EVENT_COUNT; i++) _value[i] = 0;
+	}
+
+	// 取得计数，不可用时返回 -1
+	inline int64_t Get(PerfEvent event) const { return (_fd[event] >= 0)? _value[event] : -1; }
+
+	// 每周期指令数，不可用时返回 0
+	inline double GetIPC() const {
+		if (Get(PERF_CYCLES) <= 0 || Get(PERF_INSTRUCTIONS) < 0) return 0.0;
+		return (double)Get(PERF_INSTRUCTIONS) / (double)Get(PERF_CYCLES);
+	}
+
+	inline static const char *GetName(PerfEvent event) {
+		static const char *names[PERF_EVENT_COUNT] = {
+			"cycles", "instructions", "L1D miss", "LLC miss", "dTLB miss", "branch miss", "page fault",
+		};
+		return names[event];
+	}
+
+	// 生成一行报告：IPC 以及每个 unit (比如 pixel, triangle) 的缺失次数
+	inline std::string Report(const char *unit = NULL, int64_t count = 0) const {
+		std::ostringstream os;
+		if (Get(PERF_CYCLES) >= 0 && Get(PERF_INSTRUCTIONS) >= 0)
+			os << "ipc " << GetIPC();
+		else
+			os << "ipc n/a";
+		for (int i = PERF_L1D_MISSES; i < PERF_EVENT_COUNT; i++) {
+			int64_t value = Get((PerfEvent)i);
+			os << ", " << GetName((PerfEvent)i) << " ";
+			if (value < 0)
+				os << "n/a";
+			else if (unit && count > 0)
+				os << (double)value / count << "/" << unit;
+			else
+				os << value;
+		}
+		if (!_error.empty()) os << " (hardware counters: " << _error << ")";
+		return os.str();
+	}
+
+protected:
+
+#if defined(__linux__)
+	struct Sample {
+		uint64_t value;
+		uint64_t enabled;
+		uint64_t running;
+	};
+
+	inline void ReadCounter(int index, Sample& sample) const {
+		if (read(_fd[index], &sample, sizeof(sample)) != (ssize_t)sizeof(sample))
+			memset(&sample, 0, sizeof(sample));
+	}
+
+	inline static uint64_t CacheConfig(uint64_t cache) {
+		return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	}
+
+	// 只统计用户态，inherit 使之后创建的工作线程也被计入
+	inline static int Open(PerfEvent event) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		switch (event) {
+		case PERF_CYCLES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PERF_INSTRUCTIONS:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PERF_L1D_MISSES:
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = CacheConfig(PERF_COUNT_HW_CACHE_L1D);
+			break;
+		case PERF_LLC_MISSES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			break;
+		case PERF_DTLB_MISSES:
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = CacheConfig(PERF_COUNT_HW_CACHE_DTLB);
+			break;
+		case PERF_BRANCH_MISSES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+		case PERF_PAGE_FAULTS:
+			attr.type = PERF_TYPE_SOFTWARE;
+			attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+			break;
+		default:
+			return -1;
+		}
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	Sample _begin[PERF_EVENT_COUNT];
+#endif
+
+protected:
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+protected:
+	int _fd[PERF_EVENT_COUNT];
+	int64_t _value[PERF_EVENT_COUNT];
+	std::string _error;
+};
+
+
+#endif
+
+
@@ -20,9 +20,11 @@
 #ifndef _RENDER_HELP_H_
 #define _RENDER_HELP_H_
 
+#include <stdlib.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdio.h>
 #include <math.h>
 #include <assert.h>
 
@@ -31,9 +33,24 @@
 #include <initializer_list>
 #include <stdexcept>
 #include <functional>
+#include <utility>
 #include <ostream>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <new>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
 
 
 //---------------------------------------------------------------------
@@ -715,6 +732,472 @@ typedef Matrix<4, 3, float> Mat4x3f;
 typedef Matrix<3, 4, float> Mat3x4f;
 
 
+//---------------------------------------------------------------------
+// 并行工具
+//---------------------------------------------------------------------
+
+// 取得默认的工作线程数量
+inline static int ParallelDefaultThreads() {
+	int n = (int)std::thread::hardware_concurrency();
+	return (n > 0)? n : 1;
+}
+
+// 并行执行 func(0) 到 func(count - 1)，threads 小于等于 1 时直接串行执行
+// 任务通过原子计数器动态领取，每个任务内部需要自己保证不和其他任务冲突
+inline static void ParallelFor(int count, int threads, const std::function<void(int)>& func) {
+	if (threads > count) threads = count;
+	if (threads <= 1) {
+		for (int i = 0; i < count; i++) func(i);
+		return;
+	}
+	std::atomic<int> next(0);
+	auto worker = [&] () {
+		for (int i = next++; i < count; i = next++) func(i);
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) pool.emplace_back(worker);
+	worker();
+	for (auto &t: pool) t.join();
+}
+
+// NUMA 拓扑：Linux 下从 /sys/devices/system/node 读取每个节点的 CPU 列表，
+// 其他平台或者读取失败时当作只有一个节点
+class NumaTopology
+{
+public:
+	inline static const NumaTopology& Get() {
+		static NumaTopology topology;
+		return topology;
+	}
+
+	inline int GetNodeCount() const { return (int)_cpus.size(); }
+	inline const std::vector<int>& GetCpus(int node) const { return _cpus[node]; }
+
+	// 当前线程所在的节点
+	inline int GetCurrentNode() const {
+	#if defined(__linux__)
+		int cpu = sched_getcpu();
+		if (cpu >= 0 && cpu < (int)_node_of_cpu.size()) return _node_of_cpu[cpu];
+	#endif
+		return 0;
+	}
+
+	// 把当前线程绑定到某个节点的所有 CPU 上，不支持时返回 false
+	inline bool PinCurrentThread(int node) const {
+	#if defined(__linux__)
+		if (_cpus[node].empty()) return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu: _cpus[node]) CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	#else
+		return false;
+	#endif
+	}
+
+protected:
+	inline NumaTopology() {
+	#if defined(__linux__)
+		for (int node = 0; ; node++) {
+			char name[128];
+			snprintf(name, sizeof(name), "/sys/devices/system/node/node%d/cpulist", node);
+			FILE *fp = fopen(name, "r");
+			if (fp == NULL) break;
+			// 格式为 "0-3,8-11"
+			std::vector<int> cpus;
+			int first, last;
+			char sep;
+			while (fscanf(fp, "%d", &first) == 1) {
+				last = first;
+				if (fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+					if (fscanf(fp, "%d", &last) != 1) break;
+					if (fscanf(fp, "%c", &sep) != 1) sep = 0;
+				}
+				for (int cpu = first; cpu <= last; cpu++) {
+					cpus.push_back(cpu);
+					if (cpu >= (int)_node_of_cpu.size()) _node_of_cpu.resize(cpu + 1, 0);
+					_node_of_cpu[cpu] = node;
+				}
+				if (sep != ',') break;
+			}
+			fclose(fp);
+			_cpus.push_back(cpus);
+		}
+	#endif
+		if (_cpus.empty()) _cpus.push_back(std::vector<int>());
+	}
+
+protected:
+	std::vector<std::vector<int>> _cpus;   // 每个节点的 CPU 编号
+	std::vector<int> _node_of_cpu;
+};
+
+
+// NUMA 调度统计：任务由所属节点上的线程执行记为同节点，被其他节点的线程
+// 拿走执行记为跨节点。这里统计的是任务的调度，不是实际的内存访问，跨节点
+// 执行的任务大部分访问会落到其他节点的内存上，但纹理等共享数据不在统计之内
+struct NumaStats {
+	std::atomic<int64_t> same_node;
+	std::atomic<int64_t> cross_node;
+
+	inline NumaStats(): same_node(0), cross_node(0) {}
+	inline NumaStats(const NumaStats& src) noexcept: 
+		same_node(src.same_node.load()), cross_node(src.cross_node.load()) {}
+
+	inline NumaStats& operator = (const NumaStats& src) noexcept {
+		same_node = src.same_node.load();
+		cross_node = src.cross_node.load();
+		return *this;
+	}
+
+	inline void Reset() { same_node = 0; cross_node = 0; }
+
+	// 跨节点调度的任务占的比例
+	inline float GetCrossNodeRatio() const {
+		int64_t total = same_node + cross_node;
+		return (total > 0)? (float)cross_node / (float)total : 0.0f;
+	}
+};
+
+
+// 按 NUMA 节点并行执行 func(0) 到 func(count - 1)：任务按照序号连续地分给
+// 各个节点，任务 i 属于节点 i * nodes / count，和按行分配的帧缓存内存一致。
+// 工作线程平均分到各个节点并绑定到节点的 CPU 上，先做完本节点的任务，
+// 再去帮其他节点。只有一个节点时等同于 ParallelFor
+inline static void ParallelForNodes(int count, int threads, const std::function<void(int)>& func,
+		NumaStats *stats = NULL) {
+	const NumaTopology& topology = NumaTopology::Get();
+	int nodes = topology.GetNodeCount();
+	if (nodes <= 1 || threads <= 1 || count < nodes) {
+		ParallelFor(count, threads, func);
+		if (stats) stats->same_node += count;
+		return;
+	}
+	if (threads > count) threads = count;
+	std::unique_ptr<std::atomic<int>[]> next(new std::atomic<int>[nodes]);
+	for (int n = 0; n < nodes; n++) next[n] = (int)((int64_t)n * count / nodes);
+	auto worker = [&] (int node, bool pin) {
+		if (pin) topology.PinCurrentThread(node);
+		int64_t same_node = 0, cross_node = 0;
+		for (int k = 0; k < nodes; k++) {
+			int n = (node + k) % nodes;
+			int end = (int)((int64_t)(n + 1) * count / nodes);
+			for (int i = next[n]++; i < end; i = next[n]++) {
+				func(i);
+				if (k == 0) same_node++; else cross_node++;
+			}
+		}
+		if (stats) {
+			stats->same_node += same_node;
+			stats->cross_node += cross_node;
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) 
+		pool.emplace_back(worker, i % nodes, true);
+	// 调用者不改变绑定，从自己当前所在的节点开始
+	worker(topology.GetCurrentNode(), false);
+	for (auto &t: pool) t.join();
+}
+
+
+//---------------------------------------------------------------------
+// 内存分配：帧缓存，深度缓存，纹理和网格数据等大块内存统一从这里分配，
+// 可以选择使用 2MB 的大页，减少随机访问纹理时的 TLB 缺失
+//---------------------------------------------------------------------
+
+// 不小于该尺寸的分配才使用大页
+const size_t HUGE_PAGE_MIN = 1 << 20;
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+// 分配方式
+enum MemoryKind {
+	MEMORY_HEAP = 0,          // 普通堆内存
+	MEMORY_HUGETLB = 1,       // hugetlbfs 预留的大页 (MAP_HUGETLB)
+	MEMORY_TRANSPARENT = 2,   // 2MB 对齐并用 madvise 请求透明大页 (THP)
+};
+
+// 内存用途，分别统计当前用量和峰值，用于估算每个请求需要的内存
+enum MemoryCategory {
+	MEMORY_GENERAL = 0,       // 其他
+	MEMORY_MESH = 1,          // 模型顶点，索引和网格 BVH
+	MEMORY_TEXTURE = 2,       // 纹理和普通位图
+	MEMORY_TARGET = 3,        // 帧缓存和深度缓存
+	MEMORY_SCRATCH = 4,       // 绘制过程中的临时数据
+	MEMORY_CACHED = 5,        // BitmapPool 里缓存待复用的内存
+	MEMORY_CATEGORY_COUNT = 6,
+};
+
+// 每块内存前面的头部，记录释放时需要的信息，大小为 64 保证返回地址的对齐
+struct MemoryHeader {
+	void *base;
+	size_t length;
+	int kind;
+	std::atomic<int> category;
+	char padding[64 - sizeof(void*) - sizeof(size_t) - sizeof(int) * 2];
+};
+
+// 全局状态：是否启用大页，各种方式分配的字节数，以及各种用途的用量和峰值
+struct MemoryState {
+	std::atomic<bool> huge_page;
+	std::atomic<int64_t> bytes[3];
+	std::atomic<int64_t> usage[MEMORY_CATEGORY_COUNT];
+	std::atomic<int64_t> peak[MEMORY_CATEGORY_COUNT];
+	std::atomic<int64_t> total;
+	std::atomic<int64_t> total_peak;
+
+	inline static MemoryState& Get() {
+		static MemoryState state;
+		return state;
+	}
+
+	// 记录用量变化，同时更新峰值
+	inline void Track(int category, int64_t delta) {
+		UpdatePeak(peak[category], usage[category] += delta);
+		UpdatePeak(total_peak, total += delta);
+	}
+
+	inline static void UpdatePeak(std::atomic<int64_t>& peak, int64_t value) {
+		int64_t current = peak.load();
+		while (value > current && !peak.compare_exchange_weak(current, value));
+	}
+
+protected:
+	inline MemoryState(): huge_page(false), total(0), total_peak(0) {
+		for (int i = 0; i < 3; i++) bytes[i] = 0;
+		for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) usage[i] = peak[i] = 0;
+	}
+};
+
+// 启用或关闭大页，只影响之后的分配
+inline static void MemorySetHugePage(bool enable) { MemoryState::Get().huge_page = enable; }
+inline static bool MemoryGetHugePage() { return MemoryState::Get().huge_page; }
+
+// 当前使用某种方式分配的字节数，用于确认大页是否真正生效
+inline static int64_t MemoryGetBytes(MemoryKind kind) { return MemoryState::Get().bytes[kind]; }
+
+// 某种用途当前占用和历史最高的字节数
+inline static int64_t MemoryGetUsage(MemoryCategory category) { return MemoryState::Get().usage[category]; }
+inline static int64_t MemoryGetPeak(MemoryCategory category) { return MemoryState::Get().peak[category]; }
+
+// 所有用途合计的当前用量和峰值，不包括没有经过这里分配的内存
+inline static int64_t MemoryGetTotal() { return MemoryState::Get().total; }
+inline static int64_t MemoryGetTotalPeak() { return MemoryState::Get().total_peak; }
+
+// 峰值重置为当前用量，比如每个请求开始前调用，结束后读取该请求的峰值
+inline static void MemoryResetPeak() {
+	MemoryState& state = MemoryState::Get();
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) state.peak[i] = state.usage[i].load();
+	state.total_peak = state.total.load();
+}
+
+// 记录不经过 MemoryAlloc 的内存，delta 为负表示释放
+inline static void MemoryTrack(MemoryCategory category, int64_t delta) {
+	MemoryState::Get().Track(category, delta);
+}
+
+inline static const char *MemoryCategoryName(MemoryCategory category) {
+	static const char *names[MEMORY_CATEGORY_COUNT] = {
+		"general", "mesh", "texture", "target", "scratch", "cached",
+	};
+	return names[category];
+}
+
+// 生成一行报告：每种用途的当前用量和峰值，单位 KB
+inline static std::string MemoryReport() {
+	std::ostringstream os;
+	os << "memory: total " << (MemoryGetTotal() >> 10) << "KB (peak " << (MemoryGetTotalPeak() >> 10) << "KB)";
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+		MemoryCategory category = (MemoryCategory)i;
+		os << ", " << MemoryCategoryName(category) << " " << (MemoryGetUsage(category) >> 10)
+			<< "KB (" << (MemoryGetPeak(category) >> 10) << "KB)";
+	}
+	return os.str();
+}
+
+// 分配 size 字节，返回的地址 64 字节对齐。启用大页并且尺寸足够大时先尝试
+// hugetlbfs，失败再用 THP，都不支持时退回普通堆内存，失败返回 NULL。
+// 分配的字节数计入 category 的用量
+inline static void *MemoryAlloc(size_t size, MemoryCategory category = MEMORY_GENERAL) {
+	MemoryState& state = MemoryState::Get();
+	size_t need = size + sizeof(MemoryHeader);
+	MemoryHeader *header = NULL;
+#if defined(__linux__)
+	if (state.huge_page && size >= HUGE_PAGE_MIN) {
+		size_t length = (need + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, 
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			header = (MemoryHeader*)p;
+			header->base = p;
+			header->length = length;
+			header->kind = MEMORY_HUGETLB;
+		}
+		else {
+			// 多映射 2MB 用于对齐，然后把头尾多余的部分还给系统
+			p = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, 
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p != MAP_FAILED) {
+				uintptr_t start = ((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+				size_t head = start - (uintptr_t)p;
+				if (head > 0) munmap(p, head);
+				if (head < HUGE_PAGE_SIZE) munmap((void*)(start + length), HUGE_PAGE_SIZE - head);
+				madvise((void*)start, length, MADV_HUGEPAGE);
+				header = (MemoryHeader*)start;
+				header->base = (void*)start;
+				header->length = length;
+				header->kind = MEMORY_TRANSPARENT;
+			}
+		}
+	}
+#endif
+	if (header == NULL) {
+		void *p = malloc(need + 64);
+		if (p == NULL) return NULL;
+		header = (MemoryHeader*)(((uintptr_t)p + 63) & ~(uintptr_t)63);
+		header->base = p;
+		header->length = need + 64;
+		header->kind = MEMORY_HEAP;
+	}
+	header->category = category;
+	state.bytes[header->kind] += (int64_t)header->length;
+	state.Track(category, (int64_t)header->length);
+	return header + 1;
+}
+
+inline static void MemoryFree(void *ptr) {
+	if (ptr == NULL) return;
+	MemoryHeader *header = (MemoryHeader*)ptr - 1;
+	MemoryState& state = MemoryState::Get();
+	state.bytes[header->kind] -= (int64_t)header->length;
+	state.Track(header->category, -(int64_t)header->length);
+#if defined(__linux__)
+	if (header->kind != MEMORY_HEAP) {
+		munmap(header->base, header->length);
+		return;
+	}
+#endif
+	free(header->base);
+}
+
+// 取得 MemoryAlloc 分配的内存当前计入的用途，ptr 为 NULL 时返回 MEMORY_GENERAL
+inline static MemoryCategory MemoryGetCategory(const void *ptr) {
+	if (ptr == NULL) return MEMORY_GENERAL;
+	return (MemoryCategory)((const MemoryHeader*)ptr - 1)->category.load();
+}
+
+// 取得 MemoryAlloc 分配的内存实际占用的字节数，包括头部和对齐，NULL 返回 0
+inline static size_t MemoryGetSize(const void *ptr) {
+	return ptr? ((const MemoryHeader*)ptr - 1)->length : 0;
+}
+
+// 把 MemoryAlloc 分配的内存改为计入另一种用途，比如纹理内存回到缓存池
+inline static void MemorySetCategory(void *ptr, MemoryCategory category) {
+	if (ptr == NULL) return;
+	MemoryHeader *header = (MemoryHeader*)ptr - 1;
+	int previous = header->category.exchange(category);
+	if (previous == (int)category) return;
+	MemoryState& state = MemoryState::Get();
+	state.Track(previous, -(int64_t)header->length);
+	state.Track(category, (int64_t)header->length);
+}
+
+// 用于 std::unique_ptr，释放 MemoryAlloc 分配的内存
+struct MemoryDeleter {
+	inline void operator () (void *ptr) const { MemoryFree(ptr); }
+};
+
+// 使用 MemoryAlloc 的 STL 分配器，用于网格这类大数组
+template <typename T, MemoryCategory CATEGORY = MEMORY_GENERAL> struct MemoryAllocator {
+	typedef T value_type;
+	template <typename U> struct rebind { typedef MemoryAllocator<U, CATEGORY> other; };
+	inline MemoryAllocator() {}
+	template <typename U> inline MemoryAllocator(const MemoryAllocator<U, CATEGORY>&) {}
+	inline T *allocate(size_t n) {
+		T *p = (T*)MemoryAlloc(n * sizeof(T), CATEGORY);
+		if (p == NULL) throw std::bad_alloc();
+		return p;
+	}
+	inline void deallocate(T *p, size_t) { MemoryFree(p); }
+	template <typename U> inline bool operator == (const MemoryAllocator<U, CATEGORY>&) const { return true; }
+	template <typename U> inline bool operator != (const MemoryAllocator<U, CATEGORY>&) const { return false; }
+};
+
+// 只计数不对齐的 STL 分配器，用于数量多的小块内存，比如模型的面索引
+template <typename T, MemoryCategory CATEGORY = MEMORY_GENERAL> struct TrackedAllocator {
+	typedef T value_type;
+	template <typename U> struct rebind { typedef TrackedAllocator<U, CATEGORY> other; };
+	inline TrackedAllocator() {}
+	template <typename U> inline TrackedAllocator(const TrackedAllocator<U, CATEGORY>&) {}
+	inline T *allocate(size_t n) {
+		T *p = (T*)::operator new(n * sizeof(T));
+		MemoryTrack(CATEGORY, (int64_t)(n * sizeof(T)));
+		return p;
+	}
+	inline void deallocate(T *p, size_t n) {
+		MemoryTrack(CATEGORY, -(int64_t)(n * sizeof(T)));
+		::operator delete(p);
+	}
+	template <typename U> inline bool operator == (const TrackedAllocator<U, CATEGORY>&) const { return true; }
+	template <typename U> inline bool operator != (const TrackedAllocator<U, CATEGORY>&) const { return false; }
+};
+
+// 某个对象占用的内存，按用途分别统计
+struct MemoryUsage {
+	int64_t bytes[MEMORY_CATEGORY_COUNT] = { 0 };
+
+	inline int64_t Total() const {
+		int64_t total = 0;
+		for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) total += bytes[i];
+		return total;
+	}
+
+	inline MemoryUsage& operator += (const MemoryUsage& other) {
+		for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) bytes[i] += other.bytes[i];
+		return *this;
+	}
+};
+
+// 定期在后台线程输出 MemoryReport()，或者交给回调检查内存预算。
+// 析构时停止，interval 为毫秒
+class MemoryMonitor
+{
+public:
+	typedef std::function<void(const std::string& report)> Callback;
+
+	inline MemoryMonitor(int interval, Callback callback = NULL): _quit(false) {
+		if (callback == NULL) 
+			callback = [] (const std::string& report) { std::cerr << report << "\n"; };
+		_thread = std::thread([this, interval, callback] () {
+				std::unique_lock<std::mutex> lock(_lock);
+				while (!_quit) {
+					_cond.wait_for(lock, std::chrono::milliseconds(interval));
+					if (!_quit) callback(MemoryReport());
+				}
+			});
+	}
+
+	inline virtual ~MemoryMonitor() {
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_quit = true;
+		}
+		_cond.notify_all();
+		_thread.join();
+	}
+
+protected:
+	MemoryMonitor(const MemoryMonitor&) = delete;
+	MemoryMonitor& operator=(const MemoryMonitor&) = delete;
+
+protected:
+	std::mutex _lock;
+	std::condition_variable _cond;
+	std::thread _thread;
+	bool _quit;
+};
+
+
 //---------------------------------------------------------------------
 // 3D 数学运算
 //---------------------------------------------------------------------
@@ -834,122 +1317,679 @@ inline static Mat4x4f matrix_set_perspective(float fovy, float aspect, float zn,
 }
 
 
+// D3DXMatrixOrthoLH：w/h 为视景体宽高，变换后 w 恒为 1，光栅化时走线性插值。
+// 默认深度缓存记录的是 1/w，正交投影下各点深度相同，需要深度测试时先调用
+// RenderHelp::SetDepthMode(DEPTH_Z) 改为按 z/w 比较
+inline static Mat4x4f matrix_set_ortho(float w, float h, float zn, float zf) {
+	Mat4x4f m = matrix_set_zero();
+	m.m[0][0] = 2.0f / w;
+	m.m[1][1] = 2.0f / h;
+	m.m[2][2] = 1.0f / (zf - zn);
+	m.m[3][2] = zn / (zn - zf);
+	m.m[3][3] = 1.0f;
+	return m;
+}
+
+
 //---------------------------------------------------------------------
-// 位图库：用于加载/保存图片，画点，画线，颜色读取
+// 运行时指令集分派：同一份循环代码按照不同的指令集各编译一份，
+// 启动时根据 CPU 支持的指令集选择最快的版本，不需要发布多个可执行文件
 //---------------------------------------------------------------------
-class Bitmap
-{
-public:
-	inline virtual ~Bitmap() { if (_bits) delete []_bits; _bits = NULL; }
-	inline Bitmap(int width, int height): _w(width), _h(height) {
-		_pitch = width * 4;
-		_bits = new uint8_t[_pitch * _h];
-		Fill(0);
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RENDER_HELP_ISA_X86 1
+#define RENDER_HELP_TARGET(isa) __attribute__((target(isa), flatten))
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define RENDER_HELP_ISA_NEON 1
+#endif
+
+enum KernelISA {
+	KERNEL_ISA_GENERIC = 0,
+	KERNEL_ISA_SSE2 = 1,
+	KERNEL_ISA_AVX2 = 2,
+	KERNEL_ISA_AVX512 = 3,
+	KERNEL_ISA_NEON = 4,
+	KERNEL_ISA_COUNT = 5,
+};
+
+// SWAR 混合：dst = src * a + dst * (1 - a)，和 BilinearInterp 一样把 B/R 和
+// G/A 两组分量分别打包在 32 位整数的高低 16 位里，一次乘法处理两个通道。
+// src 的 alpha 通道用 255 代入，使得输出 alpha 为 a + da * (1 - a)。
+// 没有分支，方便向量化，alpha 为 0 和 255 时结果也是精确的
+inline static uint32_t color_blend(uint32_t src, uint32_t dst) {
+	uint32_t a = src >> 24;
+	uint32_t ia = 255 - a;
+	uint32_t rb = (src & 0x00ff00ff) * a + (dst & 0x00ff00ff) * ia;
+	uint32_t ag = (((src >> 8) & 0x00ff00ff) | 0x00ff0000) * a 
+				+ ((dst >> 8) & 0x00ff00ff) * ia;
+	// 近似除以 255：(x + 128 + (x >> 8)) >> 8
+	rb = ((rb + 0x00800080 + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+	ag = (ag + 0x00800080 + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+	return rb | ag;
+}
+
+// 各个核心循环的通用实现，只写一份，由下面的包装函数按指令集分别编译。
+// 主循环每次处理固定的 KERNEL_LANES 个元素，编译器在 -O2 下也能把它
+// 展开成对应指令集宽度的向量指令，剩余的元素逐个处理
+const int KERNEL_LANES = 16;
+
+inline static void kernel_fill32(uint32_t *dst, uint32_t value, int count) {
+	int i = 0;
+	for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+		for (int k = 0; k < KERNEL_LANES; k++) dst[i + k] = value;
 	}
+	for (; i < count; i++) dst[i] = value;
+}
 
-	inline Bitmap(const Bitmap& src): _w(src._w), _h(src._h), _pitch(src._pitch) {
-		_bits = new uint8_t[_pitch * _h];
-		memcpy(_bits, src._bits, _pitch * _h);
+inline static void kernel_fill_float(float *dst, float value, int count) {
+	int i = 0;
+	for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+		for (int k = 0; k < KERNEL_LANES; k++) dst[i + k] = value;
 	}
+	for (; i < count; i++) dst[i] = value;
+}
 
-	inline Bitmap(const char *filename) {
-		Bitmap *tmp = LoadFile(filename);
-		if (tmp == NULL) {
-			std::string msg = "load failed: ";
-			msg.append(filename);
-			throw std::runtime_error(msg);
+inline static void kernel_blend32(uint32_t *dst, const uint32_t *src, int count) {
+	int i = 0;
+	for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+		// 先读到局部数组里，编译器不用考虑 src 和 dst 重叠
+		uint32_t s[KERNEL_LANES], d[KERNEL_LANES];
+		for (int k = 0; k < KERNEL_LANES; k++) s[k] = src[i + k], d[k] = dst[i + k];
+		for (int k = 0; k < KERNEL_LANES; k++) dst[i + k] = color_blend(s[k], d[k]);
+	}
+	for (; i < count; i++) dst[i] = color_blend(src[i], dst[i]);
+}
+
+inline static void kernel_encode(uint32_t *dst, const Vec4f *src, int count) {
+	int i = 0;
+	for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+		for (int k = 0; k < KERNEL_LANES; k++) 
+			dst[i + k] = vector_to_color(src[i + k]);
+	}
+	for (; i < count; i++) dst[i] = vector_to_color(src[i]);
+}
+
+// 像素格式：Bitmap 内部使用 BGRA32，即小端的 0xAARRGGBB，其他格式用于
+// 和文件或者外部缓冲区之间转换
+enum PixelFormat {
+	PIXEL_BGRA32 = 0,      // B, G, R, A 四个字节，BMP 和 Bitmap 的格式
+	PIXEL_RGBA32 = 1,      // R, G, B, A 四个字节，多数图形 API 使用的格式
+	PIXEL_BGR24 = 2,       // B, G, R 三个字节，24 位 BMP 的格式
+	PIXEL_RGB24 = 3,       // R, G, B 三个字节
+	PIXEL_GRAY8 = 4,       // 一个字节的亮度
+};
+
+inline static int PixelFormatSize(PixelFormat format) {
+	static const int sizes[] = { 4, 4, 3, 3, 1 };
+	return sizes[format];
+}
+
+// 从其他格式读取一个像素，转换成 BGRA32，没有 alpha 的格式 alpha 为 255
+template <int FORMAT> inline static uint32_t pixel_unpack(const uint8_t *p) {
+	uint32_t c;
+	if constexpr (FORMAT == PIXEL_BGRA32) memcpy(&c, p, 4);
+	if constexpr (FORMAT == PIXEL_RGBA32) {
+		memcpy(&c, p, 4);
+		c = (c & 0xff00ff00) | ((c & 0xff) << 16) | ((c >> 16) & 0xff);
+	}
+	if constexpr (FORMAT == PIXEL_BGR24) c = 0xff000000 | p[0] | (p[1] << 8) | (p[2] << 16);
+	if constexpr (FORMAT == PIXEL_RGB24) c = 0xff000000 | p[2] | (p[1] << 8) | (p[0] << 16);
+	if constexpr (FORMAT == PIXEL_GRAY8) c = 0xff000000 | (p[0] * 0x010101u);
+	return c;
+}
+
+// 把 BGRA32 像素写成其他格式，灰度按 0.30/0.59/0.11 的权重计算
+template <int FORMAT> inline static void pixel_pack(uint8_t *p, uint32_t c) {
+	if constexpr (FORMAT == PIXEL_BGRA32) memcpy(p, &c, 4);
+	if constexpr (FORMAT == PIXEL_RGBA32) {
+		c = (c & 0xff00ff00) | ((c & 0xff) << 16) | ((c >> 16) & 0xff);
+		memcpy(p, &c, 4);
+	}
+	if constexpr (FORMAT == PIXEL_BGR24) { p[0] = (uint8_t)c; p[1] = (uint8_t)(c >> 8); p[2] = (uint8_t)(c >> 16); }
+	if constexpr (FORMAT == PIXEL_RGB24) { p[2] = (uint8_t)c; p[1] = (uint8_t)(c >> 8); p[0] = (uint8_t)(c >> 16); }
+	if constexpr (FORMAT == PIXEL_GRAY8) 
+		p[0] = (uint8_t)((((c >> 16) & 0xff) * 77 + ((c >> 8) & 0xff) * 150 + (c & 0xff) * 29 + 128) >> 8);
+}
+
+// 格式转换按 KERNEL_LANES 个像素一组处理，先转换到局部数组再写出，
+// 编译器会把通道交换和 24 位的拆包/打包生成成向量的 shuffle 指令
+template <int FORMAT> inline static void kernel_unpack_format(uint32_t *dst, const uint8_t *src, int count) {
+	const int size = PixelFormatSize((PixelFormat)FORMAT);
+	int i = 0;
+	for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+		uint32_t tmp[KERNEL_LANES];
+		for (int k = 0; k < KERNEL_LANES; k++) tmp[k] = pixel_unpack<FORMAT>(src + (i + k) * size);
+		for (int k = 0; k < KERNEL_LANES; k++) dst[i + k] = tmp[k];
+	}
+	for (; i < count; i++) dst[i] = pixel_unpack<FORMAT>(src + i * size);
+}
+
+template <int FORMAT> inline static void kernel_pack_format(uint8_t *dst, const uint32_t *src, int count) {
+	const int size = PixelFormatSize((PixelFormat)FORMAT);
+	int i = 0;
+	for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+		uint8_t tmp[KERNEL_LANES * 4];
+		for (int k = 0; k < KERNEL_LANES; k++) pixel_pack<FORMAT>(tmp + k * size, src[i + k]);
+		memcpy(dst + i * size, tmp, KERNEL_LANES * size);
+	}
+	for (; i < count; i++) pixel_pack<FORMAT>(dst + i * size, src[i]);
+}
+
+inline static void kernel_unpack(uint32_t *dst, const uint8_t *src, int count, PixelFormat format) {
+	switch (format) {
+	case PIXEL_BGRA32: kernel_unpack_format<PIXEL_BGRA32>(dst, src, count); break;
+	case PIXEL_RGBA32: kernel_unpack_format<PIXEL_RGBA32>(dst, src, count); break;
+	case PIXEL_BGR24: kernel_unpack_format<PIXEL_BGR24>(dst, src, count); break;
+	case PIXEL_RGB24: kernel_unpack_format<PIXEL_RGB24>(dst, src, count); break;
+	case PIXEL_GRAY8: kernel_unpack_format<PIXEL_GRAY8>(dst, src, count); break;
+	}
+}
+
+inline static void kernel_pack(uint8_t *dst, const uint32_t *src, int count, PixelFormat format) {
+	switch (format) {
+	case PIXEL_BGRA32: kernel_pack_format<PIXEL_BGRA32>(dst, src, count); break;
+	case PIXEL_RGBA32: kernel_pack_format<PIXEL_RGBA32>(dst, src, count); break;
+	case PIXEL_BGR24: kernel_pack_format<PIXEL_BGR24>(dst, src, count); break;
+	case PIXEL_RGB24: kernel_pack_format<PIXEL_RGB24>(dst, src, count); break;
+	case PIXEL_GRAY8: kernel_pack_format<PIXEL_GRAY8>(dst, src, count); break;
+	}
+}
+
+// 原地反转一行像素：每次从两端各取 KERNEL_LANES 个，反序后交换位置
+inline static void kernel_reverse32(uint32_t *data, int count) {
+	int i = 0, j = count;
+	for (; i + KERNEL_LANES * 2 <= j; i += KERNEL_LANES, j -= KERNEL_LANES) {
+		uint32_t a[KERNEL_LANES], b[KERNEL_LANES];
+		for (int k = 0; k < KERNEL_LANES; k++) a[k] = data[i + k], b[k] = data[j - KERNEL_LANES + k];
+		for (int k = 0; k < KERNEL_LANES; k++) {
+			data[i + k] = b[KERNEL_LANES - 1 - k];
+			data[j - KERNEL_LANES + k] = a[KERNEL_LANES - 1 - k];
 		}
-		_w = tmp->_w; _h = tmp->_h; _pitch = tmp->_pitch; _bits = tmp->_bits;
-		tmp->_bits = NULL;
-		delete tmp;
 	}
+	std::reverse(data + i, data + j);
+}
+
+#ifdef RENDER_HELP_ISA_X86
+RENDER_HELP_TARGET("sse2") inline static void kernel_fill32_sse2(uint32_t *d, uint32_t v, int n) { kernel_fill32(d, v, n); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_fill32_avx2(uint32_t *d, uint32_t v, int n) { kernel_fill32(d, v, n); }
+RENDER_HELP_TARGET("avx512f") inline static void kernel_fill32_avx512(uint32_t *d, uint32_t v, int n) { kernel_fill32(d, v, n); }
+RENDER_HELP_TARGET("sse2") inline static void kernel_fill_float_sse2(float *d, float v, int n) { kernel_fill_float(d, v, n); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_fill_float_avx2(float *d, float v, int n) { kernel_fill_float(d, v, n); }
+RENDER_HELP_TARGET("avx512f") inline static void kernel_fill_float_avx512(float *d, float v, int n) { kernel_fill_float(d, v, n); }
+RENDER_HELP_TARGET("sse2") inline static void kernel_blend32_sse2(uint32_t *d, const uint32_t *s, int n) { kernel_blend32(d, s, n); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_blend32_avx2(uint32_t *d, const uint32_t *s, int n) { kernel_blend32(d, s, n); }
+RENDER_HELP_TARGET("avx512f,avx512bw") inline static void kernel_blend32_avx512(uint32_t *d, const uint32_t *s, int n) { kernel_blend32(d, s, n); }
+RENDER_HELP_TARGET("sse2") inline static void kernel_encode_sse2(uint32_t *d, const Vec4f *s, int n) { kernel_encode(d, s, n); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_encode_avx2(uint32_t *d, const Vec4f *s, int n) { kernel_encode(d, s, n); }
+RENDER_HELP_TARGET("avx512f") inline static void kernel_encode_avx512(uint32_t *d, const Vec4f *s, int n) { kernel_encode(d, s, n); }
+RENDER_HELP_TARGET("sse2") inline static void kernel_unpack_sse2(uint32_t *d, const uint8_t *s, int n, PixelFormat f) { kernel_unpack(d, s, n, f); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_unpack_avx2(uint32_t *d, const uint8_t *s, int n, PixelFormat f) { kernel_unpack(d, s, n, f); }
+RENDER_HELP_TARGET("avx512f,avx512bw") inline static void kernel_unpack_avx512(uint32_t *d, const uint8_t *s, int n, PixelFormat f) { kernel_unpack(d, s, n, f); }
+RENDER_HELP_TARGET("sse2") inline static void kernel_pack_sse2(uint8_t *d, const uint32_t *s, int n, PixelFormat f) { kernel_pack(d, s, n, f); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_pack_avx2(uint8_t *d, const uint32_t *s, int n, PixelFormat f) { kernel_pack(d, s, n, f); }
+RENDER_HELP_TARGET("avx512f,avx512bw") inline static void kernel_pack_avx512(uint8_t *d, const uint32_t *s, int n, PixelFormat f) { kernel_pack(d, s, n, f); }
+RENDER_HELP_TARGET("sse2") inline static void kernel_reverse32_sse2(uint32_t *d, int n) { kernel_reverse32(d, n); }
+RENDER_HELP_TARGET("avx2") inline static void kernel_reverse32_avx2(uint32_t *d, int n) { kernel_reverse32(d, n); }
+RENDER_HELP_TARGET("avx512f") inline static void kernel_reverse32_avx512(uint32_t *d, int n) { kernel_reverse32(d, n); }
+#endif
 
-public:
-	inline int GetW() const { return _w; }
-	inline int GetH() const { return _h; }
-	inline int GetPitch() const { return _pitch; }
-	inline uint8_t *GetBits() { return _bits; }
-	inline const uint8_t *GetBits() const { return _bits; }
-	inline uint8_t *GetLine(int y) { return _bits + _pitch * y; }
-	inline const uint8_t *GetLine(int y) const { return _bits + _pitch * y; }
 
+// 内核注册表：第一次调用 Get() 时检测 CPU，为每个内核选择可用的最高指令集
+// 版本。环境变量 RENDER_HELP_ISA (generic/sse2/avx2/avx512/neon) 可以把
+// 指令集限制到指定的级别，用于测试各个版本的结果和性能
+class KernelRegistry
+{
 public:
+	typedef void (*Fill32)(uint32_t *dst, uint32_t value, int count);
+	typedef void (*FillFloat)(float *dst, float value, int count);
+	typedef void (*Blend32)(uint32_t *dst, const uint32_t *src, int count);
+	typedef void (*Encode)(uint32_t *dst, const Vec4f *src, int count);
+	typedef void (*Unpack)(uint32_t *dst, const uint8_t *src, int count, PixelFormat format);
+	typedef void (*Pack)(uint8_t *dst, const uint32_t *src, int count, PixelFormat format);
+	typedef void (*Reverse32)(uint32_t *data, int count);
+
+	Fill32 fill32;          // 清屏
+	FillFloat fill_float;   // 清除深度缓存
+	Blend32 blend32;        // 一行像素 alpha 混合
+	Encode encode;          // 浮点颜色转换为 32 位像素
+	Unpack unpack;          // 其他格式转换为 BGRA32，用于加载图片
+	Pack pack;              // BGRA32 转换为其他格式，用于保存图片
+	Reverse32 reverse32;    // 一行像素原地反转，用于水平翻转
+
+	inline static const KernelRegistry& Get() {
+		static KernelRegistry registry;
+		return registry;
+	}
 
-	inline void Fill(uint32_t color) {
-		for (int j = 0; j < _h; j++) {
-			uint32_t *row = (uint32_t*)(_bits + j * _pitch);
-			for (int i = 0; i < _w; i++, row++) 
-				memcpy(row, &color, sizeof(uint32_t));
-		}
+	inline static const char *GetISAName(KernelISA isa) {
+		static const char *names[] = { "generic", "sse2", "avx2", "avx512", "neon" };
+		return names[isa];
 	}
 
-	inline void SetPixel(int x, int y, uint32_t color) {
-		if (x >= 0 && x < _w && y >= 0 && y < _h) {
-			memcpy(_bits + y * _pitch + x * 4, &color, sizeof(uint32_t));
-		}
+	// CPU 支持的最高指令集
+	inline KernelISA GetDetected() const { return _detected; }
+
+	// 环境变量限制以后实际使用的指令集
+	inline KernelISA GetActive() const { return _active; }
+
+	// 每个内核当前使用的版本，例如 "fill32=avx2 fill_float=avx2 ..."
+	inline std::string Report() const {
+		std::stringstream ss;
+		ss << "detected=" << GetISAName(_detected);
+		ss << " active=" << GetISAName(_active);
+		for (int i = 0; i < KERNEL_COUNT; i++) 
+			ss << " " << _names[i] << "=" << GetISAName(_chosen[i]);
+		return ss.str();
 	}
 
-	inline uint32_t GetPixel(int x, int y) const {
-		uint32_t color = 0;
-		if (x >= 0 && x < _w && y >= 0 && y < _h) {
-			memcpy(&color, _bits + y * _pitch + x * 4, sizeof(uint32_t));
+protected:
+
+	inline KernelRegistry() {
+		_detected = Detect();
+		_active = _detected;
+		const char *env = getenv("RENDER_HELP_ISA");
+		if (env) {
+			for (int i = 0; i < KERNEL_ISA_COUNT; i++) {
+				if (strcmp(env, GetISAName((KernelISA)i)) == 0 && i <= (int)_detected) 
+					_active = (KernelISA)i;
+			}
 		}
-		return color;
+		Fill32 v_fill32[KERNEL_ISA_COUNT] = { kernel_fill32 };
+		FillFloat v_fill_float[KERNEL_ISA_COUNT] = { kernel_fill_float };
+		Blend32 v_blend32[KERNEL_ISA_COUNT] = { kernel_blend32 };
+		Encode v_encode[KERNEL_ISA_COUNT] = { kernel_encode };
+		Unpack v_unpack[KERNEL_ISA_COUNT] = { kernel_unpack };
+		Pack v_pack[KERNEL_ISA_COUNT] = { kernel_pack };
+		Reverse32 v_reverse32[KERNEL_ISA_COUNT] = { kernel_reverse32 };
+	#ifdef RENDER_HELP_ISA_X86
+		v_fill32[KERNEL_ISA_SSE2] = kernel_fill32_sse2;
+		v_fill32[KERNEL_ISA_AVX2] = kernel_fill32_avx2;
+		v_fill32[KERNEL_ISA_AVX512] = kernel_fill32_avx512;
+		v_fill_float[KERNEL_ISA_SSE2] = kernel_fill_float_sse2;
+		v_fill_float[KERNEL_ISA_AVX2] = kernel_fill_float_avx2;
+		v_fill_float[KERNEL_ISA_AVX512] = kernel_fill_float_avx512;
+		v_blend32[KERNEL_ISA_SSE2] = kernel_blend32_sse2;
+		v_blend32[KERNEL_ISA_AVX2] = kernel_blend32_avx2;
+		v_blend32[KERNEL_ISA_AVX512] = kernel_blend32_avx512;
+		v_encode[KERNEL_ISA_SSE2] = kernel_encode_sse2;
+		v_encode[KERNEL_ISA_AVX2] = kernel_encode_avx2;
+		v_encode[KERNEL_ISA_AVX512] = kernel_encode_avx512;
+		v_unpack[KERNEL_ISA_SSE2] = kernel_unpack_sse2;
+		v_unpack[KERNEL_ISA_AVX2] = kernel_unpack_avx2;
+		v_unpack[KERNEL_ISA_AVX512] = kernel_unpack_avx512;
+		v_pack[KERNEL_ISA_SSE2] = kernel_pack_sse2;
+		v_pack[KERNEL_ISA_AVX2] = kernel_pack_avx2;
+		v_pack[KERNEL_ISA_AVX512] = kernel_pack_avx512;
+		v_reverse32[KERNEL_ISA_SSE2] = kernel_reverse32_sse2;
+		v_reverse32[KERNEL_ISA_AVX2] = kernel_reverse32_avx2;
+		v_reverse32[KERNEL_ISA_AVX512] = kernel_reverse32_avx512;
+	#elif defined(RENDER_HELP_ISA_NEON)
+		// NEON 是 aarch64 的基础指令集，通用版本编译出来就是 NEON 代码
+		v_fill32[KERNEL_ISA_NEON] = kernel_fill32;
+		v_fill_float[KERNEL_ISA_NEON] = kernel_fill_float;
+		v_blend32[KERNEL_ISA_NEON] = kernel_blend32;
+		v_encode[KERNEL_ISA_NEON] = kernel_encode;
+		v_unpack[KERNEL_ISA_NEON] = kernel_unpack;
+		v_pack[KERNEL_ISA_NEON] = kernel_pack;
+		v_reverse32[KERNEL_ISA_NEON] = kernel_reverse32;
+	#endif
+		fill32 = Select(v_fill32, 0);
+		fill_float = Select(v_fill_float, 1);
+		blend32 = Select(v_blend32, 2);
+		encode = Select(v_encode, 3);
+		unpack = Select(v_unpack, 4);
+		pack = Select(v_pack, 5);
+		reverse32 = Select(v_reverse32, 6);
 	}
 
-	inline void DrawLine(int x1, int y1, int x2, int y2, uint32_t color) {
-		int x, y;
-		if (x1 == x2 && y1 == y2) {
-			SetPixel(x1, y1, color);
-			return;
-		}	else if (x1 == x2) {
-			int inc = (y1 <= y2)? 1 : -1;
-			for (y = y1; y != y2; y += inc) SetPixel(x1, y, color);
-			SetPixel(x2, y2, color);
-		}	else if (y1 == y2) {
-			int inc = (x1 <= x2)? 1 : -1;
-			for (x = x1; x != x2; x += inc) SetPixel(x, y1, color);
-			SetPixel(x2, y2, color);
-		}	else {
-			int dx = (x1 < x2)? x2 - x1 : x1 - x2;
-			int dy = (y1 < y2)? y2 - y1 : y1 - y2;
-			int rem = 0;
-			if (dx >= dy) {
-				if (x2 < x1) x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
-				for (x = x1, y = y1; x <= x2; x++) {
-					SetPixel(x, y, color);
-					rem += dy;
-					if (rem >= dx) { rem -= dx; y += (y2 >= y1)? 1 : -1; SetPixel(x, y, color); }
-				}
-				SetPixel(x2, y2, color);
-			}	else {
-				if (y2 < y1) x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
-				for (x = x1, y = y1; y <= y2; y++) {
-					SetPixel(x, y, color);
-					rem += dx;
-					if (rem >= dy) { rem -= dy; x += (x2 >= x1)? 1 : -1; SetPixel(x, y, color); }
-				}
-				SetPixel(x2, y2, color);
+	// 从当前指令集开始向下找第一个编译过的版本
+	template <typename FN> inline FN Select(const FN *variants, int index) {
+		static const char *names[] = { "fill32", "fill_float", "blend32", "encode", "unpack", "pack", "reverse32" };
+		_names[index] = names[index];
+		for (int i = (int)_active; i >= 0; i--) {
+			if (variants[i] != NULL) {
+				_chosen[index] = (KernelISA)i;
+				return variants[i];
 			}
 		}
+		_chosen[index] = KERNEL_ISA_GENERIC;
+		return variants[0];
 	}
 
-	struct BITMAPINFOHEADER { // bmih  
-		uint32_t	biSize; 
-		uint32_t	biWidth; 
-		int32_t		biHeight; 
-		uint16_t	biPlanes; 
-		uint16_t	biBitCount;
-		uint32_t	biCompression; 
-		uint32_t	biSizeImage; 
-		uint32_t	biXPelsPerMeter; 
-		uint32_t	biYPelsPerMeter; 
-		uint32_t	biClrUsed; 
-		uint32_t	biClrImportant; 
-	};
+	inline static KernelISA Detect() {
+	#ifdef RENDER_HELP_ISA_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) 
+			return KERNEL_ISA_AVX512;
+		if (__builtin_cpu_supports("avx2")) return KERNEL_ISA_AVX2;
+		if (__builtin_cpu_supports("sse2")) return KERNEL_ISA_SSE2;
+	#elif defined(RENDER_HELP_ISA_NEON)
+		return KERNEL_ISA_NEON;
+	#endif
+		return KERNEL_ISA_GENERIC;
+	}
+
+protected:
+	KernelISA _detected;
+	KernelISA _active;
+	enum { KERNEL_COUNT = 7 };
+	KernelISA _chosen[KERNEL_COUNT];
+	const char *_names[KERNEL_COUNT];
+};
+
+
+//---------------------------------------------------------------------
+// 位图库：用于加载/保存图片，画点，画线，颜色读取
+//---------------------------------------------------------------------
+// 位图内存池：按尺寸分级缓存释放的像素内存，每帧创建和销毁的相同尺寸的
+// 渲染目标和临时图片可以直接复用，避免反复向系统申请和归还大块内存
+class BitmapPool
+{
+public:
+	inline static BitmapPool& Get() {
+		static BitmapPool pool;
+		return pool;
+	}
+
+	inline virtual ~BitmapPool() { Trim(); }
+
+	// 尺寸分级：4KB 以下按 4KB 算，之上每个 2 的幂区间分成 8 级，浪费不超过 1/8
+	inline static size_t ClassSize(size_t size) {
+		if (size <= 4096) return 4096;
+		size_t top = 4096;
+		while (top * 2 <= size) top *= 2;
+		size_t step = Max(top / 8, (size_t)4096);
+		return (size + step - 1) / step * step;
+	}
+
+	// 分配至少 size 字节，64 字节对齐，计入 category 的用量，失败返回 NULL
+	inline void *Alloc(size_t size, MemoryCategory category = MEMORY_TEXTURE) {
+		size_t cls = ClassSize(size);
+		void *ptr = NULL;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			auto it = _free.find(cls);
+			if (it != _free.end() && !it->second.empty()) {
+				ptr = it->second.back();
+				it->second.pop_back();
+				_cached -= cls;
+				_hits++;
+			}
+			else {
+				_misses++;
+			}
+		}
+		if (ptr == NULL) return MemoryAlloc(cls, category);
+		MemorySetCategory(ptr, category);
+		return ptr;
+	}
+
+	// 归还内存，size 必须和分配时相同；缓存超过上限时直接释放，
+	// 缓存的内存计入 MEMORY_CACHED
+	inline void Free(void *ptr, size_t size) {
+		if (ptr == NULL) return;
+		size_t cls = ClassSize(size);
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			if (_cached + cls <= _limit) {
+				MemorySetCategory(ptr, MEMORY_CACHED);
+				_free[cls].push_back(ptr);
+				_cached += cls;
+				return;
+			}
+		}
+		MemoryFree(ptr);
+	}
+
+	// 释放所有缓存的内存
+	inline void Trim() {
+		std::lock_guard<std::mutex> lock(_lock);
+		TrimLocked();
+	}
+
+	// 设置缓存上限，为 0 时关闭缓存
+	inline void SetLimit(size_t bytes) {
+		std::lock_guard<std::mutex> lock(_lock);
+		_limit = bytes;
+		if (_cached > _limit) TrimLocked();
+	}
+
+	// 统计数据会被其他线程的 Alloc/Free 修改，读取时同样需要加锁
+	inline size_t GetLimit() const { std::lock_guard<std::mutex> lock(_lock); return _limit; }
+	inline size_t GetCached() const { std::lock_guard<std::mutex> lock(_lock); return _cached; }
+	inline int64_t GetHits() const { std::lock_guard<std::mutex> lock(_lock); return _hits; }
+	inline int64_t GetMisses() const { std::lock_guard<std::mutex> lock(_lock); return _misses; }
+
+protected:
+	inline BitmapPool(): _cached(0), _limit(64 << 20), _hits(0), _misses(0) {
+		MemoryState::Get();    // 保证析构时分配器的状态还在
+	}
+
+	BitmapPool(const BitmapPool&) = delete;
+	BitmapPool& operator=(const BitmapPool&) = delete;
+
+	// 调用者已经持有 _lock
+	inline void TrimLocked() {
+		for (auto &it: _free) {
+			for (void *ptr: it.second) MemoryFree(ptr);
+		}
+		_free.clear();
+		_cached = 0;
+	}
+
+protected:
+	mutable std::mutex _lock;
+	std::map<size_t, std::vector<void*>> _free;
+	size_t _cached;
+	size_t _limit;
+	int64_t _hits;
+	int64_t _misses;
+};
+
+
+// 位图上的一块矩形区域，交给 Bitmap::ForEachTile 的回调直接读写，不做边界检查
+struct BitmapTile {
+	int x, y;            // 区域左上角在位图里的坐标
+	int w, h;            // 区域尺寸
+	uint8_t *bits;       // 位图第 0 行的地址
+	int pitch;           // 位图每行字节数
+
+	// 区域内第 j 行 (0 <= j < h) 的像素，下标 0 对应位图的第 x 列
+	inline uint32_t *Row(int j) const { return (uint32_t*)(bits + (size_t)(y + j) * pitch) + x; }
+};
+
+// 像素数少于该值时 ForEachTile/ForEachRow 串行执行，避免创建线程的开销超过计算本身
+const int BITMAP_PARALLEL_MIN = 1 << 16;
+
+
+class Bitmap
+{
+public:
+	inline virtual ~Bitmap() { BitmapPool::Get().Free(_bits, (size_t)_pitch * _h); _bits = NULL; }
+	// clear 为 false 时不初始化像素，由各个工作线程首次写入自己负责的行，
+	// 这些内存页就会分配在线程所在的 NUMA 节点上 (first-touch)；
+	// padded 为 true 时每行末尾补齐，见 CalcPitch；category 为像素内存计入的用途
+	inline Bitmap(int width, int height, bool clear = true, bool padded = false, 
+			MemoryCategory category = MEMORY_TEXTURE): _w(width), _h(height) {
+		_pitch = CalcPitch(width, padded);
+		_bits = AllocBits(_pitch, _h, category);
+		if (clear) Fill(0);
+	}
+
+	// 复制的像素内存和 src 计入相同的用途
+	inline Bitmap(const Bitmap& src): _w(src._w), _h(src._h), _pitch(src._pitch) {
+		_bits = AllocBits(_pitch, _h, src.GetCategory());
+		memcpy(_bits, src._bits, _pitch * _h);
+	}
+
+	// 移动构造：直接接管像素内存，src 变成 0x0 的空位图。不抛出异常，
+	// std::vector<Bitmap> 扩容时才会移动而不是复制
+	inline Bitmap(Bitmap&& src) noexcept: _w(src._w), _h(src._h), _pitch(src._pitch), _bits(src._bits) {
+		src._w = src._h = src._pitch = 0;
+		src._bits = NULL;
+	}
+
+	// 读取失败时抛出异常，像素内存从 LoadFile 的结果直接移动过来
+	inline Bitmap(const char *filename): Bitmap(std::move(*LoadChecked(filename))) {}
+
+	inline Bitmap& operator = (const Bitmap& src) {
+		if (this != &src) {
+			Bitmap tmp(src);
+			Swap(tmp);
+		}
+		return *this;
+	}
+
+	inline Bitmap& operator = (Bitmap&& src) noexcept {
+		Swap(src);
+		return *this;
+	}
+
+	inline void Swap(Bitmap& other) noexcept {
+		std::swap(_w, other._w);
+		std::swap(_h, other._h);
+		std::swap(_pitch, other._pitch);
+		std::swap(_bits, other._bits);
+	}
+
+public:
+	inline int GetW() const { return _w; }
+	inline int GetH() const { return _h; }
+	inline int GetPitch() const { return _pitch; }
+	inline uint8_t *GetBits() { return _bits; }
+	inline const uint8_t *GetBits() const { return _bits; }
+	inline uint8_t *GetLine(int y) { return _bits + _pitch * y; }
+	inline const uint8_t *GetLine(int y) const { return _bits + _pitch * y; }
+
+	// 像素内存计入的用途，默认为 MEMORY_TEXTURE，渲染目标设为 MEMORY_TARGET
+	inline MemoryCategory GetCategory() const { return _bits? MemoryGetCategory(_bits) : MEMORY_TEXTURE; }
+	inline void SetCategory(MemoryCategory category) { MemorySetCategory(_bits, category); }
+
+	// 像素内存实际占用的字节数，包括尺寸分级多出来的部分
+	inline size_t GetMemorySize() const { return MemoryGetSize(_bits); }
+
+	// 计算每行字节数：对齐到 64 字节的缓存行。padded 时如果行宽是 1KB 的倍数
+	// (比如 1024 宽的纹理)，再多加一个缓存行，否则同一列上相邻的行都映射到
+	// 相同的缓存组，纵向访问时互相挤出
+	inline static int CalcPitch(int width, bool padded) {
+		int pitch = (width * 4 + 63) & ~63;
+		if (padded && (pitch & 1023) == 0) pitch += 64;
+		return pitch;
+	}
+
+public:
+
+	inline void Fill(uint32_t color) {
+		const KernelRegistry& kernel = KernelRegistry::Get();
+		ForEachRow([&] (int, uint32_t *row) { kernel.fill32(row, color, _w); });
+	}
+
+	// 把位图切成 tile_w x tile_h 的块，多线程对每块调用 func(const BitmapTile&)，
+	// 块之间互不重叠，func 里可以直接读写块内的像素。边缘的块可能小一些
+	template <typename F>
+	inline void ForEachTile(F&& func, int tile_w = 64, int tile_h = 64, int threads = ParallelDefaultThreads()) {
+		if (_w <= 0 || _h <= 0 || tile_w <= 0 || tile_h <= 0) return;
+		int nx = (_w + tile_w - 1) / tile_w;
+		int ny = (_h + tile_h - 1) / tile_h;
+		ParallelFor(nx * ny, CalcThreads(threads), [&] (int index) {
+				BitmapTile tile;
+				tile.x = (index % nx) * tile_w;
+				tile.y = (index / nx) * tile_h;
+				tile.w = Min(tile_w, _w - tile.x);
+				tile.h = Min(tile_h, _h - tile.y);
+				tile.bits = _bits;
+				tile.pitch = _pitch;
+				func(tile);
+			});
+	}
+
+	// 多线程对每一行调用 func(int y, uint32_t *row)，row 有 GetW() 个像素。
+	// 相邻的若干行作为一个任务，每个任务大约处理 64KB
+	template <typename F>
+	inline void ForEachRow(F&& func, int threads = ParallelDefaultThreads()) {
+		ForEachBand(_h, [&] (int y) { func(y, (uint32_t*)(_bits + (size_t)y * _pitch)); }, threads);
+	}
+
+	// 只读版本，func(int y, const uint32_t *row)
+	template <typename F>
+	inline void ForEachRow(F&& func, int threads = ParallelDefaultThreads()) const {
+		ForEachBand(_h, [&] (int y) { func(y, (const uint32_t*)(_bits + (size_t)y * _pitch)); }, threads);
+	}
+
+	// 逐像素变换：每个像素替换成 func(x, y, color) 的返回值，按行并行
+	template <typename F>
+	inline void Transform(F&& func, int threads = ParallelDefaultThreads()) {
+		ForEachRow([&] (int y, uint32_t *row) {
+				for (int x = 0; x < _w; x++) row[x] = func(x, y, row[x]);
+			}, threads);
+	}
+
+	inline void SetPixel(int x, int y, uint32_t color) {
+		if (x >= 0 && x < _w && y >= 0 && y < _h) {
+			memcpy(_bits + y * _pitch + x * 4, &color, sizeof(uint32_t));
+		}
+	}
+
+	inline uint32_t GetPixel(int x, int y) const {
+		uint32_t color = 0;
+		if (x >= 0 && x < _w && y >= 0 && y < _h) {
+			memcpy(&color, _bits + y * _pitch + x * 4, sizeof(uint32_t));
+		}
+		return color;
+	}
+
+	inline void DrawLine(int x1, int y1, int x2, int y2, uint32_t color) {
+		int x, y;
+		if (x1 == x2 && y1 == y2) {
+			SetPixel(x1, y1, color);
+			return;
+		}	else if (x1 == x2) {
+			int inc = (y1 <= y2)? 1 : -1;
+			for (y = y1; y != y2; y += inc) SetPixel(x1, y, color);
+			SetPixel(x2, y2, color);
+		}	else if (y1 == y2) {
+			int inc = (x1 <= x2)? 1 : -1;
+			for (x = x1; x != x2; x += inc) SetPixel(x, y1, color);
+			SetPixel(x2, y2, color);
+		}	else {
+			int dx = (x1 < x2)? x2 - x1 : x1 - x2;
+			int dy = (y1 < y2)? y2 - y1 : y1 - y2;
+			int rem = 0;
+			if (dx >= dy) {
+				if (x2 < x1) x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
+				for (x = x1, y = y1; x <= x2; x++) {
+					SetPixel(x, y, color);
+					rem += dy;
+					if (rem >= dx) { rem -= dx; y += (y2 >= y1)? 1 : -1; SetPixel(x, y, color); }
+				}
+				SetPixel(x2, y2, color);
+			}	else {
+				if (y2 < y1) x = x1, y = y1, x1 = x2, y1 = y2, x2 = x, y2 = y;
+				for (x = x1, y = y1; y <= y2; y++) {
+					SetPixel(x, y, color);
+					rem += dx;
+					if (rem >= dy) { rem -= dy; x += (x2 >= x1)? 1 : -1; SetPixel(x, y, color); }
+				}
+				SetPixel(x2, y2, color);
+			}
+		}
+	}
+
+	struct BITMAPINFOHEADER { // bmih  
+		uint32_t	biSize; 
+		uint32_t	biWidth; 
+		int32_t		biHeight; 
+		uint16_t	biPlanes; 
+		uint16_t	biBitCount;
+		uint32_t	biCompression; 
+		uint32_t	biSizeImage; 
+		uint32_t	biXPelsPerMeter; 
+		uint32_t	biYPelsPerMeter; 
+		uint32_t	biClrUsed; 
+		uint32_t	biClrImportant; 
+	};
 
-	// 读取 BMP 图片，支持 24/32 位两种格式
-	inline static Bitmap* LoadFile(const char *filename) {
+	// 读取 BMP 图片，支持 24/32 位两种格式，失败返回空指针
+	inline static std::unique_ptr<Bitmap> LoadFile(const char *filename) {
 		FILE *fp = fopen(filename, "rb");
 		if (fp == NULL) return NULL;
 		BITMAPINFOHEADER info;
@@ -960,19 +2000,20 @@ public:
 		hr = (int)fread(&info, 1, sizeof(info), fp);
 		if (hr != 40) { fclose(fp); return NULL; }
 		if (info.biBitCount != 24 && info.biBitCount != 32) { fclose(fp); return NULL; }
-		Bitmap *bmp = new Bitmap(info.biWidth, info.biHeight);
+		// 像素全部由下面的 Import 写入，不需要先清零；文件不完整时 data 里
+		// 缺少的部分是 0，结果和清零相同
+		std::unique_ptr<Bitmap> bmp(new Bitmap(info.biWidth, info.biHeight, false, true));
 		uint32_t offset;
 		memcpy(&offset, header + 10, sizeof(uint32_t));
 		fseek(fp, offset, SEEK_SET);
 		uint32_t pixelsize = (info.biBitCount + 7) / 8;
 		uint32_t pitch = (pixelsize * info.biWidth + 3) & (~3);
-		for (int y = 0; y < (int)info.biHeight; y++) {
-			uint8_t *line = bmp->GetLine(info.biHeight - 1 - y);
-			for (int x = 0; x < (int)info.biWidth; x++, line += 4) {
-				line[3] = 255;
-				fread(line, pixelsize, 1, fp);
-			}
-			fseek(fp, pitch - info.biWidth * pixelsize, SEEK_CUR);
+		// 整块读入后转换，BMP 的行从下往上存放，从最后一行开始按负的行距导入
+		std::vector<uint8_t> data((size_t)pitch * info.biHeight);
+		if (!data.empty()) {
+			hr = (int)fread(&data[0], 1, data.size(), fp);
+			bmp->Import(&data[0] + (size_t)pitch * (info.biHeight - 1), -(ptrdiff_t)pitch, 
+					(pixelsize == 4)? PIXEL_BGRA32 : PIXEL_BGR24);
 		}
 		fclose(fp);
 		return bmp;
@@ -1005,13 +2046,11 @@ public:
 		info.biClrImportant = 0;
 		fwrite(&info, sizeof(info), 1, fp);
 		// printf("pitch=%d %d\n", (int)pitch, info.biSizeImage);
-		for (int y = 0; y < GetH(); y++) {
-			const uint8_t *line = GetLine(info.biHeight - 1 - y);
-			uint32_t padding = pitch - GetW() * pixelsize;
-			for (int x = 0; x < GetW(); x++, line += 4) {
-				fwrite(line, pixelsize, 1, fp);
-			}
-			for (int i = 0; i < (int)padding; i++) fputc(0, fp);
+		std::vector<uint8_t> data((size_t)pitch * GetH(), 0);
+		if (!data.empty()) {
+			Export(&data[0] + (size_t)pitch * (GetH() - 1), -(ptrdiff_t)pitch, 
+					withAlpha? PIXEL_BGRA32 : PIXEL_BGR24);
+			fwrite(&data[0], 1, data.size(), fp);
 		}
 		fclose(fp);
 		return true;
@@ -1051,32 +2090,118 @@ public:
 		SetPixel(x, y, vector_to_color(color));
 	}
 
+	// 像素内容的 FNV-1a 哈希，不包含行尾的补齐
+	inline uint64_t Hash() const {
+		uint64_t h = 14695981039346656037ull;
+		for (int y = 0; y < _h; y++) {
+			const uint8_t *p = GetLine(y);
+			for (int i = 0; i < _w * 4; i++) {
+				h ^= p[i];
+				h *= 1099511628211ull;
+			}
+		}
+		return h;
+	}
+
 	// 上下反转
 	inline void FlipVertical() {
-		uint8_t *buffer = new uint8_t[_pitch];
-		for (int i = 0, j = _h - 1; i < j; i++, j--) {
-			memcpy(buffer, GetLine(i), _pitch);
-			memcpy(GetLine(i), GetLine(j), _pitch);
-			memcpy(GetLine(j), buffer, _pitch);
-		}
-		delete []buffer;
+		ForEachBand(_h / 2, [&] (int y) {
+				uint32_t *a = (uint32_t*)GetLine(y);
+				std::swap_ranges(a, a + _w, (uint32_t*)GetLine(_h - 1 - y));
+			}, ParallelDefaultThreads());
 	}
 
 	// 水平反转
 	inline void FlipHorizontal() {
-		for (int y = 0; y < _h; y++) {
-			for (int i = 0, j = _w - 1; i < j; i++, j--) {
-				uint32_t c1 = GetPixel(i, y);
-				uint32_t c2 = GetPixel(j, y);
-				SetPixel(i, y, c2);
-				SetPixel(j, y, c1);
+		const KernelRegistry& kernel = KernelRegistry::Get();
+		ForEachRow([&] (int, uint32_t *row) { kernel.reverse32(row, _w); });
+	}
+
+	// 返回顺时针旋转 quarter 个 90 度的新位图。90 度和 270 度按 16x16 的块
+	// 转置，块内读取的 16 行源像素和写入的 16 行目标像素都留在缓存里
+	inline Bitmap Rotate(int quarter) const {
+		quarter &= 3;
+		if (quarter == 0 || quarter == 2) {
+			Bitmap dst(*this);
+			if (quarter == 2) {
+				dst.FlipVertical();
+				dst.FlipHorizontal();
+			}
+			return dst;
+		}
+		Bitmap dst(_h, _w, false, IsPadded(), GetCategory());
+		const int block = 16;
+		// 顺时针时目标 (x, y) 来自源 (y, h - 1 - x)，逆时针时来自 (w - 1 - y, x)，
+		// 目标沿 x 前进一格，源地址移动一行
+		ptrdiff_t step = (quarter == 1)? -(ptrdiff_t)_pitch : (ptrdiff_t)_pitch;
+		int nblocks = (dst._h + block - 1) / block;
+		ParallelFor(nblocks, CalcThreads(ParallelDefaultThreads()), [&] (int index) {
+				int y0 = index * block, y1 = Min(dst._h, y0 + block);
+				for (int x0 = 0; x0 < dst._w; x0 += block) {
+					int x1 = Min(dst._w, x0 + block);
+					for (int y = y0; y < y1; y++) {
+						int sx = (quarter == 1)? y : _w - 1 - y;
+						int sy = (quarter == 1)? _h - 1 - x0 : x0;
+						const uint8_t *src = _bits + (size_t)sy * _pitch + sx * 4;
+						uint32_t *row = (uint32_t*)dst.GetLine(y);
+						for (int x = x0; x < x1; x++, src += step) memcpy(row + x, src, 4);
+					}
+				}
+			});
+		return dst;
+	}
+
+	// 把 src 从 (sx, sy) 开始 w x h 的区域复制到 (x, y)，按两张位图的边界裁剪。
+	// src 可以是自己，区域重叠时结果也正确，没有复制任何像素时返回 false
+	inline bool Blit(int x, int y, const Bitmap& src, int sx, int sy, int w, int h) {
+		if (sx < 0) { x -= sx; w += sx; sx = 0; }
+		if (sy < 0) { y -= sy; h += sy; sy = 0; }
+		if (x < 0) { sx -= x; w += x; x = 0; }
+		if (y < 0) { sy -= y; h += y; y = 0; }
+		w = Min(w, Min(src._w - sx, _w - x));
+		h = Min(h, Min(src._h - sy, _h - y));
+		if (w <= 0 || h <= 0) return false;
+		if (&src == this) {
+			// 目标在源的下方时从下往上复制，同一行内的重叠由 memmove 处理
+			bool backward = (y > sy);
+			for (int j = 0; j < h; j++) {
+				int k = backward? h - 1 - j : j;
+				memmove(GetLine(y + k) + x * 4, GetLine(sy + k) + sx * 4, w * 4);
 			}
+			return true;
 		}
+		ForEachBand(h, [&] (int j) {
+				memcpy(GetLine(y + j) + x * 4, src.GetLine(sy + j) + sx * 4, w * 4);
+			}, (int64_t)w * h < BITMAP_PARALLEL_MIN? 1 : ParallelDefaultThreads());
+		return true;
 	}
 
-protected:
+	// 复制整张 src 到 (x, y)
+	inline bool Blit(int x, int y, const Bitmap& src) { return Blit(x, y, src, 0, 0, src._w, src._h); }
+
+	// 从外部缓冲区导入像素并转换成 BGRA32：data 有 GetH() 行，每行 GetW() 个
+	// format 格式的像素，相邻行的地址相差 pitch 字节，pitch 为负数时从下往上存放
+	inline void Import(const void *data, ptrdiff_t pitch, PixelFormat format) {
+		const KernelRegistry& kernel = KernelRegistry::Get();
+		ForEachRow([&] (int y, uint32_t *row) {
+				kernel.unpack(row, (const uint8_t*)data + y * pitch, _w, format);
+			});
+	}
 
-	// 双线性插值计算：给出四个点的颜色，以及坐标偏移，计算结果
+	// 把像素转换成 format 格式导出到外部缓冲区，参数和 Import 相同
+	inline void Export(void *data, ptrdiff_t pitch, PixelFormat format) const {
+		const KernelRegistry& kernel = KernelRegistry::Get();
+		ForEachRow([&] (int y, const uint32_t *row) {
+				kernel.pack((uint8_t*)data + y * pitch, row, _w, format);
+			});
+	}
+
+	// 构造时 padded 是否为 true
+	inline bool IsPadded() const { return _pitch != CalcPitch(_w, false); }
+
+public:
+
+	// 双线性插值计算：给出四个点的颜色，以及坐标偏移 (0-255)，计算结果
 	inline static uint32_t BilinearInterp(uint32_t tl, uint32_t tr, 
 		uint32_t bl, uint32_t br, int32_t distx, int32_t disty) {
 		uint32_t f, r;
@@ -1099,6 +2224,44 @@ protected:
 		return r;
 	}
 
+protected:
+
+	// 按像素数限制线程数，小图片串行执行
+	inline int CalcThreads(int threads) const {
+		return ((int64_t)_w * _h < BITMAP_PARALLEL_MIN)? 1 : threads;
+	}
+
+	// 多线程对 0 到 count - 1 行调用 func(y)，相邻的若干行作为一个任务，
+	// 每个任务大约处理 64KB
+	template <typename F>
+	inline void ForEachBand(int count, F&& func, int threads) const {
+		if (_w <= 0 || count <= 0) return;
+		int rows = Max(1, 16384 / _w);
+		int tasks = (count + rows - 1) / rows;
+		ParallelFor(tasks, CalcThreads(threads), [&] (int index) {
+				for (int y = index * rows; y < Min(count, (index + 1) * rows); y++) func(y);
+			});
+	}
+
+	// 像素内存从 BitmapPool 分配，起始地址 64 字节对齐，大图片启用大页以后
+	// 使用 2MB 的页
+	inline static uint8_t *AllocBits(int pitch, int height, MemoryCategory category = MEMORY_TEXTURE) {
+		uint8_t *bits = (uint8_t*)BitmapPool::Get().Alloc((size_t)pitch * height, category);
+		if (bits == NULL) throw std::bad_alloc();
+		return bits;
+	}
+
+	// 给文件名构造函数用：读取失败时抛出异常
+	inline static std::unique_ptr<Bitmap> LoadChecked(const char *filename) {
+		std::unique_ptr<Bitmap> bmp = LoadFile(filename);
+		if (bmp == NULL) {
+			std::string msg = "load failed: ";
+			msg.append(filename);
+			throw std::runtime_error(msg);
+		}
+		return bmp;
+	}
+
 protected:
 	int32_t _w;
 	int32_t _h;
@@ -1106,6 +2269,81 @@ protected:
 	uint8_t *_bits;
 };
 
+// 容器扩容时只有 noexcept 的移动构造才会被使用，否则退回复制像素
+static_assert(std::is_nothrow_move_constructible<Bitmap>::value, "Bitmap must be nothrow movable");
+
+
+// 纹理的 NUMA 副本：每个节点一份，由绑定在该节点上的线程复制，内存位于
+// 节点本地。PS 里用 Local() 取得当前线程所在节点的副本，避免跨节点读取纹理
+class BitmapReplicas
+{
+public:
+	inline BitmapReplicas(const Bitmap& source) {
+		const NumaTopology& topology = NumaTopology::Get();
+		int nodes = topology.GetNodeCount();
+		_replicas.resize(nodes);
+		if (nodes <= 1) {
+			_replicas[0] = new Bitmap(source);
+			return;
+		}
+		for (int node = 0; node < nodes; node++) {
+			std::thread thread([this, &source, &topology, node] () { 
+					topology.PinCurrentThread(node);
+					_replicas[node] = new Bitmap(source); 
+				});
+			thread.join();
+		}
+	}
+
+	inline virtual ~BitmapReplicas() {
+		for (auto bitmap: _replicas) delete bitmap;
+	}
+
+	inline const Bitmap& Local() const {
+		return *_replicas[NumaTopology::Get().GetCurrentNode()];
+	}
+
+	inline const Bitmap& Get(int node) const { return *_replicas[node]; }
+	inline int GetCount() const { return (int)_replicas.size(); }
+
+protected:
+	BitmapReplicas(const BitmapReplicas&) = delete;
+	BitmapReplicas& operator=(const BitmapReplicas&) = delete;
+
+protected:
+	std::vector<Bitmap*> _replicas;
+};
+
+
+// 共享的只读位图：复制句柄只增加引用计数，纹理和渲染结果可以在线程和各个
+// 处理阶段之间传递而不复制像素。需要修改时调用 Write()，如果还有其他句柄
+// 引用同一份数据，先复制一份再修改 (写时复制)，其他句柄看到的内容不变
+class SharedBitmap
+{
+public:
+	inline SharedBitmap() {}
+	inline SharedBitmap(Bitmap&& bitmap): _ptr(std::make_shared<Bitmap>(std::move(bitmap))) {}
+	inline explicit SharedBitmap(const std::shared_ptr<Bitmap>& ptr): _ptr(ptr) {}
+
+	inline const Bitmap *Get() const { return _ptr.get(); }
+	inline const Bitmap& operator * () const { return *_ptr; }
+	inline const Bitmap *operator -> () const { return _ptr.get(); }
+	inline explicit operator bool () const { return (bool)_ptr; }
+
+	// 取得可以修改的位图，和其他句柄共享时先复制
+	inline Bitmap& Write() {
+		if (_ptr.use_count() > 1) _ptr = std::make_shared<Bitmap>(*_ptr);
+		return *_ptr;
+	}
+
+	inline bool IsUnique() const { return _ptr.use_count() == 1; }
+	inline long GetRefCount() const { return _ptr.use_count(); }
+	inline void Reset() { _ptr.reset(); }
+
+protected:
+	std::shared_ptr<Bitmap> _ptr;
+};
+
 
 //---------------------------------------------------------------------
 // 着色器定义
@@ -1117,6 +2355,9 @@ struct ShaderContext {
 	std::map<int, Vec2f> varying_vec2f;    // 二维矢量 varying 列表
 	std::map<int, Vec3f> varying_vec3f;    // 三维矢量 varying 列表
 	std::map<int, Vec4f> varying_vec4f;    // 四维矢量 varying 列表
+	int x = 0;                             // 当前像素的屏幕坐标，由渲染器在调用 PS 前设置
+	int y = 0;
+	bool inner = true;                     // 保守光栅化时像素是否完全在三角形内，其他模式总为 true
 };
 
 
@@ -1131,83 +2372,632 @@ typedef std::function<Vec4f(int index, ShaderContext &output)> VertexShader;
 typedef std::function<Vec4f(ShaderContext &input)> PixelShader;
 
 
+// 像素包着色器：一次处理最多 PIXEL_PACKET 个像素，inputs/outputs 各有 count 项，
+// 适合解释执行的着色器把解释开销分摊到多个像素上，参考 ShaderDSL.h
+typedef std::function<void(ShaderContext *inputs, Vec4f *outputs, int count)> PixelPacketShader;
+
+// 像素包的大小
+const int PIXEL_PACKET = 8;
+
+
 //---------------------------------------------------------------------
-// RenderHelp
+// 着色器变体：用模板参数传递特性开关，编译期裁掉不需要的分支
 //---------------------------------------------------------------------
-class RenderHelp
-{
-public:
 
-	inline virtual ~RenderHelp() { Reset(); }
+// 常用的着色器特性位，可以自由扩展，最多 SHADER_FEATURE_BITS 位
+enum ShaderFeature {
+	SHADER_FEATURE_NORMALMAP = 1,     // 法向贴图
+	SHADER_FEATURE_SPECULAR = 2,      // 高光
+	SHADER_FEATURE_FOG = 4,           // 雾效
+	SHADER_FEATURE_ALPHATEST = 8,     // alpha 测试
+};
 
-	inline RenderHelp() {
-		_frame_buffer = NULL;
-		_depth_buffer = NULL;
-		_render_frame = false;
-		_render_pixel = true;
-	}
+const int SHADER_FEATURE_BITS = 4;
 
-	inline RenderHelp(int width, int height) {
-		_frame_buffer = NULL;
-		_depth_buffer = NULL;
-		_render_frame = false;
-		_render_pixel = true;
-		Init(width, height);
-	}
 
+// 着色器变体表：SHADER<FEATURES> 是以特性位集合为模板参数的类模板，需要提供
+// 静态函数 static Vec4f Shade(const DATA& data, ShaderContext& input)，函数内
+// 用 if constexpr (FEATURES & xxx) 判断特性，这样每个变体只包含自己需要的代码。
+// 全部 2^NBITS 个变体在编译期实例化，运行时按材质的特性位取出并缓存成 PixelShader
+template <template <uint32_t> class SHADER, typename DATA, int NBITS = SHADER_FEATURE_BITS>
+class ShaderPermutation
+{
 public:
+	typedef Vec4f (*ShadeFunction)(const DATA& data, ShaderContext& input);
+
+	// data 为材质等着色器参数，只保存引用，需要保证生命周期
+	inline ShaderPermutation(const DATA& data): _data(&data) {}
+
+	// 取得 features 对应的像素着色器，同一个变体只会生成一次
+	inline const PixelShader& Get(uint32_t features) {
+		features &= (1u << NBITS) - 1;
+		auto it = _cache.find(features);
+		if (it != _cache.end()) return it->second;
+		ShadeFunction shade = GetFunction(features);
+		const DATA *data = _data;
+		PixelShader ps = [shade, data] (ShaderContext& input) -> Vec4f {
+				return shade(*data, input);
+			};
+		return _cache[features] = ps;
+	}
 
-	// 复位状态
-	inline void Reset() {
-		_vertex_shader = NULL;
-		_pixel_shader = NULL;
-		if (_frame_buffer) delete _frame_buffer;
-		_frame_buffer = NULL;
-		if (_depth_buffer) {
-			for (int j = 0; j < _fb_height; j++) {
-				if (_depth_buffer[j]) delete []_depth_buffer[j];
-				_depth_buffer[j] = NULL;
-			}
-			delete []_depth_buffer;
-			_depth_buffer= NULL;
-		}
-		_color_fg = 0xffffffff;
-		_color_bg = 0xff191970;
+	// 直接取得变体函数指针
+	inline static ShadeFunction GetFunction(uint32_t features) {
+		static const ShadeFunction *table = MakeTable(std::make_index_sequence<(1u << NBITS)>());
+		return table[features & ((1u << NBITS) - 1)];
 	}
 
-	// 初始化 FrameBuffer，渲染前需要先调用
-	inline void Init(int width, int height) {
-		Reset();
-		_frame_buffer = new Bitmap(width, height);
-		_fb_width = width;
+protected:
+	template <size_t... I>
+	inline static const ShadeFunction *MakeTable(std::index_sequence<I...>) {
+		static const ShadeFunction table[] = { &SHADER<(uint32_t)I>::Shade... };
+		return table;
+	}
+
+protected:
+	const DATA *_data;
+	std::map<uint32_t, PixelShader> _cache;
+};
+
+
+// 精灵：屏幕空间的矩形贴图，用于 UI 和粒子，不经过 VS/PS 和透视插值
+struct Sprite {
+	Vec2f pos;         // 精灵中心的屏幕坐标（像素）
+	Vec2f size;        // 精灵宽高（像素）
+	Vec4f uv;          // 纹理坐标矩形：(u0, v0) 对应左上角，(u1, v1) 对应右下角
+	uint32_t color;    // 调制颜色，和纹理颜色逐分量相乘，alpha 参与混合
+	float rotation;    // 绕中心的旋转角度（弧度），为 0 时走轴对齐快速路径
+};
+
+
+// 图元拓扑：三角形列表，三角形带，三角扇
+enum PrimitiveTopology {
+	TOPOLOGY_TRIANGLE_LIST = 0,     // 每三个顶点组成一个独立三角形
+	TOPOLOGY_TRIANGLE_STRIP = 1,    // 三角形带：第 n 个三角形由顶点 n, n+1, n+2 组成
+	TOPOLOGY_TRIANGLE_FAN = 2,      // 三角扇：所有三角形共享第一个顶点
+};
+
+// 光栅化算法选择
+enum RasterizerMode {
+	RASTERIZER_AUTO = 0,         // 按照三角形面积和形状自动选择
+	RASTERIZER_HALFSPACE = 1,    // 外接矩形内逐点计算 Edge Equation
+	RASTERIZER_SCANLINE = 2,     // 扫描线：逐行求出被覆盖的区间
+};
+
+// 图元重启索引：索引数组中遇到该值时结束当前的三角形带/扇
+const int PRIMITIVE_RESTART = -1;
+
+// 保守光栅化模式
+enum ConservativeMode {
+	CONSERVATIVE_NONE = 0,     // 普通光栅化：只覆盖中心点在三角形内的像素
+	CONSERVATIVE_OUTER = 1,    // 覆盖三角形接触到的所有像素，深度取像素内最近的值
+	CONSERVATIVE_INNER = 2,    // 只覆盖完全在三角形内的像素，深度取像素内最远的值
+};
+
+// 深度缓存保存的值，两种都是越大越近，没有绘制过的点为 0
+enum DepthMode {
+	DEPTH_RHW = 0,    // 1/w，透视投影下精度分布更好
+	DEPTH_Z = 1,      // 1 - z/w，正交投影的 w 恒为 1，只能用 z 区分远近
+};
+
+
+//---------------------------------------------------------------------
+// 层次包围盒 (BVH)：用于光线求交
+//---------------------------------------------------------------------
+
+// 光线：origin + t * dir，只求 t 在 (0, tmax) 范围内的交点
+struct Ray {
+	Vec3f origin;
+	Vec3f dir;
+	float tmax;
+};
+
+// 交点：prim 为三角形序号，(u, v) 为重心坐标，三个顶点的权重
+// 依次是 1 - u - v, u, v
+struct RayHit {
+	float t;
+	int prim;
+	float u;
+	float v;
+};
+
+// BVH 节点：count > 0 为叶子，包含 index[start, start + count) 这些图元，
+// 否则为中间节点，两个子节点为 nodes[start] 和 nodes[start + 1]
+struct BVHNode {
+	Vec3f bmin;
+	Vec3f bmax;
+	int start;
+	int count;
+};
+
+// 光线和包围盒求交，inv_dir 为方向的倒数，返回进入距离，不相交返回 -1
+inline static float bvh_ray_box(const Vec3f& origin, const Vec3f& inv_dir, float tmax,
+		const Vec3f& bmin, const Vec3f& bmax) {
+	float t0 = 0.0f, t1 = tmax;
+	for (int i = 0; i < 3; i++) {
+		float ta = (bmin[i] - origin[i]) * inv_dir[i];
+		float tb = (bmax[i] - origin[i]) * inv_dir[i];
+		if (ta > tb) std::swap(ta, tb);
+		t0 = (ta > t0)? ta : t0;
+		t1 = (tb < t1)? tb : t1;
+		if (t0 > t1) return -1.0f;
+	}
+	return t0;
+}
+
+// 遍历 BVH 的栈深度。SAH 划分可能很不均匀，超过 BVH_SAH_DEPTH 层以后
+// 改为按中位数平分，再往下最多 31 层，树深不会超过栈的大小
+const int BVH_STACK_SIZE = 64;
+const int BVH_SAH_DEPTH = 32;
+
+// 根据图元包围盒建立 BVH，按分箱 SAH 划分，叶子最多 leaf_size 个图元，
+// index 输出叶子里的图元序号
+template <typename NodeAlloc, typename IndexAlloc>
+inline static void bvh_build(std::vector<BVHNode, NodeAlloc>& nodes, std::vector<int, IndexAlloc>& index,
+		const std::vector<Vec3f>& bmin, const std::vector<Vec3f>& bmax, int leaf_size = 4) {
+	const int BINS = 12;
+	int count = (int)bmin.size();
+	nodes.clear();
+	index.resize(count);
+	for (int i = 0; i < count; i++) index[i] = i;
+	if (count == 0) return;
+	std::vector<Vec3f> center(count);
+	for (int i = 0; i < count; i++) center[i] = (bmin[i] + bmax[i]) * 0.5f;
+	nodes.reserve(count * 2);
+	nodes.push_back({ Vec3f(), Vec3f(), 0, count });
+	std::vector<std::pair<int, int>> stack = { { 0, 0 } };    // 节点和所在层数
+	while (!stack.empty()) {
+		int id = stack.back().first;
+		int depth = stack.back().second;
+		stack.pop_back();
+		int start = nodes[id].start, n = nodes[id].count;
+		Vec3f nmin = bmin[index[start]], nmax = bmax[index[start]];
+		Vec3f cmin = center[index[start]], cmax = cmin;
+		for (int i = start + 1; i < start + n; i++) {
+			nmin = vector_min(nmin, bmin[index[i]]);
+			nmax = vector_max(nmax, bmax[index[i]]);
+			cmin = vector_min(cmin, center[index[i]]);
+			cmax = vector_max(cmax, center[index[i]]);
+		}
+		nodes[id].bmin = nmin;
+		nodes[id].bmax = nmax;
+		if (n <= leaf_size) continue;
+		// 在中心点范围最大的轴上分箱，求表面积代价最小的划分
+		int axis = 0;
+		Vec3f ext = cmax - cmin;
+		if (ext.y > ext[axis]) axis = 1;
+		if (ext.z > ext[axis]) axis = 2;
+		if (ext[axis] <= 0.0f) continue;
+		float scale = BINS / ext[axis];
+		int bin_count[BINS] = { 0 };
+		Vec3f bin_min[BINS], bin_max[BINS];
+		for (int i = start; i < start + n; i++) {
+			int p = index[i];
+			int b = Min(BINS - 1, (int)((center[p][axis] - cmin[axis]) * scale));
+			bin_min[b] = (bin_count[b] == 0)? bmin[p] : vector_min(bin_min[b], bmin[p]);
+			bin_max[b] = (bin_count[b] == 0)? bmax[p] : vector_max(bin_max[b], bmax[p]);
+			bin_count[b]++;
+		}
+		auto area = [] (const Vec3f& a, const Vec3f& b) -> float {
+			Vec3f d = b - a;
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		};
+		float left_area[BINS];
+		int left_count[BINS];
+		Vec3f lmin, lmax;
+		for (int b = 0, c = 0; b < BINS; b++) {
+			if (bin_count[b] > 0) {
+				lmin = (c == 0)? bin_min[b] : vector_min(lmin, bin_min[b]);
+				lmax = (c == 0)? bin_max[b] : vector_max(lmax, bin_max[b]);
+				c += bin_count[b];
+			}
+			left_count[b] = c;
+			left_area[b] = (c > 0)? area(lmin, lmax) : 0.0f;
+		}
+		float best_cost = n * area(nmin, nmax);
+		int best = -1;
+		Vec3f rmin, rmax;
+		for (int b = BINS - 1, c = 0; b > 0 && depth < BVH_SAH_DEPTH; b--) {
+			if (bin_count[b] > 0) {
+				rmin = (c == 0)? bin_min[b] : vector_min(rmin, bin_min[b]);
+				rmax = (c == 0)? bin_max[b] : vector_max(rmax, bin_max[b]);
+				c += bin_count[b];
+			}
+			if (c == 0 || left_count[b - 1] == 0) continue;
+			float cost = left_count[b - 1] * left_area[b - 1] + c * area(rmin, rmax);
+			if (cost < best_cost) best_cost = cost, best = b;
+		}
+		int mid;
+		if (best > 0) {
+			int *first = &index[start];
+			mid = start + (int)(std::partition(first, first + n, [&] (int p) {
+					return Min(BINS - 1, (int)((center[p][axis] - cmin[axis]) * scale)) < best;
+				}) - first);
+		}
+		else {
+			// 代价没有改善或者层数太深时按中位数平分，避免叶子过大
+			mid = start + n / 2;
+			std::nth_element(&index[start], &index[mid], &index[start] + n, [&] (int a, int b) {
+					return center[a][axis] < center[b][axis];
+				});
+		}
+		int left = (int)nodes.size();
+		nodes.push_back({ Vec3f(), Vec3f(), start, mid - start });
+		nodes.push_back({ Vec3f(), Vec3f(), mid, start + n - mid });
+		nodes[id].start = left;
+		nodes[id].count = 0;
+		stack.push_back({ left, depth + 1 });
+		stack.push_back({ left + 1, depth + 1 });
+	}
+}
+
+
+// 光线包的大小：2x2 个像素
+const int RAY_PACKET = 4;
+
+// 三角形网格的 BVH，每三个顶点组成一个三角形
+class MeshBVH
+{
+public:
+	inline MeshBVH() {}
+	inline MeshBVH(const std::vector<Vec3f>& verts) { Build(verts); }
+
+	inline void Build(const std::vector<Vec3f>& verts) {
+		_verts.assign(verts.begin(), verts.end());
+		int count = (int)_verts.size() / 3;
+		std::vector<Vec3f> bmin(count), bmax(count);
+		for (int i = 0; i < count; i++) {
+			const Vec3f *p = &_verts[i * 3];
+			bmin[i] = vector_min(vector_min(p[0], p[1]), p[2]);
+			bmax[i] = vector_max(vector_max(p[0], p[1]), p[2]);
+		}
+		bvh_build(_nodes, _index, bmin, bmax);
+	}
+
+	inline int GetTriangleCount() const { return (int)_verts.size() / 3; }
+	inline int GetNodeCount() const { return (int)_nodes.size(); }
+	inline const Vec3f& GetVertex(int prim, int k) const { return _verts[prim * 3 + k]; }
+
+	// 顶点，节点和索引占用的字节数
+	inline size_t GetMemorySize() const {
+		return _verts.capacity() * sizeof(Vec3f) + _nodes.capacity() * sizeof(BVHNode) 
+			+ _index.capacity() * sizeof(int);
+	}
+
+	// 取得整个网格的包围盒，空网格返回 false
+	inline bool GetBounds(Vec3f& bmin, Vec3f& bmax) const {
+		if (_nodes.empty()) return false;
+		bmin = _nodes[0].bmin;
+		bmax = _nodes[0].bmax;
+		return true;
+	}
+
+	// 求最近的交点，hit.t 为交点距离，没有交点返回 false
+	inline bool Intersect(const Ray& ray, RayHit& hit) const {
+		hit.t = ray.tmax;
+		hit.prim = -1;
+		Traverse(ray, hit, false);
+		return hit.prim >= 0;
+	}
+
+	// 只判断 tmax 范围内是否有遮挡，找到任意交点就返回，比 Intersect 快
+	inline bool Occluded(const Ray& ray) const {
+		RayHit hit = { ray.tmax, -1, 0.0f, 0.0f };
+		Traverse(ray, hit, true);
+		return hit.prim >= 0;
+	}
+
+	// 光线包求交：最多 RAY_PACKET 条光线一起遍历，节点只要和其中任意一条
+	// 光线相交就访问。相邻像素的光线访问的节点基本相同，节点数据只读取一次，
+	// 包围盒测试按分量展开成固定长度的循环，方便编译器向量化。返回命中数
+	inline int IntersectPacket(const Ray *rays, RayHit *hits, int count) const {
+		float ox[RAY_PACKET], oy[RAY_PACKET], oz[RAY_PACKET];
+		float ix[RAY_PACKET], iy[RAY_PACKET], iz[RAY_PACKET], tmax[RAY_PACKET];
+		count = Min(count, RAY_PACKET);
+		for (int i = 0; i < RAY_PACKET; i++) {
+			// 不足 RAY_PACKET 条时，空余的光线 tmax 为负数，永远不会相交
+			const Ray& ray = rays[Min(i, count - 1)];
+			ox[i] = ray.origin.x; oy[i] = ray.origin.y; oz[i] = ray.origin.z;
+			ix[i] = 1.0f / ray.dir.x; iy[i] = 1.0f / ray.dir.y; iz[i] = 1.0f / ray.dir.z;
+			tmax[i] = (i < count)? ray.tmax : -1.0f;
+			if (i < count) hits[i] = { ray.tmax, -1, 0.0f, 0.0f };
+		}
+		if (_nodes.empty() || count <= 0) return 0;
+		int stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const BVHNode& node = _nodes[stack[--top]];
+			bool visit = false;
+			for (int i = 0; i < RAY_PACKET; i++) {
+				float ta = (node.bmin.x - ox[i]) * ix[i], tb = (node.bmax.x - ox[i]) * ix[i];
+				float t0 = Max(0.0f, Min(ta, tb)), t1 = Min(tmax[i], Max(ta, tb));
+				ta = (node.bmin.y - oy[i]) * iy[i]; tb = (node.bmax.y - oy[i]) * iy[i];
+				t0 = Max(t0, Min(ta, tb)); t1 = Min(t1, Max(ta, tb));
+				ta = (node.bmin.z - oz[i]) * iz[i]; tb = (node.bmax.z - oz[i]) * iz[i];
+				t0 = Max(t0, Min(ta, tb)); t1 = Min(t1, Max(ta, tb));
+				visit |= (t0 <= t1);
+			}
+			if (!visit) continue;
+			if (node.count > 0) {
+				for (int k = node.start; k < node.start + node.count; k++) {
+					int prim = _index[k];
+					for (int i = 0; i < count; i++) {
+						float t, u, v;
+						if (IntersectTriangle(rays[i], &_verts[prim * 3], tmax[i], t, u, v)) {
+							hits[i] = { t, prim, u, v };
+							tmax[i] = t;
+						}
+					}
+				}
+				continue;
+			}
+			// 按照第一条光线的方向决定子节点的访问顺序
+			const BVHNode& a = _nodes[node.start];
+			const BVHNode& b = _nodes[node.start + 1];
+			Vec3f d = (a.bmin + a.bmax) - (b.bmin + b.bmax);
+			bool a_first = vector_dot(d, rays[0].dir) <= 0.0f;
+			stack[top++] = a_first? node.start + 1 : node.start;
+			stack[top++] = a_first? node.start : node.start + 1;
+		}
+		int hit = 0;
+		for (int i = 0; i < count; i++) hit += (hits[i].prim >= 0)? 1 : 0;
+		return hit;
+	}
+
+	// 光线和三角形求交 (Möller-Trumbore)，不区分正反面
+	inline static bool IntersectTriangle(const Ray& ray, const Vec3f *p, float tmax, 
+			float& t, float& u, float& v) {
+		Vec3f e1 = p[1] - p[0];
+		Vec3f e2 = p[2] - p[0];
+		Vec3f pv = vector_cross(ray.dir, e2);
+		float det = vector_dot(e1, pv);
+		if (det == 0.0f) return false;
+		float inv = 1.0f / det;
+		Vec3f tv = ray.origin - p[0];
+		u = vector_dot(tv, pv) * inv;
+		if (u < 0.0f || u > 1.0f) return false;
+		Vec3f qv = vector_cross(tv, e1);
+		v = vector_dot(ray.dir, qv) * inv;
+		if (v < 0.0f || u + v > 1.0f) return false;
+		t = vector_dot(e2, qv) * inv;
+		return t > 0.0f && t < tmax;
+	}
+
+protected:
+
+	inline void Traverse(const Ray& ray, RayHit& hit, bool any) const {
+		if (_nodes.empty()) return;
+		Vec3f inv_dir = Vec3f(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+		// 栈里同时保存节点的进入距离，出栈时已经找到更近的交点就跳过
+		int stack[BVH_STACK_SIZE];
+		float enter[BVH_STACK_SIZE];
+		int top = 0;
+		float t0 = bvh_ray_box(ray.origin, inv_dir, hit.t, _nodes[0].bmin, _nodes[0].bmax);
+		if (t0 < 0.0f) return;
+		stack[top] = 0;
+		enter[top++] = t0;
+		while (top > 0) {
+			top--;
+			if (enter[top] >= hit.t) continue;
+			const BVHNode& node = _nodes[stack[top]];
+			if (node.count > 0) {
+				for (int i = node.start; i < node.start + node.count; i++) {
+					int prim = _index[i];
+					float t, u, v;
+					if (IntersectTriangle(ray, &_verts[prim * 3], hit.t, t, u, v)) {
+						hit = { t, prim, u, v };
+						if (any) return;
+					}
+				}
+				continue;
+			}
+			// 先访问较近的子节点，远的子节点出栈时如果比已找到的交点还远就剪掉
+			const BVHNode& a = _nodes[node.start];
+			const BVHNode& b = _nodes[node.start + 1];
+			float ta = bvh_ray_box(ray.origin, inv_dir, hit.t, a.bmin, a.bmax);
+			float tb = bvh_ray_box(ray.origin, inv_dir, hit.t, b.bmin, b.bmax);
+			bool a_first = (tb < 0.0f) || (ta >= 0.0f && ta <= tb);
+			if (a_first) {
+				if (tb >= 0.0f) stack[top] = node.start + 1, enter[top++] = tb;
+				if (ta >= 0.0f) stack[top] = node.start, enter[top++] = ta;
+			}
+			else {
+				if (ta >= 0.0f) stack[top] = node.start, enter[top++] = ta;
+				stack[top] = node.start + 1, enter[top++] = tb;
+			}
+		}
+	}
+
+protected:
+	std::vector<Vec3f, MemoryAllocator<Vec3f, MEMORY_MESH>> _verts;      // 三角形顶点，每三个一组
+	std::vector<BVHNode, MemoryAllocator<BVHNode, MEMORY_MESH>> _nodes;
+	std::vector<int, MemoryAllocator<int, MEMORY_MESH>> _index;          // 叶子引用的三角形序号
+};
+
+
+//---------------------------------------------------------------------
+// 帧捕获接口
+//---------------------------------------------------------------------
+
+// 影响绘制结果的渲染状态，用于保存和恢复
+struct RenderState {
+	uint32_t color_fg;
+	uint32_t color_bg;
+	bool render_frame;
+	bool render_pixel;
+	int perspective_span;
+	RasterizerMode rasterizer;
+	ConservativeMode conservative;
+	DepthMode depth_mode;
+	bool alpha_test;
+	float alpha_ref;
+};
+
+class RenderHelp;
+
+// RenderHelp 在每次清屏和绘制之前调用，实现见 FrameCapture.h
+class CaptureSink
+{
+public:
+	inline virtual ~CaptureSink() {}
+	virtual void OnClear(const RenderHelp& rh) = 0;
+	virtual void OnDraw(const RenderHelp& rh, PrimitiveTopology topology, const int *indices, int count) = 0;
+	virtual void OnSprites(const RenderHelp& rh, const Sprite *sprites, int count, const Bitmap *texture) = 0;
+	virtual void OnRayCast(const RenderHelp& rh, const MeshBVH& bvh, const Mat4x4f& mvp) = 0;
+};
+
+
+//---------------------------------------------------------------------
+// RenderHelp
+//---------------------------------------------------------------------
+class RenderHelp
+{
+protected:
+
+	// 顶点结构体
+	struct Vertex {
+		ShaderContext context;    // 上下文
+		float rhw;                // w 的倒数
+		float depth;              // 写入深度缓存的值，见 DepthMode
+		Vec4f pos;                // 坐标
+		Vec2f spf;                // 浮点数屏幕坐标
+		Vec2i spi;                // 整数屏幕坐标
+	};
+
+public:
+
+	inline virtual ~RenderHelp() { Reset(); }
+
+	inline RenderHelp() {
+		_render_frame = false;
+		_render_pixel = true;
+		_num_threads = ParallelDefaultThreads();
+		_perspective_span = 0;
+		_rasterizer = RASTERIZER_AUTO;
+		_conservative = CONSERVATIVE_NONE;
+		_depth_mode = DEPTH_RHW;
+		_alpha_test = false;
+		_alpha_ref = 0.5f;
+		_packet_count = 0;
+		_capture = NULL;
+	}
+
+	inline RenderHelp(int width, int height) {
+		_render_frame = false;
+		_render_pixel = true;
+		_num_threads = ParallelDefaultThreads();
+		_perspective_span = 0;
+		_rasterizer = RASTERIZER_AUTO;
+		_conservative = CONSERVATIVE_NONE;
+		_depth_mode = DEPTH_RHW;
+		_alpha_test = false;
+		_alpha_ref = 0.5f;
+		_packet_count = 0;
+		_capture = NULL;
+		Init(width, height);
+	}
+
+	// 可以移动，不能复制：帧缓存和深度缓存随对象一起转移
+	inline RenderHelp(RenderHelp&& src) noexcept = default;
+	inline RenderHelp& operator = (RenderHelp&& src) noexcept = default;
+
+public:
+
+	// 复位状态
+	inline void Reset() {
+		_vertex_shader = NULL;
+		_pixel_shader = NULL;
+		_packet_shader = NULL;
+		_packet_count = 0;
+		_frame_buffer.reset();
+		_depth_buffer.clear();
+		_depth_block.reset();
+		_color_fg = 0xffffffff;
+		_color_bg = 0xff191970;
+	}
+
+	// 初始化 FrameBuffer，渲染前需要先调用
+	inline void Init(int width, int height) {
+		Reset();
+		// 帧缓存和深度缓存都先不初始化，由 Clear 里各个条带所属的线程首次写入
+		// 两者的行宽都补齐，避免相邻行映射到相同的缓存组
+		_frame_buffer = std::make_shared<Bitmap>(width, height, false, true, MEMORY_TARGET);
+		_fb_width = width;
 		_fb_height = height;
-		_depth_buffer = new float*[height];
+		_depth_buffer.resize(height);
+		int stride = Bitmap::CalcPitch(width, true) / 4;
+		float *block = (float*)MemoryAlloc(sizeof(float) * stride * height, MEMORY_TARGET);
+		if (block == NULL) throw std::bad_alloc();
+		_depth_block.reset(block);
 		for (int j = 0; j < height; j++) {
-			_depth_buffer[j] = new float[width];
+			_depth_buffer[j] = block + j * stride;
 		}
 		Clear();
 	}
 
 	// 清空 FrameBuffer 和深度缓存
 	inline void Clear() {
-		if (_frame_buffer) {
-			_frame_buffer->Fill(_color_bg);
-		}
-		if (_depth_buffer) {
-			for (int j = 0; j < _fb_height; j++) {
-				for (int i = 0; i < _fb_width; i++) 
-					_depth_buffer[j][i] = 0.0f;
+		if (_frame_buffer == NULL || _depth_buffer.empty()) return;
+		if (_capture) _capture->OnClear(*this);
+		// 上一帧还被 GetFrame 取出的句柄引用时换一块新的帧缓存，反正马上要
+		// 整个清除，不需要复制；新的内存通常直接从 BitmapPool 里复用
+		if (_frame_buffer.use_count() > 1) 
+			_frame_buffer = std::make_shared<Bitmap>(_fb_width, _fb_height, false, true, MEMORY_TARGET);
+		const KernelRegistry& kernel = KernelRegistry::Get();
+		int nbands = (_fb_height + BAND_ROWS - 1) / BAND_ROWS;
+		auto clear_band = [&] (int band) {
+			for (int j = band * BAND_ROWS; j < Min(_fb_height, (band + 1) * BAND_ROWS); j++) {
+				kernel.fill32((uint32_t*)_frame_buffer->GetLine(j), _color_bg, _fb_width);
+				kernel.fill_float(_depth_buffer[j], 0.0f, _fb_width);
 			}
-		}
+		};
+		// 多个 NUMA 节点时由各条带所属节点的线程清除，同时完成 first-touch
+		if (NumaTopology::Get().GetNodeCount() > 1) 
+			ParallelForNodes(nbands, _num_threads, clear_band, &_numa_stats);
+		else 
+			for (int band = 0; band < nbands; band++) clear_band(band);
 	}
 
 	// 设置 VS/PS 着色器函数
 	inline void SetVertexShader(VertexShader vs) { _vertex_shader = vs; }
 	inline void SetPixelShader(PixelShader ps) { _pixel_shader = ps; }
 
+	// 设置像素包着色器，设置以后代替 PixelShader，传入 NULL 取消
+	inline void SetPixelPacketShader(PixelPacketShader ps) { _packet_shader = ps; }
+
 	// 保存 FrameBuffer 到 BMP 文件
 	inline void SaveFile(const char *filename) { if (_frame_buffer) _frame_buffer->SaveFile(filename); }
 
+	// 取得当前帧的只读句柄，不复制像素，可以交给其他线程保存或显示。
+	// 一帧画完以后调用，下次 Clear 会换用新的帧缓存，句柄里的内容不再变化
+	inline SharedBitmap GetFrame() const { return SharedBitmap(_frame_buffer); }
+
+	// 当前占用的内存：帧缓存和深度缓存计入 MEMORY_TARGET，顶点和像素包的
+	// 上下文计入 MEMORY_SCRATCH。已经被 GetFrame 交出去的旧帧不算在内
+	inline MemoryUsage GetMemoryUsage() const {
+		MemoryUsage usage;
+		if (_frame_buffer) usage.bytes[MEMORY_TARGET] += _frame_buffer->GetMemorySize();
+		usage.bytes[MEMORY_TARGET] += MemoryGetSize(_depth_block.get());
+		usage.bytes[MEMORY_TARGET] += _depth_buffer.capacity() * sizeof(float*);
+		usage.bytes[MEMORY_SCRATCH] += sizeof(RenderHelp);
+		for (int k = 0; k < 3; k++) 
+			usage.bytes[MEMORY_SCRATCH] += GetContextMemorySize(_vertex[k].context);
+		for (int i = 0; i < PIXEL_PACKET; i++) 
+			usage.bytes[MEMORY_SCRATCH] += GetContextMemorySize(_packet_input[i]);
+		return usage;
+	}
+
+	// 取得 FrameBuffer 尺寸
+	inline int GetWidth() const { return _fb_width; }
+	inline int GetHeight() const { return _fb_height; }
+
+	// 读取深度缓存：返回该点的 1/w（DEPTH_Z 模式下为 1 - z/w），没有绘制过的点为 0
+	inline float GetDepth(int x, int y) const { 
+		if (_depth_buffer.empty() || x < 0 || y < 0 || x >= _fb_width || y >= _fb_height) return 0.0f;
+		return _depth_buffer[y][x];
+	}
+
 	// 设置背景/前景色
 	inline void SetBGColor(uint32_t color) { _color_bg = color; }
 	inline void SetFGColor(uint32_t color) { _color_fg = color; }
@@ -1228,6 +3018,80 @@ public:
 		_render_pixel = pixel;
 	}
 
+	// 设置透视矫正的 span 长度：0 为逐像素精确矫正（默认），设置为 8 或 16 时
+	// 每隔 span 个像素精确计算一次，中间线性插值；三角形 w 变化太大导致误差超出
+	// 阈值时会自动缩短 span 甚至退回逐像素矫正
+	inline void SetPerspectiveSpan(int span) { _perspective_span = Max(0, span); }
+
+	// 设置 alpha 测试：开启后 PS 返回颜色的 alpha 小于 ref 的像素被丢弃，
+	// 不写颜色也不写深度，配合 SHADER_FEATURE_ALPHATEST 做镂空贴图
+	inline void SetAlphaTest(bool enable, float ref = 0.5f) { 
+		_alpha_test = enable; 
+		_alpha_ref = ref; 
+	}
+
+	// 设置光栅化算法，两种算法覆盖的像素完全相同，默认自动选择
+	inline void SetRasterizer(RasterizerMode mode) { _rasterizer = mode; }
+
+	// 设置保守光栅化模式：低分辨率的遮挡缓存用 CONSERVATIVE_INNER 绘制遮挡物，
+	// 写入的深度不会超过遮挡物真实覆盖的范围，被测物体用 CONSERVATIVE_OUTER
+	// 绘制，不会因为三角形太细而漏掉，深度取像素内最近的值，两者配合可以
+	// 安全地降低剔除的分辨率
+	inline void SetConservative(ConservativeMode mode) { _conservative = mode; }
+
+	// 设置深度缓存保存的值，默认 DEPTH_RHW，使用 matrix_set_ortho 时应该设置为
+	// DEPTH_Z。应该在清屏之前设置，同一帧里不要混用
+	inline void SetDepthMode(DepthMode mode) { _depth_mode = mode; }
+	inline DepthMode GetDepthMode() const { return _depth_mode; }
+
+	// 设置并行绘制使用的线程数，1 为单线程
+	inline void SetThreads(int n) { _num_threads = Max(1, n); }
+	inline int GetThreads() const { return _num_threads; }
+
+	// 取得和恢复全部渲染状态
+	inline RenderState GetState() const {
+		RenderState state;
+		state.color_fg = _color_fg;
+		state.color_bg = _color_bg;
+		state.render_frame = _render_frame;
+		state.render_pixel = _render_pixel;
+		state.perspective_span = _perspective_span;
+		state.rasterizer = _rasterizer;
+		state.conservative = _conservative;
+		state.depth_mode = _depth_mode;
+		state.alpha_test = _alpha_test;
+		state.alpha_ref = _alpha_ref;
+		return state;
+	}
+
+	inline void SetState(const RenderState& state) {
+		_color_fg = state.color_fg;
+		_color_bg = state.color_bg;
+		_render_frame = state.render_frame;
+		_render_pixel = state.render_pixel;
+		_perspective_span = state.perspective_span;
+		_rasterizer = state.rasterizer;
+		_conservative = state.conservative;
+		_depth_mode = state.depth_mode;
+		_alpha_test = state.alpha_test;
+		_alpha_ref = state.alpha_ref;
+	}
+
+	// 取得当前的顶点着色器
+	inline const VertexShader& GetVertexShader() const { return _vertex_shader; }
+
+	// 设置帧捕获，之后的清屏和绘制都会先通知 capture，传入 NULL 停止捕获
+	inline void SetCapture(CaptureSink *capture) { _capture = capture; }
+
+	// 并行绘制的 NUMA 统计：条带在所属节点以外执行的比例，可以调用 Reset 清零
+	inline NumaStats& GetNumaStats() { return _numa_stats; }
+
+	// 判断三个顶点的 1/w 是否在误差范围内相等
+	inline static bool IsConstantW(float rhw0, float rhw1, float rhw2) {
+		float e = Abs(rhw0) * CONSTANT_W_EPSILON;
+		return NearEqual(rhw0, rhw1, e) && NearEqual(rhw0, rhw2, e);
+	}
+
 	// 判断一条边是不是三角形的左上边 (Top-Left Edge)
 	inline bool IsTopLeft(const Vec2i& a, const Vec2i& b) {
 		return ((a.y == b.y) && (a.x < b.x)) || (a.y > b.y);
@@ -1239,79 +3103,709 @@ public:
 	inline bool DrawPrimitive() {
 		if (_frame_buffer == NULL || _vertex_shader == NULL) 
 			return false;
+		if (_capture) _capture->OnDraw(*this, TOPOLOGY_TRIANGLE_LIST, NULL, 3);
 
-		// 顶点初始化
+		// 顶点初始化，VS 的 index 依次为 0, 1, 2
 		for (int k = 0; k < 3; k++) {
-			Vertex& vertex = _vertex[k];
-
-			// 清空上下文 varying 列表
-			vertex.context.varying_float.clear();
-			vertex.context.varying_vec2f.clear();
-			vertex.context.varying_vec3f.clear();
-			vertex.context.varying_vec4f.clear();
-
-			// 运行顶点着色程序，返回顶点坐标
-			vertex.pos = _vertex_shader(k, vertex.context);
-
-			// 简单裁剪，任何一个顶点超过 CVV 就剔除
-			float w = vertex.pos.w;
-			
-			// 这里图简单，当一个点越界，立马放弃整个三角形，更精细的做法是
-			// 如果越界了就在齐次空间内进行裁剪，拆分为 0-2 个三角形然后继续
-			if (w == 0.0f) return false;
-			if (vertex.pos.z < 0.0f || vertex.pos.z > w) return false;
-			if (vertex.pos.x < -w || vertex.pos.x > w) return false;
-			if (vertex.pos.y < -w || vertex.pos.y > w) return false;
-
-			// 计算 w 的倒数：Reciprocal of the Homogeneous W 
-			vertex.rhw = 1.0f / w;
-
-			// 齐次坐标空间 /w 归一化到单位体积 cvv
-			vertex.pos *= vertex.rhw;
-
-			// 计算屏幕坐标
-			vertex.spf.x = (vertex.pos.x + 1.0f) * _fb_width * 0.5f;
-			vertex.spf.y = (1.0f - vertex.pos.y) * _fb_height * 0.5f;
-
-			// 整数屏幕坐标：加 0.5 的偏移取屏幕像素方格中心对齐
-			vertex.spi.x = (int)(vertex.spf.x + 0.5f);
-			vertex.spi.y = (int)(vertex.spf.y + 0.5f);
-
-			// 更新外接矩形范围
+			if (ProcessVertex(_vertex[k], k) == false) 
+				return false;
+		}
+
+		return RasterizeTriangle(&_vertex[0], &_vertex[1], &_vertex[2]);
+	}
+
+	// 按照图元拓扑绘制 count 个顶点，VS 的 index 依次为 0 到 count - 1
+	// 三角形带和三角扇会在相邻三角形之间复用两个已经变换好的顶点
+	inline int DrawPrimitive(PrimitiveTopology topology, int count) {
+		if (_frame_buffer == NULL || _vertex_shader == NULL || count < 3) 
+			return 0;
+		if (_capture) _capture->OnDraw(*this, topology, NULL, count);
+		return DrawPrimitiveStream(topology, NULL, count);
+	}
+
+	// 按照索引数组绘制，VS 的 index 为索引数组里的值，
+	// 三角形带和三角扇遇到 PRIMITIVE_RESTART 时重新开始一组新的图元
+	inline int DrawIndexedPrimitive(PrimitiveTopology topology, const int *indices, int count) {
+		if (_frame_buffer == NULL || _vertex_shader == NULL || indices == NULL) 
+			return 0;
+		if (_capture) _capture->OnDraw(*this, topology, indices, count);
+		return DrawPrimitiveStream(topology, indices, count);
+	}
+
+	// 批量绘制精灵，texture 为 NULL 时只使用调制颜色，返回可见的精灵数量
+	// 精灵按照屏幕水平条带分箱，各条带由不同线程绘制，同一条带内保持提交顺序，
+	// 因此多线程结果和单线程完全一致。精灵不做深度测试，直接和背景进行 alpha 混合
+	inline int DrawSprites(const Sprite *sprites, int count, const Bitmap *texture) {
+		if (_frame_buffer == NULL || sprites == NULL || count <= 0) 
+			return 0;
+		if (_capture) _capture->OnSprites(*this, sprites, count, texture);
+		int nbands = (_fb_height + BAND_ROWS - 1) / BAND_ROWS;
+		std::vector<std::vector<int, TrackedAllocator<int, MEMORY_SCRATCH>>> bins(nbands);
+		int visible = 0;
+		for (int i = 0; i < count; i++) {
+			const Sprite& sp = sprites[i];
+			// 计算旋转后的外接矩形半径
+			float cs = Abs((float)cos(sp.rotation));
+			float sn = Abs((float)sin(sp.rotation));
+			float hy = (sp.size.x * sn + sp.size.y * cs) * 0.5f;
+			float hx = (sp.size.x * cs + sp.size.y * sn) * 0.5f;
+			if (sp.pos.x + hx <= 0.0f || sp.pos.x - hx >= _fb_width) continue;
+			int y0 = Max(0, (int)ceil(sp.pos.y - hy - 0.5f));
+			int y1 = Min(_fb_height, (int)ceil(sp.pos.y + hy - 0.5f));
+			if (y0 >= y1) continue;
+			for (int b = y0 / BAND_ROWS; b <= (y1 - 1) / BAND_ROWS; b++) 
+				bins[b].push_back(i);
+			visible++;
+		}
+		ParallelForNodes(nbands, _num_threads, [&] (int band) {
+				int y0 = band * BAND_ROWS;
+				int y1 = Min(_fb_height, y0 + BAND_ROWS);
+				for (int index: bins[band]) 
+					DrawSpriteBand(sprites[index], texture, y0, y1);
+			}, &_numa_stats);
+		return visible;
+	}
+
+	// 光线投射绘制：每个像素发射一条光线和 bvh 求最近交点，用交点的重心坐标
+	// 插值三个顶点的 varying，再执行同一个 PS，深度测试和 alpha 测试与光栅化
+	// 相同，两种方式绘制的物体可以混合。bvh 第 i 个三角形的三个顶点对应 VS 的
+	// index 为 3i, 3i + 1, 3i + 2，和 DrawPrimitive(TOPOLOGY_TRIANGLE_LIST, n)
+	// 一致，mvp 为 bvh 顶点所在空间到裁剪空间的矩阵。像素按 2x2 打包求交，
+	// 各行由不同线程绘制，所以 VS 和 PS 会被并发调用。设置了 PixelPacketShader
+	// 时和光栅化一样按像素包着色，像素包只有一份，这时只用一个线程。
+	// 返回被覆盖的像素数
+	inline int RayCastPrimitive(const MeshBVH& bvh, const Mat4x4f& mvp) {
+		if (_frame_buffer == NULL || _vertex_shader == NULL || _render_pixel == false) 
+			return 0;
+		if (_capture) _capture->OnRayCast(*this, bvh, mvp);
+		Mat4x4f inv = matrix_invert(mvp);
+		std::atomic<int> covered(0);
+		int rows = (_fb_height + 1) / 2;
+		int threads = (_packet_shader != NULL)? 1 : _num_threads;
+		ParallelForNodes(rows, threads, [&] (int row) {
+				// 相邻像素大多命中同一个三角形，缓存最近一次 VS 的结果
+				Vertex cache[3];
+				Vertex *vtx[3] = { &cache[0], &cache[1], &cache[2] };
+				int cached = -1;
+				int count = 0;
+				for (int x0 = 0; x0 < _fb_width; x0 += 2) {
+					Ray rays[RAY_PACKET];
+					RayHit hits[RAY_PACKET];
+					int px[RAY_PACKET], py[RAY_PACKET], n = 0;
+					for (int k = 0; k < RAY_PACKET; k++) {
+						int cx = x0 + (k & 1), cy = row * 2 + (k >> 1);
+						if (cx >= _fb_width || cy >= _fb_height) continue;
+						// 反投影像素中心在近平面和远平面上的点，t 从 0 到 1 对应近到远
+						float nx = (cx + 0.5f) * 2.0f / _fb_width - 1.0f;
+						float ny = 1.0f - (cy + 0.5f) * 2.0f / _fb_height;
+						Vec4f pn = Vec4f(nx, ny, 0.0f, 1.0f) * inv;
+						Vec4f pf = Vec4f(nx, ny, 1.0f, 1.0f) * inv;
+						rays[n].origin = pn.xyz() / pn.w;
+						rays[n].dir = pf.xyz() / pf.w - rays[n].origin;
+						rays[n].tmax = 1.0f;
+						px[n] = cx;
+						py[n] = cy;
+						n++;
+					}
+					if (bvh.IntersectPacket(rays, hits, n) == 0) continue;
+					for (int k = 0; k < n; k++) {
+						const RayHit& hit = hits[k];
+						if (hit.prim < 0) continue;
+						if (hit.prim != cached) {
+							for (int j = 0; j < 3; j++) {
+								cache[j].context.varying_float.clear();
+								cache[j].context.varying_vec2f.clear();
+								cache[j].context.varying_vec3f.clear();
+								cache[j].context.varying_vec4f.clear();
+								cache[j].pos = _vertex_shader(hit.prim * 3 + j, cache[j].context);
+							}
+							cached = hit.prim;
+						}
+						// 模型空间的重心坐标就是透视矫正后的插值系数
+						float c0 = 1.0f - hit.u - hit.v, c1 = hit.u, c2 = hit.v;
+						float w = c0 * cache[0].pos.w + c1 * cache[1].pos.w + c2 * cache[2].pos.w;
+						if (w <= 0.0f) continue;
+						float depth = 1.0f / w;
+						if (_depth_mode == DEPTH_Z) {
+							float z = c0 * cache[0].pos.z + c1 * cache[1].pos.z + c2 * cache[2].pos.z;
+							depth = 1.0f - z / w;
+						}
+						int cx = px[k], cy = py[k];
+						if (depth < _depth_buffer[cy][cx]) continue;
+						if (_packet_shader != NULL) {
+							// 同一行的像素各不相同，先写深度后着色没有先后顺序问题
+							if (!_alpha_test) _depth_buffer[cy][cx] = depth;
+							count += QueuePixel(vtx, cx, cy, depth, c0, c1, c2);
+							continue;
+						}
+						if (!ShadePixel(vtx, cx, cy, c0, c1, c2)) continue;
+						_depth_buffer[cy][cx] = depth;
+						count++;
+					}
+				}
+				if (_packet_shader != NULL) count += FlushPixels();
+				covered += count;
+			}, &_numa_stats);
+		return covered;
+	}
+
+	// 是否应该用光线投射绘制有 triangles 个三角形的网格：光栅化的开销和三角形
+	// 数量成正比，光线投射和像素数成正比，只随三角形数对数增长
+	inline bool UseRayCast(int triangles) const {
+		return (float)triangles > (float)_fb_width * _fb_height * RAYCAST_MIN_DENSITY;
+	}
+
+	// 每帧按照三角形数量自动选择光栅化或者光线投射，VS 的 index 含义相同，
+	// 使用光线投射时返回 true
+	inline bool DrawMesh(const MeshBVH& bvh, const Mat4x4f& mvp) {
+		int triangles = bvh.GetTriangleCount();
+		if (UseRayCast(triangles)) {
+			RayCastPrimitive(bvh, mvp);
+			return true;
+		}
+		DrawPrimitive(TOPOLOGY_TRIANGLE_LIST, triangles * 3);
+		return false;
+	}
+
+protected:
+
+	// 平均每个像素的三角形数超过该值时改用光线投射
+	// 经验值：sample_16 扫描不同密度，单核上两者耗时在每个像素约 0.6 个
+	// 三角形处交叉，实际位置随机器、线程数和着色器开销变化
+	static constexpr float RAYCAST_MIN_DENSITY = 0.6f;
+
+	// 自动选择扫描线算法的阈值：外接矩形宽度和三角形面积（像素）
+	static const int SCANLINE_MIN_WIDTH = 8;
+	static const int SCANLINE_MIN_AREA = 32;
+
+	// 根据设置以及当前三角形外接矩形和面积决定是否使用扫描线算法
+	inline bool UseScanline(float area) const {
+		if (_rasterizer == RASTERIZER_SCANLINE) return true;
+		if (_rasterizer == RASTERIZER_HALFSPACE) return false;
+		int width = _max_x - _min_x + 1;
+		int height = _max_y - _min_y + 1;
+		// 细长的横向三角形每行覆盖的点多，竖直方向细长的三角形每行只有一两个点，
+		// 每行三次除法的开销不划算
+		if (width < SCANLINE_MIN_WIDTH || area < SCANLINE_MIN_AREA) return false;
+		return (height <= width * 8);
+	}
+
+	// 整数向下取整除法，b 必须大于零
+	inline static int FloorDiv(int a, int b) {
+		return (a >= 0)? (a / b) : -((-a + b - 1) / b);
+	}
+
+	// 对边 a->b 的 Edge Equation 在第 cy 行求解 E(cx) >= t 的 cx 范围，
+	// 结果和 [xl, xr] 求交集。E(cx) = A * cx + B 是 cx 的一次函数
+	inline static void EdgeSpan(const Vec2i& a, const Vec2i& b, int cy, int t, int& xl, int& xr) {
+		int A = -(b.y - a.y);
+		int B = a.x * (b.y - a.y) + (cy - a.y) * (b.x - a.x);
+		if (A > 0) {
+			// cx >= ceil((t - B) / A)
+			xl = Max(xl, -FloorDiv(B - t, A));
+		}
+		else if (A < 0) {
+			// cx <= floor((B - t) / -A)
+			xr = Min(xr, FloorDiv(B - t, -A));
+		}
+		else if (B < t) {
+			// 水平边：整行都在边的外面
+			xr = xl - 1;
+		}
+	}
+
+	// 判断三角形 w 是否为常量的相对误差
+	static constexpr float CONSTANT_W_EPSILON = 1e-5f;
+
+	// span 内线性插值允许的插值系数最大误差
+	static constexpr float PERSPECTIVE_SPAN_ERROR = 1.0f / 256.0f;
+
+	// 计算屏幕上某点透视矫正后的插值系数，inv_area 为有向总面积的倒数，
+	// 该点位于三角形外且 1/w 外推为非正数时返回 false
+	inline static bool PerspectiveWeights(Vertex *vtx[3], float inv_area, float x, float y, Vec3f& weights) {
+		Vec2f px = { x, y };
+		Vec2f s0 = vtx[0]->spf - px;
+		Vec2f s1 = vtx[1]->spf - px;
+		Vec2f s2 = vtx[2]->spf - px;
+		float a = vector_cross(s1, s2) * inv_area * vtx[0]->rhw;
+		float b = vector_cross(s2, s0) * inv_area * vtx[1]->rhw;
+		float c = vector_cross(s0, s1) * inv_area * vtx[2]->rhw;
+		float rhw = a + b + c;
+		if (rhw <= 0.0f) return false;
+		weights = Vec3f(a, b, c) * (1.0f / rhw);
+		return true;
+	}
+
+	// 根据三角形 1/w 的变化范围决定实际使用的 span 长度：
+	// 一段 span 内 1/w 的相对变化量为 d 时，线性插值代替透视矫正的误差约为 d^2 / 4，
+	// 要求误差不超过 PERSPECTIVE_SPAN_ERROR，即 d <= 2 * sqrt(PERSPECTIVE_SPAN_ERROR)
+	inline int PerspectiveSpanLength(Vertex *vtx[3], float inv_area) const {
+		int span = _perspective_span;
+		if (span <= 1) return 0;
+		// 1/w 沿屏幕 x 方向的梯度：即三个重心坐标的 x 方向偏导数加权求和
+		float ga = (vtx[1]->spf.y - vtx[2]->spf.y) * inv_area;
+		float gb = (vtx[2]->spf.y - vtx[0]->spf.y) * inv_area;
+		float gc = (vtx[0]->spf.y - vtx[1]->spf.y) * inv_area;
+		float grad = Abs(vtx[0]->rhw * ga + vtx[1]->rhw * gb + vtx[2]->rhw * gc);
+		float rhw_min = Min(vtx[0]->rhw, Min(vtx[1]->rhw, vtx[2]->rhw));
+		if (rhw_min <= 0.0f) return 0;
+		float limit = 2.0f * sqrtf(PERSPECTIVE_SPAN_ERROR) * rhw_min;
+		while (span > 1 && span * grad > limit) span >>= 1;
+		return (span >= 4)? span : 0;
+	}
+
+	// 帧缓存按照水平条带分给各个线程：精灵分箱和清屏都以条带为单位，
+	// 多个 NUMA 节点时条带按顺序连续地分给各个节点
+	static const int BAND_ROWS = 32;
+
+	// 按分量调制颜色：c = a * b / 255
+	inline static uint32_t ColorModulate(uint32_t a, uint32_t b) {
+		uint32_t c = 0;
+		for (int i = 0; i < 32; i += 8) {
+			uint32_t x = ((a >> i) & 0xff) * ((b >> i) & 0xff) + 255;
+			c |= ((x >> 8) & 0xff) << i;
+		}
+		return c;
+	}
+
+	// Alpha 混合：dst = src * a + dst * (1 - a)，a 为 src 的 alpha，
+	// 完全透明和完全不透明的像素直接返回
+	inline static uint32_t ColorBlend(uint32_t src, uint32_t dst) {
+		uint32_t a = src >> 24;
+		if (a == 0) return dst;
+		if (a == 255) return src;
+		return color_blend(src, dst);
+	}
+
+	// 在 [band_y0, band_y1) 行范围内绘制一个精灵：屏幕坐标到纹理坐标是仿射
+	// 变换，所以纹理坐标沿扫描线每个像素加一个常量即可，无需透视除法
+	inline void DrawSpriteBand(const Sprite& sp, const Bitmap *texture, int band_y0, int band_y1) {
+		if (sp.size.x <= 0.0f || sp.size.y <= 0.0f) return;
+		float cs = (float)cos(sp.rotation);
+		float sn = (float)sin(sp.rotation);
+		bool aligned = (sp.rotation == 0.0f);
+		float tw = (texture)? (float)texture->GetW() : 0.0f;
+		float th = (texture)? (float)texture->GetH() : 0.0f;
+
+		// 屏幕像素到精灵局部坐标 (s, t) 的映射，(s, t) 在 [0, 1) 内表示被覆盖
+		// s = ((x - cx) * cos + (y - cy) * sin) / w + 0.5
+		// t = ((y - cy) * cos - (x - cx) * sin) / h + 0.5
+		float dsdx = cs / sp.size.x, dsdy = sn / sp.size.x;
+		float dtdx = -sn / sp.size.y, dtdy = cs / sp.size.y;
+
+		// 局部坐标到纹理像素坐标，和 Sample2D 一样加 0.5 偏移
+		float du = (sp.uv.z - sp.uv.x) * tw, dv = (sp.uv.w - sp.uv.y) * th;
+		float u0 = sp.uv.x * tw + 0.5f, v0 = sp.uv.y * th + 0.5f;
+
+		// 外接矩形
+		float hx = (sp.size.x * Abs(cs) + sp.size.y * Abs(sn)) * 0.5f;
+		float hy = (sp.size.x * Abs(sn) + sp.size.y * Abs(cs)) * 0.5f;
+		int xmin = Max(0, (int)ceil(sp.pos.x - hx - 0.5f));
+		int xmax = Min(_fb_width, (int)ceil(sp.pos.x + hx - 0.5f));
+		int ymin = Max(band_y0, (int)ceil(sp.pos.y - hy - 0.5f));
+		int ymax = Min(band_y1, (int)ceil(sp.pos.y + hy - 0.5f));
+
+		const KernelRegistry& kernel = KernelRegistry::Get();
+
+		for (int y = ymin; y < ymax; y++) {
+			// 当前行第一个像素中心的局部坐标
+			float dx = xmin + 0.5f - sp.pos.x;
+			float dy = y + 0.5f - sp.pos.y;
+			float ls = dx * dsdx + dy * dsdy + 0.5f;
+			float lt = dx * dtdx + dy * dtdy + 0.5f;
+			uint32_t *line = (uint32_t*)_frame_buffer->GetLine(y);
+			if (aligned) {
+				// 轴对齐的精灵外接矩形就是覆盖范围，每次先算出一段像素的颜色，
+				// 再用向量化的内核一起混合
+				uint32_t row[64];
+				for (int x0 = xmin; x0 < xmax; x0 += 64) {
+					int n = Min(64, xmax - x0);
+					for (int i = 0; i < n; i++, ls += dsdx) {
+						uint32_t color = sp.color;
+						if (texture) {
+							uint32_t cc = texture->SampleBilinear(u0 + ls * du, v0 + lt * dv);
+							color = (color == 0xffffffff)? cc : ColorModulate(cc, color);
+						}
+						row[i] = color;
+					}
+					kernel.blend32(line + x0, row, n);
+				}
+				continue;
+			}
+			for (int x = xmin; x < xmax; x++, ls += dsdx, lt += dtdx) {
+				if (ls < 0.0f || ls >= 1.0f || lt < 0.0f || lt >= 1.0f) 
+					continue;
+				uint32_t color = sp.color;
+				if (texture) {
+					uint32_t cc = texture->SampleBilinear(u0 + ls * du, v0 + lt * dv);
+					color = (color == 0xffffffff)? cc : ColorModulate(cc, color);
+				}
+				uint32_t dst;
+				memcpy(&dst, line + x, sizeof(uint32_t));
+				dst = ColorBlend(color, dst);
+				memcpy(line + x, &dst, sizeof(uint32_t));
+			}
+		}
+	}
+
+	// 估算上下文里 varying 占用的内存：std::map 每个节点除了键值还有三个
+	// 指针和颜色位，按 32 字节估算
+	inline static size_t GetContextMemorySize(const ShaderContext& context) {
+		return (context.varying_float.size() * (sizeof(std::pair<int, float>) + 32)) + 
+			(context.varying_vec2f.size() * (sizeof(std::pair<int, Vec2f>) + 32)) + 
+			(context.varying_vec3f.size() * (sizeof(std::pair<int, Vec3f>) + 32)) + 
+			(context.varying_vec4f.size() * (sizeof(std::pair<int, Vec4f>) + 32));
+	}
+
+	// 运行顶点着色器并完成顶点变换，顶点越界则返回 false
+	inline bool ProcessVertex(Vertex& vertex, int index) {
+		// 清空上下文 varying 列表
+		vertex.context.varying_float.clear();
+		vertex.context.varying_vec2f.clear();
+		vertex.context.varying_vec3f.clear();
+		vertex.context.varying_vec4f.clear();
+
+		// 运行顶点着色程序，返回顶点坐标
+		vertex.pos = _vertex_shader(index, vertex.context);
+
+		// 简单裁剪，任何一个顶点超过 CVV 就剔除
+		float w = vertex.pos.w;
+		
+		// 这里图简单，当一个点越界，立马放弃整个三角形，更精细的做法是
+		// 如果越界了就在齐次空间内进行裁剪，拆分为 0-2 个三角形然后继续
+		if (w == 0.0f) return false;
+		if (vertex.pos.z < 0.0f || vertex.pos.z > w) return false;
+		if (vertex.pos.x < -w || vertex.pos.x > w) return false;
+		if (vertex.pos.y < -w || vertex.pos.y > w) return false;
+
+		// 计算 w 的倒数：Reciprocal of the Homogeneous W 
+		vertex.rhw = 1.0f / w;
+
+		// 齐次坐标空间 /w 归一化到单位体积 cvv
+		vertex.pos *= vertex.rhw;
+		vertex.depth = (_depth_mode == DEPTH_Z)? (1.0f - vertex.pos.z) : vertex.rhw;
+
+		// 计算屏幕坐标
+		vertex.spf.x = (vertex.pos.x + 1.0f) * _fb_width * 0.5f;
+		vertex.spf.y = (1.0f - vertex.pos.y) * _fb_height * 0.5f;
+
+		// 整数屏幕坐标：加 0.5 的偏移取屏幕像素方格中心对齐
+		vertex.spi.x = (int)(vertex.spf.x + 0.5f);
+		vertex.spi.y = (int)(vertex.spf.y + 0.5f);
+
+		return true;
+	}
+
+	// 绘制顶点流：indices 为 NULL 时顶点序号就是 0 到 count - 1
+	// 顶点变换结果保存在 _vertex 的三个槽位里，三角形带和三角扇每绘制
+	// 一个新三角形只需要变换一个新顶点，另外两个顶点从上一个三角形继承
+	inline int DrawPrimitiveStream(PrimitiveTopology topology, const int *indices, int count) {
+		Vertex *slot[3] = { &_vertex[0], &_vertex[1], &_vertex[2] };
+		bool valid[3] = { false, false, false };
+		int drawn = 0;
+		int nverts = 0;      // 当前这组图元里已经处理的顶点数
+		for (int i = 0; i < count; i++) {
+			int index = (indices)? indices[i] : i;
+
+			// 图元重启：丢弃缓存的顶点，后续顶点开始一组新的带/扇
+			if (index == PRIMITIVE_RESTART) {
+				nverts = 0;
+				continue;
+			}
+
+			if (topology == TOPOLOGY_TRIANGLE_LIST) {
+				valid[nverts] = ProcessVertex(*slot[nverts], index);
+				if (++nverts < 3) continue;
+				nverts = 0;
+				if (valid[0] && valid[1] && valid[2]) {
+					if (RasterizeTriangle(slot[0], slot[1], slot[2])) drawn++;
+				}
+				continue;
+			}
+
+			// 前两个顶点只变换不绘制
+			if (nverts < 2) {
+				valid[nverts] = ProcessVertex(*slot[nverts], index);
+				nverts++;
+				continue;
+			}
+
+			// 第三个槽位用于新顶点
+			valid[2] = ProcessVertex(*slot[2], index);
+
+			if (valid[0] && valid[1] && valid[2]) {
+				bool hr;
+				if (topology == TOPOLOGY_TRIANGLE_FAN) {
+					hr = RasterizeTriangle(slot[0], slot[1], slot[2]);
+				}
+				else if ((nverts & 1) == 0) {
+					hr = RasterizeTriangle(slot[0], slot[1], slot[2]);
+				}
+				else {
+					// 三角形带奇数三角形交换前两个顶点，保持绕序一致
+					hr = RasterizeTriangle(slot[1], slot[0], slot[2]);
+				}
+				if (hr) drawn++;
+			}
+
+			// 轮换槽位：只交换指针不复制顶点，避免拷贝 varying 列表
+			Vertex *vt = slot[2];
+			bool vv = valid[2];
+			if (topology == TOPOLOGY_TRIANGLE_FAN) {
+				// 三角扇保留中心点，新顶点成为下一个三角形的第二个顶点
+				slot[2] = slot[1]; slot[1] = vt;
+				valid[2] = valid[1]; valid[1] = vv;
+			}
+			else {
+				// 三角形带丢弃最老的顶点
+				slot[2] = slot[0]; slot[0] = slot[1]; slot[1] = vt;
+				valid[2] = valid[0]; valid[0] = valid[1]; valid[1] = vv;
+			}
+			nverts++;
+		}
+		return drawn;
+	}
+
+	// 按照三个顶点的插值系数计算当前像素的各项 varying
+	inline static void InterpolateVaryings(Vertex *vtx[3], float c0, float c1, float c2, ShaderContext& input) {
+		ShaderContext& i0 = vtx[0]->context;
+		ShaderContext& i1 = vtx[1]->context;
+		ShaderContext& i2 = vtx[2]->context;
+
+		// 插值各项 varying
+		for (auto const &it: i0.varying_float) {
+			int key = it.first;
+			float f0 = i0.varying_float[key];
+			float f1 = i1.varying_float[key];
+			float f2 = i2.varying_float[key];
+			input.varying_float[key] = c0 * f0 + c1 * f1 + c2 * f2;
+		}
+
+		for (auto const &it: i0.varying_vec2f) {
+			int key = it.first;
+			const Vec2f& f0 = i0.varying_vec2f[key];
+			const Vec2f& f1 = i1.varying_vec2f[key];
+			const Vec2f& f2 = i2.varying_vec2f[key];
+			input.varying_vec2f[key] = c0 * f0 + c1 * f1 + c2 * f2;
+		}
+
+		for (auto const &it: i0.varying_vec3f) {
+			int key = it.first;
+			const Vec3f& f0 = i0.varying_vec3f[key];
+			const Vec3f& f1 = i1.varying_vec3f[key];
+			const Vec3f& f2 = i2.varying_vec3f[key];
+			input.varying_vec3f[key] = c0 * f0 + c1 * f1 + c2 * f2;
+		}
+
+		for (auto const &it: i0.varying_vec4f) {
+			int key = it.first;
+			const Vec4f& f0 = i0.varying_vec4f[key];
+			const Vec4f& f1 = i1.varying_vec4f[key];
+			const Vec4f& f2 = i2.varying_vec4f[key];
+			input.varying_vec4f[key] = c0 * f0 + c1 * f1 + c2 * f2;
+		}
+	}
+
+	// 按照三个顶点的插值系数计算当前像素的 varying，执行像素着色器并写入，
+	// 开启 alpha 测试且像素被丢弃时返回 false
+	inline bool ShadePixel(Vertex *vtx[3], int cx, int cy, float c0, float c1, float c2, bool inner = true) {
+		// 准备为当前像素的各项 varying 进行插值
+		ShaderContext input;
+		InterpolateVaryings(vtx, c0, c1, c2, input);
+		input.x = cx;
+		input.y = cy;
+		input.inner = inner;
+
+		// 执行像素着色器
+		Vec4f color = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+		if (_pixel_shader != NULL) {
+			color = _pixel_shader(input);
+		}
+
+		// alpha 测试：PS 返回的 alpha 小于阈值时放弃绘制，此时调用者也不更新深度
+		if (_alpha_test && color.a < _alpha_ref) 
+			return false;
+
+		// 绘制到 framebuffer 上
+		_frame_buffer->SetPixel(cx, cy, color);
+		return true;
+	}
+
+	// 打包模式：插值 varying 后先放进像素包，凑满 PIXEL_PACKET 个再一起着色，
+	// 返回这次着色写入的像素数
+	inline int QueuePixel(Vertex *vtx[3], int cx, int cy, float depth, float c0, float c1, float c2, bool inner = true) {
+		int n = _packet_count;
+		ShaderContext& input = _packet_input[n];
+		input.varying_float.clear();
+		input.varying_vec2f.clear();
+		input.varying_vec3f.clear();
+		input.varying_vec4f.clear();
+		InterpolateVaryings(vtx, c0, c1, c2, input);
+		input.x = cx;
+		input.y = cy;
+		input.inner = inner;
+		_packet_x[n] = cx;
+		_packet_y[n] = cy;
+		_packet_depth[n] = depth;
+		return (++_packet_count == PIXEL_PACKET)? FlushPixels() : 0;
+	}
+
+	// 对像素包执行 PixelPacketShader 并写入结果，包内像素来自同一个三角形
+	// 的不同位置，所以先测试深度后着色不会有先后顺序问题。返回写入的像素数
+	inline int FlushPixels() {
+		int count = _packet_count;
+		if (count == 0) return 0;
+		_packet_count = 0;
+		Vec4f color[PIXEL_PACKET];
+		uint32_t pixel[PIXEL_PACKET];
+		_packet_shader(_packet_input, color, count);
+		KernelRegistry::Get().encode(pixel, color, count);
+		int drawn = 0;
+		for (int i = 0; i < count; i++) {
+			int cx = _packet_x[i], cy = _packet_y[i];
+			if (_alpha_test) {
+				if (color[i].a < _alpha_ref) continue;
+				_depth_buffer[cy][cx] = _packet_depth[i];
+			}
+			_frame_buffer->SetPixel(cx, cy, pixel[i]);
+			drawn++;
+		}
+		return drawn;
+	}
+
+	// 保守光栅化：把每个像素看成一个方格，三条边的 edge equation 在方格内的
+	// 最大值都不小于零时方格和三角形相交，最小值都不小于零时方格完全在三角形内。
+	// 使用浮点屏幕坐标，不做顶点取整，面积小于一个像素的三角形也不会丢失
+	inline bool RasterizeConservative(Vertex *v0, Vertex *v1, Vertex *v2) {
+		Vertex *vtx[3] = { v0, v1, v2 };
+		float area = vector_cross(v1->spf - v0->spf, v2->spf - v0->spf);
+		if (area == 0.0f) return false;
+		if (area < 0.0f) {
+			vtx[1] = v2;
+			vtx[2] = v1;
+			area = -area;
+		}
+		float inv_area = 1.0f / area;
+
+		// 外接矩形按照浮点坐标计算，包含所有和三角形有交集的像素方格
+		Vec2f pmin = vector_min(vector_min(v0->spf, v1->spf), v2->spf);
+		Vec2f pmax = vector_max(vector_max(v0->spf, v1->spf), v2->spf);
+		int x0 = Max(0, (int)floorf(pmin.x));
+		int y0 = Max(0, (int)floorf(pmin.y));
+		int x1 = Min(_fb_width - 1, Max((int)floorf(pmin.x), (int)ceilf(pmax.x) - 1));
+		int y1 = Min(_fb_height - 1, Max((int)floorf(pmin.y), (int)ceilf(pmax.y) - 1));
+
+		// 第 k 条边 edge equation 的系数：E(p) = A * x + B * y + C，
+		// 在三角形内为正，方格中心偏移半个像素时最多变化 (|A| + |B|) / 2
+		float A[3], B[3], C[3], R[3];
+		for (int k = 0; k < 3; k++) {
+			const Vec2f& a = vtx[(k + 1) % 3]->spf;
+			const Vec2f& b = vtx[(k + 2) % 3]->spf;
+			A[k] = a.y - b.y;
+			B[k] = b.x - a.x;
+			C[k] = a.x * b.y - a.y * b.x;
+			R[k] = (Abs(A[k]) + Abs(B[k])) * 0.5f;
+		}
+
+		// 深度（1/w 或者 z/w）在屏幕空间线性变化，INNER 模式下写入方格内最远
+		// （最小）的值，OUTER 模式下写入最近（最大）的值，但不超过三个顶点里最近的深度
+		float ddx = 0.0f, ddy = 0.0f;
+		for (int k = 0; k < 3; k++) {
+			ddx += vtx[k]->depth * A[k] * inv_area;
+			ddy += vtx[k]->depth * B[k] * inv_area;
+		}
+		float depth_range = (Abs(ddx) + Abs(ddy)) * 0.5f;
+		float depth_max = Max(vtx[0]->depth, Max(vtx[1]->depth, vtx[2]->depth));
+
+		for (int cy = y0; cy <= y1; cy++) {
+			for (int cx = x0; cx <= x1; cx++) {
+				float px = cx + 0.5f, py = cy + 0.5f;
+				float e[3];
+				bool outer = true, inner = true;
+				for (int k = 0; k < 3; k++) {
+					e[k] = A[k] * px + B[k] * py + C[k];
+					outer = outer && (e[k] + R[k] >= 0.0f);
+					inner = inner && (e[k] - R[k] >= 0.0f);
+				}
+				if (!outer) continue;
+				if (_conservative == CONSERVATIVE_INNER && !inner) continue;
+
+				// 像素中心在三角形外时插值点钳制到三角形边上，
+				// 深度和 varying 不会超出三角形顶点的范围
+				float a = Max(0.0f, e[0]), b = Max(0.0f, e[1]), c = Max(0.0f, e[2]);
+				float sum = a + b + c;
+				if (sum <= 0.0f) continue;
+				a /= sum; b /= sum; c /= sum;
+
+				float depth = vtx[0]->depth * a + vtx[1]->depth * b + vtx[2]->depth * c;
+				if (_conservative == CONSERVATIVE_INNER) depth -= depth_range;
+				else depth = Min(depth + depth_range, depth_max);
+				if (depth < _depth_buffer[cy][cx]) continue;
+				if (!_alpha_test) _depth_buffer[cy][cx] = depth;
+
+				// 透视矫正
+				float rhw = vtx[0]->rhw * a + vtx[1]->rhw * b + vtx[2]->rhw * c;
+				float w = 1.0f / ((rhw != 0.0f)? rhw : 1.0f);
+				float c0 = vtx[0]->rhw * a * w;
+				float c1 = vtx[1]->rhw * b * w;
+				float c2 = vtx[2]->rhw * c * w;
+
+				if (_packet_shader != NULL) 
+					QueuePixel(vtx, cx, cy, depth, c0, c1, c2, inner);
+				else if (ShadePixel(vtx, cx, cy, c0, c1, c2, inner) && _alpha_test) 
+					_depth_buffer[cy][cx] = depth;
+			}
+		}
+
+		FlushPixels();
+		return true;
+	}
+
+	// 光栅化一个已经完成顶点变换的三角形
+	inline bool RasterizeTriangle(Vertex *v0, Vertex *v1, Vertex *v2) {
+		Vertex *vertex[3] = { v0, v1, v2 };
+
+		// 计算外接矩形范围
+		for (int k = 0; k < 3; k++) {
+			const Vec2i& spi = vertex[k]->spi;
 			if (k == 0) {
-				_min_x = _max_x = Between(0, _fb_width - 1, vertex.spi.x);
-				_min_y = _max_y = Between(0, _fb_height - 1, vertex.spi.y);
+				_min_x = _max_x = Between(0, _fb_width - 1, spi.x);
+				_min_y = _max_y = Between(0, _fb_height - 1, spi.y);
 			}
 			else {
-				_min_x = Between(0, _fb_width - 1, Min(_min_x, vertex.spi.x));
-				_max_x = Between(0, _fb_width - 1, Max(_max_x, vertex.spi.x));
-				_min_y = Between(0, _fb_height - 1, Min(_min_y, vertex.spi.y));
-				_max_y = Between(0, _fb_height - 1, Max(_max_y, vertex.spi.y));
+				_min_x = Between(0, _fb_width - 1, Min(_min_x, spi.x));
+				_max_x = Between(0, _fb_width - 1, Max(_max_x, spi.x));
+				_min_y = Between(0, _fb_height - 1, Min(_min_y, spi.y));
+				_max_y = Between(0, _fb_height - 1, Max(_max_y, spi.y));
 			}
 		}
 
 		// 绘制线框
 		if (_render_frame) {
-			DrawLine(_vertex[0].spi.x, _vertex[0].spi.y, _vertex[1].spi.x, _vertex[1].spi.y);
-			DrawLine(_vertex[0].spi.x, _vertex[0].spi.y, _vertex[2].spi.x, _vertex[2].spi.y);
-			DrawLine(_vertex[2].spi.x, _vertex[2].spi.y, _vertex[1].spi.x, _vertex[1].spi.y);
+			DrawLine(v0->spi.x, v0->spi.y, v1->spi.x, v1->spi.y);
+			DrawLine(v0->spi.x, v0->spi.y, v2->spi.x, v2->spi.y);
+			DrawLine(v2->spi.x, v2->spi.y, v1->spi.x, v1->spi.y);
 		}
 
 		// 如果不填充像素就退出
 		if (_render_pixel == false) return false;
 
+		if (_conservative != CONSERVATIVE_NONE) 
+			return RasterizeConservative(v0, v1, v2);
+
 		// 判断三角形朝向
-		Vec4f v01 = _vertex[1].pos - _vertex[0].pos;
-		Vec4f v02 = _vertex[2].pos - _vertex[0].pos;
+		Vec4f v01 = v1->pos - v0->pos;
+		Vec4f v02 = v2->pos - v0->pos;
 		Vec4f normal = vector_cross(v01, v02);
 
-		// 使用 vtx 访问三个顶点，而不直接用 _vertex 访问，因为可能会调整顺序
-		Vertex *vtx[3] = { &_vertex[0], &_vertex[1], &_vertex[2] };
+		// 使用 vtx 访问三个顶点，而不直接用 vertex 访问，因为可能会调整顺序
+		Vertex *vtx[3] = { v0, v1, v2 };
 
 		// 如果背向视点，则交换顶点，保证 edge equation 判断的符号为正
 		if (normal.z > 0.0f) {
-			vtx[1] = &_vertex[2];
-			vtx[2] = &_vertex[1];
+			vtx[1] = v2;
+			vtx[2] = v1;
 		}
 		else if (normal.z == 0.0f) {
 			return false;
@@ -1326,142 +3820,155 @@ public:
 		float s = Abs(vector_cross(p1 - p0, p2 - p0));
 		if (s <= 0) return false;
 
+		// 三个顶点的 w 相同时（比如正交投影），透视矫正的系数就等于屏幕空间的
+		// 重心坐标，可以改用纯线性插值：有向子三角形面积乘以总面积的倒数，
+		// 每个像素不再需要任何除法
+		bool affine = IsConstantW(vtx[0]->rhw, vtx[1]->rhw, vtx[2]->rhw);
+		float area = vector_cross(vtx[1]->spf - vtx[0]->spf, vtx[2]->spf - vtx[0]->spf);
+		if (area == 0.0f) affine = false;
+		float inv_area = (area != 0.0f)? (1.0f / area) : 0.0f;
+
+		// 可选的 span 透视矫正：每隔 span 个像素精确计算一次插值系数，中间线性插值
+		int span = (affine || area == 0.0f)? 0 : PerspectiveSpanLength(vtx, inv_area);
+
 		// 三角形填充时，左面和上面的边上的点需要包括，右方和下方边上的点不包括
 		// 先判断是否是 TopLeft，判断出来后会和下方 Edge Equation 一起决策
 		bool TopLeft01 = IsTopLeft(p0, p1);
 		bool TopLeft12 = IsTopLeft(p1, p2);
 		bool TopLeft20 = IsTopLeft(p2, p0);
 
-		// 迭代三角形外接矩形的所有点
+		// 选择光栅化算法：扫描线算法直接求出每一行被覆盖的区间，省掉外接矩形
+		// 里一半以上的无效测试，但每行需要三次整数除法，小三角形用逐点测试更快
+		bool scanline = UseScanline(s * 0.5f);
+
+		// 迭代三角形外接矩形的所有行
 		for (int cy = _min_y; cy <= _max_y; cy++) {
-			for (int cx = _min_x; cx <= _max_x; cx++) {
+			int xl = _min_x, xr = _max_x;
+			if (scanline) {
+				// 和下面的 Edge Equation 判断完全一致，只是对每条边解出 x 的范围
+				EdgeSpan(p0, p1, cy, TopLeft01? 0 : 1, xl, xr);
+				EdgeSpan(p1, p2, cy, TopLeft12? 0 : 1, xl, xr);
+				EdgeSpan(p2, p0, cy, TopLeft20? 0 : 1, xl, xr);
+				if (xl > xr) continue;
+			}
+			int span_x = -1;            // 当前 span 的起点，-1 表示还没有开始
+			int span_n = 0;             // 当前 span 的长度
+			Vec3f span_c, span_d;       // span 起点的插值系数和每像素增量
+			for (int cx = xl; cx <= xr; cx++) {
 				Vec2f px = { (float)cx + 0.5f, (float)cy + 0.5f };
 
-				// Edge Equation
-				// 使用整数避免浮点误差，同时因为是左手系，所以符号取反
-				int E01 = -(cx - p0.x) * (p1.y - p0.y) + (cy - p0.y) * (p1.x - p0.x);
-				int E12 = -(cx - p1.x) * (p2.y - p1.y) + (cy - p1.y) * (p2.x - p1.x);
-				int E20 = -(cx - p2.x) * (p0.y - p2.y) + (cy - p2.y) * (p0.x - p2.x);
-
-
-				// 如果是左上边，用 E >= 0 判断合法，如果右下边就用 E > 0 判断合法
-				// 这里通过引入一个误差 1 ，来将 < 0 和 <= 0 用一个式子表达
-				if (E01 < (TopLeft01? 0 : 1)) continue;   // 在第一条边后面
-				if (E12 < (TopLeft12? 0 : 1)) continue;   // 在第二条边后面
-				if (E20 < (TopLeft20? 0 : 1)) continue;   // 在第三条边后面
+				// 扫描线算法得到的区间内所有点都已经被覆盖
+				if (!scanline) {
+					// Edge Equation
+					// 使用整数避免浮点误差，同时因为是左手系，所以符号取反
+					int E01 = -(cx - p0.x) * (p1.y - p0.y) + (cy - p0.y) * (p1.x - p0.x);
+					int E12 = -(cx - p1.x) * (p2.y - p1.y) + (cy - p1.y) * (p2.x - p1.x);
+					int E20 = -(cx - p2.x) * (p0.y - p2.y) + (cy - p2.y) * (p0.x - p2.x);
+
+					// 如果是左上边，用 E >= 0 判断合法，如果右下边就用 E > 0 判断合法
+					// 这里通过引入一个误差 1 ，来将 < 0 和 <= 0 用一个式子表达
+					if (E01 < (TopLeft01? 0 : 1)) continue;   // 在第一条边后面
+					if (E12 < (TopLeft12? 0 : 1)) continue;   // 在第二条边后面
+					if (E20 < (TopLeft20? 0 : 1)) continue;   // 在第三条边后面
+				}
 
 				// 三个端点到当前点的矢量
 				Vec2f s0 = vtx[0]->spf - px;
 				Vec2f s1 = vtx[1]->spf - px;
 				Vec2f s2 = vtx[2]->spf - px;
 
-				// 重心坐标系：计算内部子三角形面积 a / b / c
-				float a = Abs(vector_cross(s1, s2));    // 子三角形 Px-P1-P2 面积
-				float b = Abs(vector_cross(s2, s0));    // 子三角形 Px-P2-P0 面积
-				float c = Abs(vector_cross(s0, s1));    // 子三角形 Px-P0-P1 面积
-				float s = a + b + c;                    // 大三角形 P0-P1-P2 面积
+				float a, b, c;
 
-				if (s == 0.0f) continue;
-
-				// 除以总面积，以保证：a + b + c = 1，方便用作插值系数
-				a = a * (1.0f / s);
-				b = b * (1.0f / s);
-				c = c * (1.0f / s);
+				if (affine || span > 0) {
+					// 线性插值：有向面积之和恒等于总面积，直接乘以倒数即可
+					a = vector_cross(s1, s2) * inv_area;
+					b = vector_cross(s2, s0) * inv_area;
+					c = vector_cross(s0, s1) * inv_area;
+				}
+				else {
+					// 重心坐标系：计算内部子三角形面积 a / b / c
+					a = Abs(vector_cross(s1, s2));    // 子三角形 Px-P1-P2 面积
+					b = Abs(vector_cross(s2, s0));    // 子三角形 Px-P2-P0 面积
+					c = Abs(vector_cross(s0, s1));    // 子三角形 Px-P0-P1 面积
+					float s = a + b + c;              // 大三角形 P0-P1-P2 面积
+
+					if (s == 0.0f) continue;
+
+					// 除以总面积，以保证：a + b + c = 1，方便用作插值系数
+					a = a * (1.0f / s);
+					b = b * (1.0f / s);
+					c = c * (1.0f / s);
+				}
 
 				// 计算当前点的 1/w，因 1/w 和屏幕空间呈线性关系，故直接重心插值
 				float rhw = vtx[0]->rhw * a + vtx[1]->rhw * b + vtx[2]->rhw * c;
 
-				// 进行深度测试
-				if (rhw < _depth_buffer[cy][cx]) continue;
-				_depth_buffer[cy][cx] = rhw;   // 记录 1/w 到深度缓存
-
-				// 还原当前像素的 w
-				float w = 1.0f / ((rhw != 0.0f)? rhw : 1.0f);
-
-				// 计算三个顶点插值 varying 的系数
-				// 先除以各自顶点的 w 然后进行屏幕空间插值然后再乘以当前 w
-				float c0 = vtx[0]->rhw * a * w;
-				float c1 = vtx[1]->rhw * b * w;
-				float c2 = vtx[2]->rhw * c * w;
-
-				// 准备为当前像素的各项 varying 进行插值
-				ShaderContext input;
+				// 深度默认就是 1/w，正交投影时 1/w 恒为 1，改用同样线性变化的 z/w
+				float depth = (_depth_mode == DEPTH_Z)? 
+					(vtx[0]->depth * a + vtx[1]->depth * b + vtx[2]->depth * c) : rhw;
 
-				ShaderContext& i0 = vtx[0]->context;
-				ShaderContext& i1 = vtx[1]->context;
-				ShaderContext& i2 = vtx[2]->context;
-
-				// 插值各项 varying
-				for (auto const &it: i0.varying_float) {
-					int key = it.first;
-					float f0 = i0.varying_float[key];
-					float f1 = i1.varying_float[key];
-					float f2 = i2.varying_float[key];
-					input.varying_float[key] = c0 * f0 + c1 * f1 + c2 * f2;
-				}
-
-				for (auto const &it: i0.varying_vec2f) {
-					int key = it.first;
-					const Vec2f& f0 = i0.varying_vec2f[key];
-					const Vec2f& f1 = i1.varying_vec2f[key];
-					const Vec2f& f2 = i2.varying_vec2f[key];
-					input.varying_vec2f[key] = c0 * f0 + c1 * f1 + c2 * f2;
-				}
-
-				for (auto const &it: i0.varying_vec3f) {
-					int key = it.first;
-					const Vec3f& f0 = i0.varying_vec3f[key];
-					const Vec3f& f1 = i1.varying_vec3f[key];
-					const Vec3f& f2 = i2.varying_vec3f[key];
-					input.varying_vec3f[key] = c0 * f0 + c1 * f1 + c2 * f2;
-				}
-
-				for (auto const &it: i0.varying_vec4f) {
-					int key = it.first;
-					const Vec4f& f0 = i0.varying_vec4f[key];
-					const Vec4f& f1 = i1.varying_vec4f[key];
-					const Vec4f& f2 = i2.varying_vec4f[key];
-					input.varying_vec4f[key] = c0 * f0 + c1 * f1 + c2 * f2;
+				// 进行深度测试
+				if (depth < _depth_buffer[cy][cx]) continue;
+
+				// 记录深度，开启 alpha 测试时要等 PS 执行完再决定
+				if (!_alpha_test) _depth_buffer[cy][cx] = depth;
+
+				float c0 = a, c1 = b, c2 = c;
+
+				if (span > 0) {
+					// 进入新的 span 时精确计算两端的透视矫正系数
+					if (span_x < 0 || cx >= span_x + span_n) {
+						Vec3f cs(c0, c1, c2), ce;
+						PerspectiveWeights(vtx, inv_area, px.x, px.y, cs);
+						span_x = cx;
+						span_n = span;
+						// 终点外推到三角形外太远导致 1/w 非正时，该像素单独精确计算
+						if (!PerspectiveWeights(vtx, inv_area, px.x + span, px.y, ce)) 
+							ce = cs, span_n = 1;
+						span_c = cs;
+						span_d = (ce - cs) * (1.0f / span);
+					}
+					float t = (float)(cx - span_x);
+					c0 = span_c.x + span_d.x * t;
+					c1 = span_c.y + span_d.y * t;
+					c2 = span_c.z + span_d.z * t;
 				}
-
-				// 执行像素着色器
-				Vec4f color = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-				if (_pixel_shader != NULL) {
-					color = _pixel_shader(input);
+				else if (!affine) {
+					// 还原当前像素的 w
+					float w = 1.0f / ((rhw != 0.0f)? rhw : 1.0f);
+
+					// 计算三个顶点插值 varying 的系数
+					// 先除以各自顶点的 w 然后进行屏幕空间插值然后再乘以当前 w
+					c0 = vtx[0]->rhw * a * w;
+					c1 = vtx[1]->rhw * b * w;
+					c2 = vtx[2]->rhw * c * w;
 				}
 
-				// 绘制到 framebuffer 上，这里可以加判断，如果 PS 返回的颜色 alpha 分量
-				// 小于等于零则放弃绘制，不过这样的话要把前面的更新深度缓存的代码挪下来，
-				// 只有需要渲染的时候才更新深度。
-				_frame_buffer->SetPixel(cx, cy, color);
+				// 插值 varying 并运行像素着色器
+				if (_packet_shader != NULL) 
+					QueuePixel(vtx, cx, cy, depth, c0, c1, c2);
+				else if (ShadePixel(vtx, cx, cy, c0, c1, c2) && _alpha_test) 
+					_depth_buffer[cy][cx] = depth;
 			}
 		}
 
+		// 处理像素包里剩余的像素
+		FlushPixels();
+
 		// 绘制线框，再画一次避免覆盖
 		if (_render_frame) {
-			DrawLine(_vertex[0].spi.x, _vertex[0].spi.y, _vertex[1].spi.x, _vertex[1].spi.y);
-			DrawLine(_vertex[0].spi.x, _vertex[0].spi.y, _vertex[2].spi.x, _vertex[2].spi.y);
-			DrawLine(_vertex[2].spi.x, _vertex[2].spi.y, _vertex[1].spi.x, _vertex[1].spi.y);
+			DrawLine(v0->spi.x, v0->spi.y, v1->spi.x, v1->spi.y);
+			DrawLine(v0->spi.x, v0->spi.y, v2->spi.x, v2->spi.y);
+			DrawLine(v2->spi.x, v2->spi.y, v1->spi.x, v1->spi.y);
 		}
 
 		return true;
 	}
 
 protected:
-
-	// 顶点结构体
-	struct Vertex {
-		ShaderContext context;    // 上下文
-		float rhw;                // w 的倒数
-		Vec4f pos;                // 坐标
-		Vec2f spf;                // 浮点数屏幕坐标
-		Vec2i spi;                // 整数屏幕坐标
-	};
-
-protected:
-	Bitmap *_frame_buffer;    // 像素缓存
-	float **_depth_buffer;    // 深度缓存
+	std::shared_ptr<Bitmap> _frame_buffer;    // 像素缓存
+	std::vector<float*> _depth_buffer;        // 深度缓存的每一行
+	std::unique_ptr<float, MemoryDeleter> _depth_block;    // 深度缓存所有行所在的内存
 
 	int _fb_width;            // frame buffer 宽度
 	int _fb_height;           // frame buffer 高度
@@ -1478,8 +3985,393 @@ protected:
 	bool _render_frame;       // 是否绘制线框
 	bool _render_pixel;       // 是否填充像素
 
+	int _num_threads;         // 并行绘制使用的线程数
+	NumaStats _numa_stats;    // 并行绘制的条带在同节点/跨节点执行的统计
+	int _perspective_span;    // 透视矫正 span 长度，0 为逐像素矫正
+	RasterizerMode _rasterizer;    // 光栅化算法
+	ConservativeMode _conservative;    // 保守光栅化模式
+	DepthMode _depth_mode;    // 深度缓存保存的值
+	bool _alpha_test;         // 是否开启 alpha 测试
+	float _alpha_ref;         // alpha 测试阈值
+
 	VertexShader _vertex_shader;
 	PixelShader _pixel_shader;
+	PixelPacketShader _packet_shader;
+
+	// 等待着色的像素包
+	ShaderContext _packet_input[PIXEL_PACKET];
+	int _packet_x[PIXEL_PACKET];
+	int _packet_y[PIXEL_PACKET];
+	float _packet_depth[PIXEL_PACKET];
+	int _packet_count;
+
+	CaptureSink *_capture;    // 帧捕获，不捕获时为 NULL
+};
+
+static_assert(std::is_nothrow_move_constructible<RenderHelp>::value, "RenderHelp must be nothrow movable");
+
+
+//---------------------------------------------------------------------
+// 分块光源剔除 (Tiled Forward+)：把屏幕切成小块，每块只保留可能
+// 照亮该块内像素的点光源，PS 只需要遍历当前块的光源列表
+//---------------------------------------------------------------------
+
+// 点光源：世界坐标位置，影响半径，颜色
+struct PointLight {
+	Vec3f pos;
+	float radius;
+	Vec3f color;
+};
+
+
+class LightGrid
+{
+public:
+	inline LightGrid(int tile_size = 16): _tile(Max(1, tile_size)), _cols(0), _rows(0) {}
+
+	// 每帧在深度预绘制 (depth pre-pass) 之后调用：统计每个块的深度范围，
+	// 然后把光源包围球投影到屏幕上，和重叠并且深度范围相交的块建立关联。
+	// view/proj 为摄像机矩阵和 matrix_set_perspective 生成的透视矩阵
+	inline void Build(const std::vector<PointLight>& lights, const Mat4x4f& view, 
+			const Mat4x4f& proj, const RenderHelp& rh) {
+		int width = rh.GetWidth();
+		int height = rh.GetHeight();
+		_cols = (width + _tile - 1) / _tile;
+		_rows = (height + _tile - 1) / _tile;
+		_lists.assign(_cols * _rows, std::vector<int>());
+		_zmin.assign(_cols * _rows, 0.0f);
+		_zmax.assign(_cols * _rows, 0.0f);
+
+		// 统计每个块的深度范围：透视投影下 w 就是视空间的 z，DEPTH_RHW 模式
+		// 直接取倒数，DEPTH_Z 模式由 z/w = m22 + m32 / w 解出 w。块内有没绘制
+		// 过的点（深度为 0）时最远深度为无穷远
+		bool depth_z = (rh.GetDepthMode() == DEPTH_Z);
+		auto view_z = [&] (float depth) -> float {
+				if (depth <= 0.0f) return 1e30f;
+				if (!depth_z) return 1.0f / depth;
+				float d = (1.0f - depth) - proj.m[2][2];
+				return (d < 0.0f)? (proj.m[3][2] / d) : 1e30f;
+			};
+		for (int ty = 0; ty < _rows; ty++) {
+			for (int tx = 0; tx < _cols; tx++) {
+				float dmin = 1e30f, dmax = 0.0f;
+				for (int y = ty * _tile; y < Min(height, (ty + 1) * _tile); y++) {
+					for (int x = tx * _tile; x < Min(width, (tx + 1) * _tile); x++) {
+						float depth = rh.GetDepth(x, y);
+						dmin = Min(dmin, depth);
+						dmax = Max(dmax, depth);
+					}
+				}
+				int index = ty * _cols + tx;
+				_zmin[index] = view_z(dmax);
+				_zmax[index] = view_z(dmin);
+			}
+		}
+
+		float zn = -proj.m[3][2] / proj.m[2][2];   // 从透视矩阵还原近平面距离
+		for (int i = 0; i < (int)lights.size(); i++) {
+			const PointLight& light = lights[i];
+			Vec3f c = (light.pos.xyz1() * view).xyz();
+			float r = light.radius;
+			if (c.z + r < zn) continue;    // 整个包围球在近平面之前
+			int x0 = 0, y0 = 0, x1 = _cols - 1, y1 = _rows - 1;
+			if (c.z - r > zn) {
+				// 包围球在近平面之后：视空间包围盒四个角投影后的范围包含球的投影
+				float xmin = 1e30f, xmax = -1e30f, ymin = 1e30f, ymax = -1e30f;
+				for (int k = 0; k < 4; k++) {
+					float x = c.x + ((k & 1)? r : -r);
+					float z = c.z + ((k & 2)? r : -r);
+					float y = c.y + ((k & 1)? r : -r);
+					xmin = Min(xmin, x / z); xmax = Max(xmax, x / z);
+					ymin = Min(ymin, y / z); ymax = Max(ymax, y / z);
+				}
+				// 投影到屏幕像素坐标，屏幕 y 向下
+				float sx0 = (xmin * proj.m[0][0] + 1.0f) * width * 0.5f;
+				float sx1 = (xmax * proj.m[0][0] + 1.0f) * width * 0.5f;
+				float sy0 = (1.0f - ymax * proj.m[1][1]) * height * 0.5f;
+				float sy1 = (1.0f - ymin * proj.m[1][1]) * height * 0.5f;
+				if (sx1 < 0.0f || sy1 < 0.0f || sx0 >= width || sy0 >= height) continue;
+				x0 = Max(0, (int)sx0 / _tile);
+				y0 = Max(0, (int)sy0 / _tile);
+				x1 = Min(_cols - 1, (int)sx1 / _tile);
+				y1 = Min(_rows - 1, (int)sy1 / _tile);
+			}
+			for (int ty = y0; ty <= y1; ty++) {
+				for (int tx = x0; tx <= x1; tx++) {
+					int index = ty * _cols + tx;
+					// 包围球和块的深度范围不相交就跳过
+					if (c.z + r < _zmin[index] || c.z - r > _zmax[index]) continue;
+					_lists[index].push_back(i);
+				}
+			}
+		}
+	}
+
+	// 取得屏幕坐标 (x, y) 所在块的光源编号列表
+	inline const std::vector<int>& GetLights(int x, int y) const {
+		int tx = Between(0, _cols - 1, x / _tile);
+		int ty = Between(0, _rows - 1, y / _tile);
+		return _lists[ty * _cols + tx];
+	}
+
+	// 统计所有块的光源数之和，用于估算着色开销
+	inline size_t GetTotalCount() const {
+		size_t count = 0;
+		for (auto &list: _lists) count += list.size();
+		return count;
+	}
+
+	inline int GetTileSize() const { return _tile; }
+	inline int GetCols() const { return _cols; }
+	inline int GetRows() const { return _rows; }
+
+protected:
+	int _tile;
+	int _cols;
+	int _rows;
+	std::vector<std::vector<int>> _lists;    // 每个块的光源列表
+	std::vector<float> _zmin;                // 每个块的最近视空间深度
+	std::vector<float> _zmax;                // 每个块的最远视空间深度
+};
+
+
+//---------------------------------------------------------------------
+// 场景 BVH：两层结构，顶层管理实例的包围盒，底层为每个网格的 MeshBVH，
+// 用于视锥剔除，遮挡测试和拾取射线
+//---------------------------------------------------------------------
+class SceneBVH
+{
+public:
+	inline SceneBVH(): _dirty(false) {}
+
+	// 添加一个实例，多个实例可以共享同一个 MeshBVH，返回实例编号
+	inline int AddInstance(const MeshBVH *mesh, const Mat4x4f& transform) {
+		Instance inst;
+		inst.mesh = mesh;
+		_instances.push_back(inst);
+		SetTransform((int)_instances.size() - 1, transform);
+		_dirty = true;
+		return (int)_instances.size() - 1;
+	}
+
+	// 修改实例的模型变换，之后调用 Refit 或者 Build 更新顶层
+	inline void SetTransform(int id, const Mat4x4f& transform) {
+		Instance& inst = _instances[id];
+		inst.transform = transform;
+		inst.inverse = matrix_invert(transform);
+		// 网格包围盒的八个角变换到世界空间后重新求包围盒
+		Vec3f bmin, bmax;
+		if (!inst.mesh->GetBounds(bmin, bmax)) {
+			inst.bmin = inst.bmax = (Vec3f(0, 0, 0).xyz1() * transform).xyz();
+			return;
+		}
+		for (int k = 0; k < 8; k++) {
+			Vec3f p = { (k & 1)? bmax.x : bmin.x, (k & 2)? bmax.y : bmin.y, (k & 4)? bmax.z : bmin.z };
+			Vec3f w = (p.xyz1() * transform).xyz();
+			inst.bmin = (k == 0)? w : vector_min(inst.bmin, w);
+			inst.bmax = (k == 0)? w : vector_max(inst.bmax, w);
+		}
+	}
+
+	inline int GetInstanceCount() const { return (int)_instances.size(); }
+	inline const MeshBVH *GetMesh(int id) const { return _instances[id].mesh; }
+	inline const Mat4x4f& GetTransform(int id) const { return _instances[id].transform; }
+
+	inline void GetBounds(int id, Vec3f& bmin, Vec3f& bmax) const {
+		bmin = _instances[id].bmin;
+		bmax = _instances[id].bmax;
+	}
+
+	// 重新建立顶层 BVH，添加过实例以后必须调用
+	inline void Build() {
+		std::vector<Vec3f> bmin, bmax;
+		for (auto &inst: _instances) {
+			bmin.push_back(inst.bmin);
+			bmax.push_back(inst.bmax);
+		}
+		bvh_build(_nodes, _index, bmin, bmax, 2);
+		_dirty = false;
+	}
+
+	// 实例移动以后只更新节点包围盒，不改变树的结构，比 Build 快很多，
+	// 但物体移动距离很大时树的质量会下降，这时应该重新 Build
+	inline void Refit() {
+		if (_dirty) {
+			Build();
+			return;
+		}
+		// 子节点的编号总是大于父节点，倒序遍历即可自底向上更新
+		for (int i = (int)_nodes.size() - 1; i >= 0; i--) {
+			BVHNode& node = _nodes[i];
+			if (node.count > 0) {
+				for (int k = 0; k < node.count; k++) {
+					const Instance& inst = _instances[_index[node.start + k]];
+					node.bmin = (k == 0)? inst.bmin : vector_min(node.bmin, inst.bmin);
+					node.bmax = (k == 0)? inst.bmax : vector_max(node.bmax, inst.bmax);
+				}
+			}
+			else {
+				const BVHNode& a = _nodes[node.start];
+				const BVHNode& b = _nodes[node.start + 1];
+				node.bmin = vector_min(a.bmin, b.bmin);
+				node.bmax = vector_max(a.bmax, b.bmax);
+			}
+		}
+	}
+
+	// 视锥剔除：viewproj 为 view * proj 矩阵，visible 返回包围盒和视锥相交的
+	// 实例，按照包围盒中心的视空间深度从近到远排序，先绘制近处的实例作为
+	// 遮挡物，后面的实例可以用 IsOccluded 测试。返回可见的实例数量
+	inline int CullFrustum(const Mat4x4f& viewproj, std::vector<int>& visible) const {
+		visible.clear();
+		if (_nodes.empty()) return 0;
+		// 行向量右乘矩阵，裁剪空间坐标等于点和矩阵各列的点积，
+		// -w <= x <= w，-w <= y <= w，0 <= z <= w 对应六个平面
+		Vec4f col[4], planes[6];
+		for (int i = 0; i < 4; i++) 
+			col[i] = Vec4f(viewproj.m[0][i], viewproj.m[1][i], viewproj.m[2][i], viewproj.m[3][i]);
+		planes[0] = col[3] + col[0];
+		planes[1] = col[3] - col[0];
+		planes[2] = col[3] + col[1];
+		planes[3] = col[3] - col[1];
+		planes[4] = col[2];
+		planes[5] = col[3] - col[2];
+		std::vector<std::pair<float, int>> order;
+		// bvh_build 保证树深不超过 BVH_STACK_SIZE，Refit 不改变树的结构
+		int stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const BVHNode& node = _nodes[stack[--top]];
+			if (!BoxInFrustum(planes, node.bmin, node.bmax)) continue;
+			if (node.count == 0) {
+				stack[top++] = node.start;
+				stack[top++] = node.start + 1;
+				continue;
+			}
+			for (int k = 0; k < node.count; k++) {
+				int id = _index[node.start + k];
+				const Instance& inst = _instances[id];
+				if (node.count > 1 && !BoxInFrustum(planes, inst.bmin, inst.bmax)) continue;
+				Vec3f center = (inst.bmin + inst.bmax) * 0.5f;
+				order.push_back(std::make_pair(vector_dot(center.xyz1(), col[3]), id));
+			}
+		}
+		std::sort(order.begin(), order.end());
+		for (auto &it: order) visible.push_back(it.second);
+		return (int)visible.size();
+	}
+
+	// 遮挡测试：把实例的包围盒投影到屏幕，覆盖范围内深度缓存的每个点都比
+	// 包围盒最近的点更近时，实例被完全挡住。包围盒跨越近平面时总是返回 false。
+	// 包围盒的深度按照渲染器的 DepthMode 计算，和深度缓存里的值可以直接比较
+	inline bool IsOccluded(int id, const Mat4x4f& viewproj, const RenderHelp& rh) const {
+		const Instance& inst = _instances[id];
+		int width = rh.GetWidth(), height = rh.GetHeight();
+		bool depth_z = (rh.GetDepthMode() == DEPTH_Z);
+		float xmin = 1e30f, xmax = -1e30f, ymin = 1e30f, ymax = -1e30f, depth = 0.0f;
+		for (int k = 0; k < 8; k++) {
+			Vec3f p = { (k & 1)? inst.bmax.x : inst.bmin.x, (k & 2)? inst.bmax.y : inst.bmin.y, 
+				(k & 4)? inst.bmax.z : inst.bmin.z };
+			Vec4f c = p.xyz1() * viewproj;
+			if (c.w <= 0.0f || c.z < 0.0f) return false;
+			float sx = (c.x / c.w + 1.0f) * width * 0.5f;
+			float sy = (1.0f - c.y / c.w) * height * 0.5f;
+			xmin = Min(xmin, sx); xmax = Max(xmax, sx);
+			ymin = Min(ymin, sy); ymax = Max(ymax, sy);
+			depth = Max(depth, depth_z? (1.0f - c.z / c.w) : (1.0f / c.w));
+		}
+		int x0 = Max(0, (int)floorf(xmin)), x1 = Min(width - 1, (int)floorf(xmax));
+		int y0 = Max(0, (int)floorf(ymin)), y1 = Min(height - 1, (int)floorf(ymax));
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				// 深度缓存的两种模式都是越大越近
+				if (rh.GetDepth(x, y) < depth) return false;
+			}
+		}
+		return true;
+	}
+
+	// 拾取：求射线和所有实例的最近交点，hit 中的 t 为世界空间的射线参数，
+	// prim 和 (u, v) 为该实例网格里的三角形序号和重心坐标，instance 返回实例编号
+	inline bool Intersect(const Ray& ray, RayHit& hit, int& instance) const {
+		hit.t = ray.tmax;
+		hit.prim = -1;
+		instance = -1;
+		Traverse(ray, hit, instance, false);
+		return instance >= 0;
+	}
+
+	// 只判断射线在 tmax 范围内是否被任意实例挡住
+	inline bool Occluded(const Ray& ray) const {
+		RayHit hit = { ray.tmax, -1, 0.0f, 0.0f };
+		int instance = -1;
+		Traverse(ray, hit, instance, true);
+		return instance >= 0;
+	}
+
+protected:
+
+	struct Instance {
+		const MeshBVH *mesh;
+		Mat4x4f transform;
+		Mat4x4f inverse;
+		Vec3f bmin;          // 世界空间包围盒
+		Vec3f bmax;
+	};
+
+	// 包围盒是否在六个平面的内侧：只需要测试离平面最远的那个角
+	inline static bool BoxInFrustum(const Vec4f *planes, const Vec3f& bmin, const Vec3f& bmax) {
+		for (int i = 0; i < 6; i++) {
+			const Vec4f& p = planes[i];
+			float x = (p.x >= 0.0f)? bmax.x : bmin.x;
+			float y = (p.y >= 0.0f)? bmax.y : bmin.y;
+			float z = (p.z >= 0.0f)? bmax.z : bmin.z;
+			if (p.x * x + p.y * y + p.z * z + p.w < 0.0f) return false;
+		}
+		return true;
+	}
+
+	inline void Traverse(const Ray& ray, RayHit& hit, int& instance, bool any) const {
+		if (_nodes.empty()) return;
+		Vec3f inv_dir = Vec3f(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+		int stack[BVH_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const BVHNode& node = _nodes[stack[--top]];
+			if (bvh_ray_box(ray.origin, inv_dir, hit.t, node.bmin, node.bmax) < 0.0f) continue;
+			if (node.count == 0) {
+				stack[top++] = node.start;
+				stack[top++] = node.start + 1;
+				continue;
+			}
+			for (int k = 0; k < node.count; k++) {
+				int id = _index[node.start + k];
+				const Instance& inst = _instances[id];
+				// 射线变换到模型空间，方向不归一化，所以 t 和世界空间一致
+				Ray local;
+				local.origin = (ray.origin.xyz1() * inst.inverse).xyz();
+				local.dir = (Vec4f(ray.dir.x, ray.dir.y, ray.dir.z, 0.0f) * inst.inverse).xyz();
+				local.tmax = hit.t;
+				if (any) {
+					if (inst.mesh->Occluded(local)) { instance = id; return; }
+					continue;
+				}
+				RayHit h;
+				if (inst.mesh->Intersect(local, h)) {
+					hit = h;
+					instance = id;
+				}
+			}
+		}
+	}
+
+protected:
+	std::vector<Instance> _instances;
+	std::vector<BVHNode> _nodes;
+	std::vector<int> _index;
+	bool _dirty;              // 添加过实例，需要重新建立
 };
 
 
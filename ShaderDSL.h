@@ -0,0 +1,769 @@
+//=====================================================================
+//
+// ShaderDSL.h - 简单的着色语言，编译成寄存器字节码后按像素包解释执行
+//
+// Created by agent on 2026/10/19
+//
+// 语法示例：
+//
+//     // 注释
+//     l = normalize(light_dir);
+//     n = sample(normalmap, uv).rgb * 2 - 1;
+//     intense = saturate(dot(n, l)) + 0.2;
+//     return sample(diffuse, uv) * intense;
+//
+// - 语句只有两种：赋值 name = expr; 以及最后的 return expr;
+// - 数据类型为 1 到 4 维的 float 矢量，标量参与运算时自动扩展
+// - 支持 + - * / 和负号，分量选择 .xyzw / .rgba
+// - 内置函数：vec2 vec3 vec4 dot normalize length saturate clamp min max
+//   pow sqrt abs lerp mul(矢量乘以 4x4 矩阵) sample(纹理采样)
+// - varying / uniform / 纹理需要在编译前用 SetVarying / SetUniform /
+//   SetTexture 声明，uniform 和纹理在编译后还可以继续修改
+//
+// 每个寄存器保存 PIXEL_PACKET 个像素的四个分量，每条指令一次处理整个
+// 像素包，解释器取指令和分派的开销被分摊到 8 个像素上，指令内部是对
+// 连续内存的简单循环，编译器可以直接向量化
+//
+//=====================================================================
+#ifndef _SHADER_DSL_H_
+#define _SHADER_DSL_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <istream>
+#include <ostream>
+#include <functional>
+
+#include "RenderHelp.h"
+
+
+//---------------------------------------------------------------------
+// ShaderProgram
+//---------------------------------------------------------------------
+class ShaderProgram
+{
+public:
+	inline ShaderProgram() { _output = -1; _output_width = 0; }
+
+public:
+
+	// 声明 varying：width 为维度 1-4，key 为 ShaderContext 里对应列表的 key
+	inline void SetVarying(const char *name, int width, int key) {
+		Symbol& sym = _symbols[name];
+		sym.kind = SYMBOL_VARYING;
+		sym.width = Between(1, 4, width);
+		sym.key = key;
+	}
+
+	// 声明或者修改 uniform 矢量，width 为维度
+	inline void SetUniform(const char *name, const Vec4f& value, int width = 4) {
+		Symbol& sym = _symbols[name];
+		if (sym.kind != SYMBOL_UNIFORM) {
+			sym.kind = SYMBOL_UNIFORM;
+			sym.reg = -1;
+		}
+		sym.width = Between(1, 4, width);
+		sym.value[0] = value;
+		if (sym.reg >= 0) LoadConstant(sym.reg, value);
+	}
+
+	// 声明或者修改 uniform 标量
+	inline void SetUniform(const char *name, float value) {
+		SetUniform(name, Vec4f(value, value, value, value), 1);
+	}
+
+	// 声明或者修改 uniform 矩阵，只能用于 mul 函数
+	inline void SetUniform(const char *name, const Mat4x4f& m) {
+		Symbol& sym = _symbols[name];
+		if (sym.kind != SYMBOL_MATRIX) {
+			sym.kind = SYMBOL_MATRIX;
+			sym.reg = -1;
+		}
+		sym.width = 4;
+		for (int i = 0; i < 4; i++) {
+			sym.value[i] = m.Row(i);
+			if (sym.reg >= 0) LoadConstant(sym.reg + i, sym.value[i]);
+		}
+	}
+
+	// 声明或者修改纹理
+	inline void SetTexture(const char *name, const Bitmap *texture) {
+		Symbol& sym = _symbols[name];
+		if (sym.kind != SYMBOL_TEXTURE) {
+			sym.kind = SYMBOL_TEXTURE;
+			sym.key = (int)_textures.size();
+			_textures.push_back(texture);
+		}
+		_textures[sym.key] = texture;
+	}
+
+	// 编译源代码，失败返回 false，错误信息用 GetError 取得
+	inline bool Compile(const char *source) {
+		_code.clear();
+		_consts.clear();
+		_error.clear();
+		_output = -1;
+		_nregs = 0;
+		_source = source;
+		_pos = 0;
+		_line = 1;
+		_locals.clear();
+		for (auto &it: _symbols) {
+			Symbol& sym = it.second;
+			if (sym.kind == SYMBOL_UNIFORM) {
+				sym.reg = AllocReg();
+				_consts.push_back(std::make_pair(sym.reg, sym.value[0]));
+			}
+			else if (sym.kind == SYMBOL_MATRIX) {
+				sym.reg = AllocReg();
+				for (int i = 1; i < 4; i++) AllocReg();
+				for (int i = 0; i < 4; i++)
+					_consts.push_back(std::make_pair(sym.reg + i, sym.value[i]));
+			}
+		}
+		try {
+			ParseProgram();
+		}
+		catch (const std::runtime_error& e) {
+			_error = e.what();
+			_code.clear();
+			_output = -1;
+			return false;
+		}
+		_regs.assign(_nregs * 4 * PIXEL_PACKET, 0.0f);
+		for (auto &it: _consts) LoadConstant(it.first, it.second);
+		return true;
+	}
+
+	inline const std::string& GetError() const { return _error; }
+
+	// 字节码指令数和寄存器数
+	inline int GetInstructionCount() const { return (int)_code.size(); }
+	inline int GetRegisterCount() const { return _nregs; }
+
+	// 对最多 PIXEL_PACKET 个像素执行程序
+	inline void Execute(ShaderContext *inputs, Vec4f *outputs, int count) {
+		if (_output < 0) {
+			for (int i = 0; i < count; i++) outputs[i] = Vec4f(0, 0, 0, 0);
+			return;
+		}
+		for (const Instruction& ins: _code) {
+			Run(ins, inputs, count);
+		}
+		const float *r = Reg(_output);
+		for (int i = 0; i < count; i++) {
+			outputs[i].x = r[0 * PIXEL_PACKET + i];
+			outputs[i].y = r[1 * PIXEL_PACKET + i];
+			outputs[i].z = r[2 * PIXEL_PACKET + i];
+			outputs[i].w = (_output_width == 4)? r[3 * PIXEL_PACKET + i] : 1.0f;
+		}
+	}
+
+	// 取得可以直接设置给 RenderHelp::SetPixelPacketShader 的着色器
+	inline PixelPacketShader GetShader() {
+		return [this] (ShaderContext *inputs, Vec4f *outputs, int count) {
+				Execute(inputs, outputs, count);
+			};
+	}
+
+	// 取得逐像素调用的 PixelShader，每次只执行一个像素
+	inline PixelShader GetPixelShader() {
+		return [this] (ShaderContext& input) -> Vec4f {
+				Vec4f output;
+				Execute(&input, &output, 1);
+				return output;
+			};
+	}
+
+	// 保存源代码和声明的符号，用于帧捕获，纹理由 texture_id 转换成编号
+	inline void Save(std::ostream& out, const std::function<int(const Bitmap*)>& texture_id) const {
+		WriteString(out, _source);
+		int32_t count = (int32_t)_symbols.size();
+		out.write((const char*)&count, sizeof(count));
+		for (auto &it: _symbols) {
+			const Symbol& sym = it.second;
+			int32_t head[3] = { (int32_t)sym.kind, sym.width, sym.key };
+			if (sym.kind == SYMBOL_TEXTURE) head[2] = texture_id(_textures[sym.key]);
+			WriteString(out, it.first);
+			out.write((const char*)head, sizeof(head));
+			out.write((const char*)sym.value, sizeof(sym.value));
+		}
+	}
+
+	// 读取 Save 保存的程序并重新编译，texture 把编号转换回纹理
+	inline bool Load(std::istream& in, const std::function<const Bitmap*(int)>& texture) {
+		std::string source = ReadString(in);
+		int32_t count = 0;
+		in.read((char*)&count, sizeof(count));
+		for (int i = 0; in && i < count; i++) {
+			std::string name = ReadString(in);
+			int32_t head[3];
+			Vec4f value[4];
+			in.read((char*)head, sizeof(head));
+			in.read((char*)value, sizeof(value));
+			if (!in) break;
+			if (head[0] == SYMBOL_VARYING) {
+				SetVarying(name.c_str(), head[1], head[2]);
+			}
+			else if (head[0] == SYMBOL_UNIFORM) {
+				SetUniform(name.c_str(), value[0], head[1]);
+			}
+			else if (head[0] == SYMBOL_MATRIX) {
+				Mat4x4f m;
+				for (int k = 0; k < 4; k++) m.SetRow(k, value[k]);
+				SetUniform(name.c_str(), m);
+			}
+			else if (head[0] == SYMBOL_TEXTURE) {
+				SetTexture(name.c_str(), texture(head[2]));
+			}
+		}
+		if (!in) {
+			_error = "bad program data";
+			return false;
+		}
+		return Compile(source.c_str());
+	}
+
+protected:
+
+	// 字节码
+	enum OpCode {
+		OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_NEG, OP_MIN, OP_MAX, OP_POW,
+		OP_SQRT, OP_ABS, OP_SATURATE, OP_CLAMP, OP_LERP, OP_DOT,
+		OP_NORMALIZE, OP_LENGTH, OP_SWIZZLE, OP_INSERT, OP_MULMAT,
+		OP_SAMPLE, OP_VARYING,
+	};
+
+	// 寄存器指令：dst = op(a, b, c)，imm 为分量选择/纹理编号等立即数
+	struct Instruction {
+		uint8_t op;
+		uint8_t width;
+		uint16_t dst, a, b, c;
+		int32_t imm;
+	};
+
+	enum SymbolKind { SYMBOL_NONE, SYMBOL_VARYING, SYMBOL_UNIFORM, SYMBOL_MATRIX, SYMBOL_TEXTURE };
+
+	// 外部声明的符号
+	struct Symbol {
+		Symbol(): kind(SYMBOL_NONE), width(0), key(0), reg(-1) {}
+		SymbolKind kind;
+		int width;
+		int key;            // varying 的 key，或者纹理编号
+		int reg;            // uniform 所在寄存器
+		Vec4f value[4];     // uniform 的值
+	};
+
+	// 表达式的值：所在寄存器和维度，标量的四个分量值相同
+	struct Value {
+		int reg;
+		int width;
+	};
+
+protected:
+
+	inline float *Reg(int index) { return &_regs[index * 4 * PIXEL_PACKET]; }
+
+	inline static void WriteString(std::ostream& out, const std::string& text) {
+		int32_t size = (int32_t)text.size();
+		out.write((const char*)&size, sizeof(size));
+		out.write(text.data(), size);
+	}
+
+	inline static std::string ReadString(std::istream& in) {
+		int32_t size = 0;
+		in.read((char*)&size, sizeof(size));
+		if (!in || size < 0 || size > (1 << 24)) {
+			in.setstate(std::ios::failbit);
+			return std::string();
+		}
+		std::string text(size, '\0');
+		if (size > 0) in.read(&text[0], size);
+		return text;
+	}
+
+	// 把常量写到寄存器的所有像素里
+	inline void LoadConstant(int reg, const Vec4f& value) {
+		if ((int)_regs.size() < (reg + 1) * 4 * PIXEL_PACKET) return;
+		float *r = Reg(reg);
+		for (int k = 0; k < 4; k++) {
+			for (int i = 0; i < PIXEL_PACKET; i++) r[k * PIXEL_PACKET + i] = value[k];
+		}
+	}
+
+	// 执行一条指令，每个分支都是对 4 x PIXEL_PACKET 个连续浮点数的循环
+	inline void Run(const Instruction& ins, ShaderContext *inputs, int count) {
+		const int N = 4 * PIXEL_PACKET;
+		const int P = PIXEL_PACKET;
+		float *D = Reg(ins.dst);
+		const float *A = Reg(ins.a);
+		const float *B = Reg(ins.b);
+		const float *C = Reg(ins.c);
+		switch (ins.op) {
+		case OP_ADD: for (int i = 0; i < N; i++) D[i] = A[i] + B[i]; break;
+		case OP_SUB: for (int i = 0; i < N; i++) D[i] = A[i] - B[i]; break;
+		case OP_MUL: for (int i = 0; i < N; i++) D[i] = A[i] * B[i]; break;
+		case OP_DIV: for (int i = 0; i < N; i++) D[i] = A[i] / B[i]; break;
+		case OP_NEG: for (int i = 0; i < N; i++) D[i] = -A[i]; break;
+		case OP_MIN: for (int i = 0; i < N; i++) D[i] = Min(A[i], B[i]); break;
+		case OP_MAX: for (int i = 0; i < N; i++) D[i] = Max(A[i], B[i]); break;
+		case OP_POW: for (int i = 0; i < N; i++) D[i] = powf(A[i], B[i]); break;
+		case OP_SQRT: for (int i = 0; i < N; i++) D[i] = sqrtf(A[i]); break;
+		case OP_ABS: for (int i = 0; i < N; i++) D[i] = fabsf(A[i]); break;
+		case OP_SATURATE: for (int i = 0; i < N; i++) D[i] = Between(0.0f, 1.0f, A[i]); break;
+		case OP_CLAMP: for (int i = 0; i < N; i++) D[i] = Between(B[i], C[i], A[i]); break;
+		case OP_LERP: for (int i = 0; i < N; i++) D[i] = A[i] + (B[i] - A[i]) * C[i]; break;
+		case OP_DOT:
+		case OP_LENGTH:
+		case OP_NORMALIZE: {
+				float sum[PIXEL_PACKET];
+				const float *S = (ins.op == OP_DOT)? B : A;
+				for (int i = 0; i < P; i++) sum[i] = 0.0f;
+				for (int k = 0; k < ins.width; k++) {
+					for (int i = 0; i < P; i++) sum[i] += A[k * P + i] * S[k * P + i];
+				}
+				if (ins.op == OP_DOT) {
+					for (int k = 0; k < 4; k++)
+						for (int i = 0; i < P; i++) D[k * P + i] = sum[i];
+				}
+				else if (ins.op == OP_LENGTH) {
+					for (int i = 0; i < P; i++) sum[i] = sqrtf(sum[i]);
+					for (int k = 0; k < 4; k++)
+						for (int i = 0; i < P; i++) D[k * P + i] = sum[i];
+				}
+				else {
+					for (int i = 0; i < P; i++) sum[i] = 1.0f / sqrtf(sum[i]);
+					for (int k = 0; k < 4; k++)
+						for (int i = 0; i < P; i++) D[k * P + i] = A[k * P + i] * sum[i];
+				}
+			}
+			break;
+		case OP_SWIZZLE:
+			// imm 每两位选择一个源分量
+			for (int k = 0; k < 4; k++) {
+				int sk = (ins.imm >> (k * 2)) & 3;
+				for (int i = 0; i < P; i++) D[k * P + i] = A[sk * P + i];
+			}
+			break;
+		case OP_INSERT: {
+				// imm 低两位为源分量，高两位为目标分量
+				int sk = ins.imm & 3, dk = (ins.imm >> 2) & 3;
+				for (int i = 0; i < P; i++) D[dk * P + i] = A[sk * P + i];
+			}
+			break;
+		case OP_MULMAT:
+			// 行矢量乘以矩阵，B 开始的四个寄存器为矩阵的四行
+			for (int c = 0; c < 4; c++) {
+				for (int i = 0; i < P; i++) {
+					float sum = 0.0f;
+					for (int r = 0; r < 4; r++)
+						sum += A[r * P + i] * B[r * N + c * P + i];
+					D[c * P + i] = sum;
+				}
+			}
+			break;
+		case OP_SAMPLE: {
+				const Bitmap *texture = _textures[ins.imm];
+				for (int i = 0; i < count; i++) {
+					Vec4f cc = (texture)? texture->Sample2D(A[i], A[P + i]) : Vec4f();
+					for (int k = 0; k < 4; k++) D[k * P + i] = cc[k];
+				}
+			}
+			break;
+		case OP_VARYING:
+			for (int i = 0; i < count; i++) {
+				Vec4f v = FetchVarying(inputs[i], ins.width, ins.imm);
+				for (int k = 0; k < 4; k++) D[k * P + i] = v[k];
+			}
+			break;
+		}
+	}
+
+	// 从 ShaderContext 里取出 varying，标量扩展到四个分量
+	inline static Vec4f FetchVarying(const ShaderContext& input, int width, int key) {
+		Vec4f v;
+		if (width == 1) {
+			auto it = input.varying_float.find(key);
+			if (it != input.varying_float.end()) v = Vec4f(it->second, it->second, it->second, it->second);
+		}
+		else if (width == 2) {
+			auto it = input.varying_vec2f.find(key);
+			if (it != input.varying_vec2f.end()) v = Vec4f(it->second.x, it->second.y, 0, 0);
+		}
+		else if (width == 3) {
+			auto it = input.varying_vec3f.find(key);
+			if (it != input.varying_vec3f.end()) v = it->second.xyz1();
+		}
+		else {
+			auto it = input.varying_vec4f.find(key);
+			if (it != input.varying_vec4f.end()) v = it->second;
+		}
+		return v;
+	}
+
+protected:
+
+	// 编译：词法分析
+	enum TokenType { TOKEN_END, TOKEN_NUMBER, TOKEN_NAME, TOKEN_CHAR };
+
+	struct Token {
+		TokenType type;
+		std::string text;
+		float number;
+	};
+
+	inline void Error(const std::string& msg) {
+		std::stringstream ss;
+		ss << "line " << _line << ": " << msg;
+		throw std::runtime_error(ss.str());
+	}
+
+	inline void SkipSpace() {
+		while (_pos < _source.size()) {
+			char ch = _source[_pos];
+			if (ch == '\n') { _line++; _pos++; }
+			else if (ch == ' ' || ch == '\t' || ch == '\r') _pos++;
+			else if (ch == '/' && _pos + 1 < _source.size() && _source[_pos + 1] == '/') {
+				while (_pos < _source.size() && _source[_pos] != '\n') _pos++;
+			}
+			else break;
+		}
+	}
+
+	inline Token Peek() {
+		size_t pos = _pos;
+		int line = _line;
+		Token token = Next();
+		_pos = pos;
+		_line = line;
+		return token;
+	}
+
+	inline Token Next() {
+		Token token;
+		token.number = 0.0f;
+		SkipSpace();
+		if (_pos >= _source.size()) { token.type = TOKEN_END; return token; }
+		char ch = _source[_pos];
+		if (isdigit((unsigned char)ch) || (ch == '.' && _pos + 1 < _source.size() &&
+					isdigit((unsigned char)_source[_pos + 1]))) {
+			const char *start = _source.c_str() + _pos;
+			char *end = NULL;
+			token.type = TOKEN_NUMBER;
+			token.number = strtof(start, &end);
+			token.text.assign(start, end - start);
+			_pos += end - start;
+		}
+		else if (isalpha((unsigned char)ch) || ch == '_') {
+			size_t start = _pos;
+			while (_pos < _source.size() && (isalnum((unsigned char)_source[_pos]) || _source[_pos] == '_'))
+				_pos++;
+			token.type = TOKEN_NAME;
+			token.text = _source.substr(start, _pos - start);
+		}
+		else {
+			token.type = TOKEN_CHAR;
+			token.text = std::string(1, ch);
+			_pos++;
+		}
+		return token;
+	}
+
+	inline void Expect(const char *text) {
+		Token token = Next();
+		if (token.text != text) Error(std::string("expect '") + text + "' but got '" + token.text + "'");
+	}
+
+	inline bool Accept(const char *text) {
+		Token token = Peek();
+		if (token.type == TOKEN_CHAR && token.text == text) { Next(); return true; }
+		return false;
+	}
+
+protected:
+
+	// 编译：代码生成
+	inline int AllocReg() {
+		if (_nregs >= 65535) Error("too many registers");
+		return _nregs++;
+	}
+
+	inline Value Emit(int op, int width, int a, int b = 0, int c = 0, int imm = 0) {
+		Instruction ins;
+		ins.op = (uint8_t)op;
+		ins.width = (uint8_t)width;
+		ins.dst = (uint16_t)AllocReg();
+		ins.a = (uint16_t)a;
+		ins.b = (uint16_t)b;
+		ins.c = (uint16_t)c;
+		ins.imm = imm;
+		_code.push_back(ins);
+		Value v = { ins.dst, width };
+		return v;
+	}
+
+	inline Value Constant(float x) {
+		Value v = { AllocReg(), 1 };
+		_consts.push_back(std::make_pair(v.reg, Vec4f(x, x, x, x)));
+		return v;
+	}
+
+	// 逐分量运算的结果维度：标量可以和任意矢量运算
+	inline int ResultWidth(const Value& a, const Value& b) {
+		if (a.width == 1) return b.width;
+		if (b.width == 1 || a.width == b.width) return a.width;
+		Error("vector width mismatch");
+		return 0;
+	}
+
+	inline Value Binary(int op, const Value& a, const Value& b) {
+		return Emit(op, ResultWidth(a, b), a.reg, b.reg);
+	}
+
+	// 分量选择：.x .xy .rgb 等，单个分量时扩展到全部四个分量
+	inline Value Swizzle(const Value& a, const std::string& sel) {
+		if (sel.size() < 1 || sel.size() > 4) Error("bad swizzle: " + sel);
+		int imm = 0, last = 0;
+		for (int k = 0; k < 4; k++) {
+			if (k < (int)sel.size()) {
+				const char *p = strchr("xyzw", sel[k]);
+				const char *q = strchr("rgba", sel[k]);
+				if (p) last = (int)(p - "xyzw");
+				else if (q) last = (int)(q - "rgba");
+				else Error("bad swizzle: " + sel);
+				if (last >= a.width && a.width > 1) Error("swizzle out of range: " + sel);
+				if (a.width == 1) last = 0;
+			}
+			imm |= last << (k * 2);
+		}
+		return Emit(OP_SWIZZLE, (int)sel.size(), a.reg, 0, 0, imm);
+	}
+
+	// 矢量构造函数：vec2 / vec3 / vec4，参数依次填入分量
+	inline Value Construct(int width, const std::vector<Value>& args) {
+		int total = 0;
+		for (auto &v: args) total += v.width;
+		Value out = { AllocReg(), width };
+		if (args.size() == 1 && args[0].width == 1) {
+			for (int k = 0; k < 4; k++) EmitInsert(out.reg, args[0].reg, 0, k);
+			return out;
+		}
+		if (total != width) Error("wrong number of components in constructor");
+		int dk = 0;
+		for (auto &v: args) {
+			for (int sk = 0; sk < v.width; sk++) EmitInsert(out.reg, v.reg, sk, dk++);
+		}
+		// 剩余分量清零，避免残留数据
+		Value zero = Constant(0.0f);
+		for (; dk < 4; dk++) EmitInsert(out.reg, zero.reg, 0, dk);
+		return out;
+	}
+
+	inline void EmitInsert(int dst, int src, int sk, int dk) {
+		Instruction ins;
+		ins.op = OP_INSERT;
+		ins.width = 4;
+		ins.dst = (uint16_t)dst;
+		ins.a = (uint16_t)src;
+		ins.b = ins.c = 0;
+		ins.imm = sk | (dk << 2);
+		_code.push_back(ins);
+	}
+
+	// 函数调用
+	inline Value Call(const std::string& name) {
+		// sample 和 mul 的第一个参数是名字
+		if (name == "sample") {
+			Token tex = Next();
+			auto it = _symbols.find(tex.text);
+			if (it == _symbols.end() || it->second.kind != SYMBOL_TEXTURE)
+				Error("unknown texture: " + tex.text);
+			Expect(",");
+			Value uv = ParseExpr();
+			Expect(")");
+			if (uv.width != 2) Error("sample() needs vec2 texture coordinates");
+			return Emit(OP_SAMPLE, 4, uv.reg, 0, 0, it->second.key);
+		}
+		std::vector<Value> args;
+		if (!Accept(")")) {
+			do {
+				if (name == "mul" && args.size() == 1) {
+					Token mat = Next();
+					auto it = _symbols.find(mat.text);
+					if (it == _symbols.end() || it->second.kind != SYMBOL_MATRIX)
+						Error("unknown matrix: " + mat.text);
+					Value m = { it->second.reg, 16 };
+					args.push_back(m);
+				}
+				else {
+					args.push_back(ParseExpr());
+				}
+			}	while (Accept(","));
+			Expect(")");
+		}
+		int n = (int)args.size();
+		auto check = [&] (int count) {
+				if (n != count) Error("wrong number of arguments to " + name);
+			};
+		if (name == "vec2") return Construct(2, args);
+		if (name == "vec3") return Construct(3, args);
+		if (name == "vec4") return Construct(4, args);
+		if (name == "dot") {
+			check(2);
+			Value v = Emit(OP_DOT, ResultWidth(args[0], args[1]), args[0].reg, args[1].reg);
+			v.width = 1;
+			return v;
+		}
+		if (name == "normalize") { check(1); return Emit(OP_NORMALIZE, args[0].width, args[0].reg); }
+		if (name == "length") {
+			check(1);
+			Value v = Emit(OP_LENGTH, args[0].width, args[0].reg);
+			v.width = 1;
+			return v;
+		}
+		if (name == "saturate") { check(1); return Emit(OP_SATURATE, args[0].width, args[0].reg); }
+		if (name == "sqrt") { check(1); return Emit(OP_SQRT, args[0].width, args[0].reg); }
+		if (name == "abs") { check(1); return Emit(OP_ABS, args[0].width, args[0].reg); }
+		if (name == "min") { check(2); return Binary(OP_MIN, args[0], args[1]); }
+		if (name == "max") { check(2); return Binary(OP_MAX, args[0], args[1]); }
+		if (name == "pow") { check(2); return Binary(OP_POW, args[0], args[1]); }
+		if (name == "clamp") {
+			check(3);
+			ResultWidth(args[0], args[1]);
+			ResultWidth(args[0], args[2]);
+			return Emit(OP_CLAMP, args[0].width, args[0].reg, args[1].reg, args[2].reg);
+		}
+		if (name == "lerp") {
+			check(3);
+			int width = ResultWidth(args[0], args[1]);
+			ResultWidth(args[0], args[2]);
+			return Emit(OP_LERP, width, args[0].reg, args[1].reg, args[2].reg);
+		}
+		if (name == "mul") {
+			check(2);
+			if (args[0].width != 4) Error("mul() needs a vec4");
+			return Emit(OP_MULMAT, 4, args[0].reg, args[1].reg);
+		}
+		Error("unknown function: " + name);
+		return Value();
+	}
+
+	// primary := number | name | name '(' args ')' | '(' expr ')'
+	inline Value ParsePrimary() {
+		Token token = Next();
+		if (token.type == TOKEN_NUMBER) {
+			return Constant(token.number);
+		}
+		if (token.type == TOKEN_NAME) {
+			if (Accept("(")) return Call(token.text);
+			auto local = _locals.find(token.text);
+			if (local != _locals.end()) return local->second;
+			auto it = _symbols.find(token.text);
+			if (it == _symbols.end()) Error("unknown name: " + token.text);
+			Symbol& sym = it->second;
+			if (sym.kind == SYMBOL_UNIFORM) {
+				Value v = { sym.reg, sym.width };
+				return v;
+			}
+			if (sym.kind == SYMBOL_VARYING) {
+				// 同一个 varying 只读取一次
+				Value v = Emit(OP_VARYING, sym.width, 0, 0, 0, sym.key);
+				_locals[token.text] = v;
+				return v;
+			}
+			Error("can not use '" + token.text + "' as value");
+		}
+		if (token.text == "(") {
+			Value v = ParseExpr();
+			Expect(")");
+			return v;
+		}
+		Error("unexpected '" + token.text + "'");
+		return Value();
+	}
+
+	// postfix := primary ('.' swizzle)*
+	inline Value ParsePostfix() {
+		Value v = ParsePrimary();
+		while (Accept(".")) {
+			Token sel = Next();
+			if (sel.type != TOKEN_NAME) Error("bad swizzle");
+			v = Swizzle(v, sel.text);
+		}
+		return v;
+	}
+
+	// unary := '-' unary | postfix
+	inline Value ParseUnary() {
+		if (Accept("-")) {
+			Value v = ParseUnary();
+			return Emit(OP_NEG, v.width, v.reg);
+		}
+		return ParsePostfix();
+	}
+
+	// term := unary (('*' | '/') unary)*
+	inline Value ParseTerm() {
+		Value v = ParseUnary();
+		while (true) {
+			if (Accept("*")) v = Binary(OP_MUL, v, ParseUnary());
+			else if (Accept("/")) v = Binary(OP_DIV, v, ParseUnary());
+			else break;
+		}
+		return v;
+	}
+
+	// expr := term (('+' | '-') term)*
+	inline Value ParseExpr() {
+		Value v = ParseTerm();
+		while (true) {
+			if (Accept("+")) v = Binary(OP_ADD, v, ParseTerm());
+			else if (Accept("-")) v = Binary(OP_SUB, v, ParseTerm());
+			else break;
+		}
+		return v;
+	}
+
+	// program := (name '=' expr ';')* 'return' expr ';'
+	inline void ParseProgram() {
+		while (true) {
+			Token token = Next();
+			if (token.type == TOKEN_END) Error("missing return");
+			if (token.type != TOKEN_NAME) Error("unexpected '" + token.text + "'");
+			if (token.text == "return") {
+				Value v = ParseExpr();
+				Accept(";");
+				if (v.width < 3) Error("return value must be vec3 or vec4");
+				_output = v.reg;
+				_output_width = v.width;
+				if (Next().type != TOKEN_END) Error("code after return");
+				return;
+			}
+			Expect("=");
+			Value v = ParseExpr();
+			Expect(";");
+			_locals[token.text] = v;
+		}
+	}
+
+protected:
+	std::map<std::string, Symbol> _symbols;      // 外部声明的符号
+	std::map<std::string, Value> _locals;        // 局部变量
+	std::vector<const Bitmap*> _textures;        // 纹理列表
+	std::vector<Instruction> _code;              // 字节码
+	std::vector<std::pair<int, Vec4f>> _consts;  // 常量寄存器及其值
+	std::vector<float> _regs;                    // 寄存器堆
+	std::string _error;
+	std::string _source;
+	size_t _pos;
+	int _line;
+	int _nregs;
+	int _output;
+	int _output_width;
+};
+
+
+#endif
+
+
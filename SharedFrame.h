@@ -0,0 +1,380 @@
+//=====================================================================
+//
+// SharedFrame.h - 通过共享内存把帧缓存交给本机的其他进程显示
+//
+// Created by agent on 2026/10/19
+//
+// - SharedFrameBuffer 在渲染进程里用 shm_open 创建一块共享内存，包括
+//   一个头部和 2 或 3 个帧缓冲区，每画完一帧调用 Present 写入空闲的
+//   缓冲区，然后发布为最新一帧，帧序号加一并唤醒等待的查看器
+// - SharedFrameViewer 在查看器进程里映射同一块内存，WaitFrame 等待新
+//   的帧 (Linux 下用 futex，其他平台轮询)，Acquire 直接返回最新一帧
+//   在共享内存里的地址，不复制像素，Release 以后渲染进程才能覆盖它
+// - 渲染进程不会写入最新一帧和查看器正在读取的缓冲区，所以读到的画面
+//   不会撕裂；三缓冲时渲染进程永远不需要等待，双缓冲时如果查看器还
+//   拿着旧的一帧，新的一帧会被丢弃
+// - 只支持一个查看器，没有 POSIX 共享内存的平台上 Create/Open 返回 false
+//
+//=====================================================================
+#ifndef _SHARED_FRAME_H_
+#define _SHARED_FRAME_H_
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "RenderHelp.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SHARED_FRAME_POSIX 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+
+//---------------------------------------------------------------------
+// 共享内存布局：4KB 的头部，后面是按页对齐的各个缓冲区
+//---------------------------------------------------------------------
+const int SHARED_FRAME_MAX_BUFFERS = 3;
+const uint32_t SHARED_FRAME_VERSION = 1;
+const size_t SHARED_FRAME_PAGE = 4096;
+
+// 头部里的原子变量需要在两个进程之间使用，必须是无锁的
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "lock-free atomics required");
+static_assert(std::atomic<int32_t>::is_always_lock_free, "lock-free atomics required");
+
+struct SharedFrameHeader {
+	char magic[4];                       // "RHFB"
+	uint32_t version;
+	int32_t width;
+	int32_t height;
+	int32_t pitch;                       // 每行字节数，像素格式为 BGRA32
+	int32_t buffers;                     // 缓冲区数量，2 或 3
+	uint64_t offset[SHARED_FRAME_MAX_BUFFERS];    // 每个缓冲区相对于映射起点的偏移
+	std::atomic<uint32_t> sequence;      // 已经发布的帧数，也是 futex 等待的地址
+	std::atomic<int32_t> latest;         // 最新一帧所在的缓冲区，-1 表示还没有
+	std::atomic<int32_t> reading;        // 查看器正在读取的缓冲区，-1 表示没有
+	std::atomic<int32_t> closed;         // 渲染进程已经关闭
+	std::atomic<uint32_t> frame[SHARED_FRAME_MAX_BUFFERS];    // 每个缓冲区里的帧序号
+};
+
+static_assert(sizeof(SharedFrameHeader) <= SHARED_FRAME_PAGE, "header too large");
+
+
+// 等待和唤醒：Linux 下直接在共享内存的地址上使用 futex (不加 PRIVATE
+// 标志，可以跨进程)，其他平台每毫秒检查一次
+inline static void shared_frame_wait(std::atomic<uint32_t> *addr, uint32_t value, int timeout) {
+#if defined(__linux__)
+	struct timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000L;
+	syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, value, &ts, NULL, 0);
+#else
+	(void)value;
+	(void)timeout;
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+}
+
+inline static void shared_frame_wake(std::atomic<uint32_t> *addr) {
+#if defined(__linux__)
+	syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)addr;
+#endif
+}
+
+// shm_open 要求名字以 / 开头
+inline static std::string shared_frame_name(const char *name) {
+	std::string text = name;
+	if (text.empty() || text[0] != '/') text = "/" + text;
+	return text;
+}
+
+
+//---------------------------------------------------------------------
+// 渲染进程：创建共享内存并发布每一帧
+//---------------------------------------------------------------------
+class SharedFrameBuffer
+{
+public:
+	inline SharedFrameBuffer(): _base(NULL), _size(0), _back(-1), _dropped(0) {}
+	inline virtual ~SharedFrameBuffer() { Close(); }
+
+	// 创建 width x height 的共享帧缓存，buffers 为 2 或 3，同名的旧内存会被替换
+	inline bool Create(const char *name, int width, int height, int buffers = 3) {
+		Close();
+	#ifdef SHARED_FRAME_POSIX
+		if (width <= 0 || height <= 0 || buffers < 2 || buffers > SHARED_FRAME_MAX_BUFFERS) return false;
+		int pitch = width * 4;
+		size_t frame_size = ((size_t)pitch * height + SHARED_FRAME_PAGE - 1) & ~(SHARED_FRAME_PAGE - 1);
+		size_t size = SHARED_FRAME_PAGE + frame_size * buffers;
+		std::string path = shared_frame_name(name);
+		int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) return false;
+		if (ftruncate(fd, (off_t)size) != 0) {
+			close(fd);
+			shm_unlink(path.c_str());
+			return false;
+		}
+		void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED) {
+			shm_unlink(path.c_str());
+			return false;
+		}
+		_base = (uint8_t*)base;
+		_size = size;
+		_name = path;
+		// 新建的共享内存全部为 0，原子变量直接赋值即可；magic 最后写入，
+		// 查看器看到 magic 时其他字段都已经就绪
+		SharedFrameHeader *header = GetHeader();
+		header->version = SHARED_FRAME_VERSION;
+		header->width = width;
+		header->height = height;
+		header->pitch = pitch;
+		header->buffers = buffers;
+		for (int i = 0; i < buffers; i++) {
+			header->offset[i] = SHARED_FRAME_PAGE + frame_size * i;
+			header->frame[i] = 0;
+		}
+		header->sequence = 0;
+		header->latest = -1;
+		header->reading = -1;
+		header->closed = 0;
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(header->magic, "RHFB", 4);
+		return true;
+	#else
+		(void)name; (void)width; (void)height; (void)buffers;
+		return false;
+	#endif
+	}
+
+	// 通知查看器并删除共享内存，已经映射的查看器仍然可以读到最后一帧
+	inline void Close() {
+	#ifdef SHARED_FRAME_POSIX
+		if (_base == NULL) return;
+		SharedFrameHeader *header = GetHeader();
+		header->closed = 1;
+		header->sequence++;
+		shared_frame_wake(&header->sequence);
+		munmap(_base, _size);
+		shm_unlink(_name.c_str());
+	#endif
+		_base = NULL;
+		_size = 0;
+		_back = -1;
+		_name.clear();
+	}
+
+	inline bool IsOpen() const { return _base != NULL; }
+	inline int GetWidth() const { return _base? GetHeader()->width : 0; }
+	inline int GetHeight() const { return _base? GetHeader()->height : 0; }
+	inline int GetPitch() const { return _base? GetHeader()->pitch : 0; }
+
+	// 已经发布的帧数，以及因为没有空闲缓冲区被丢弃的帧数
+	inline uint32_t GetSequence() const { return _base? GetHeader()->sequence.load() : 0; }
+	inline int64_t GetDropped() const { return _dropped; }
+
+	// 开始写一帧：返回一个空闲缓冲区的地址，每行 GetPitch() 字节。既不是
+	// 最新一帧，也不是查看器正在读取的缓冲区；没有空闲缓冲区时返回 NULL
+	inline uint8_t *BeginFrame() {
+		if (_base == NULL) return NULL;
+		SharedFrameHeader *header = GetHeader();
+		int latest = header->latest.load();
+		int reading = header->reading.load();
+		_back = -1;
+		for (int i = 0; i < header->buffers; i++) {
+			if (i != latest && i != reading) {
+				_back = i;
+				break;
+			}
+		}
+		if (_back < 0) {
+			_dropped++;
+			return NULL;
+		}
+		return _base + header->offset[_back];
+	}
+
+	// 发布 BeginFrame 返回的缓冲区为最新一帧，并唤醒查看器
+	inline void EndFrame() {
+		if (_base == NULL || _back < 0) return;
+		SharedFrameHeader *header = GetHeader();
+		uint32_t sequence = header->sequence.load() + 1;
+		header->frame[_back] = sequence;
+		header->latest = _back;
+		header->sequence = sequence;
+		shared_frame_wake(&header->sequence);
+		_back = -1;
+	}
+
+	// 把一帧画面复制到共享内存并发布，尺寸必须和 Create 时相同，
+	// 丢弃或者失败时返回 false
+	inline bool Present(const Bitmap& frame) {
+		if (_base == NULL || frame.GetW() != GetWidth() || frame.GetH() != GetHeight()) return false;
+		uint8_t *bits = BeginFrame();
+		if (bits == NULL) return false;
+		frame.Export(bits, GetPitch(), PIXEL_BGRA32);
+		EndFrame();
+		return true;
+	}
+
+	inline bool Present(const RenderHelp& rh) {
+		SharedBitmap frame = rh.GetFrame();
+		return frame.Get() && Present(*frame);
+	}
+
+protected:
+	inline SharedFrameHeader *GetHeader() const { return (SharedFrameHeader*)_base; }
+
+	SharedFrameBuffer(const SharedFrameBuffer&) = delete;
+	SharedFrameBuffer& operator=(const SharedFrameBuffer&) = delete;
+
+protected:
+	uint8_t *_base;
+	size_t _size;
+	std::string _name;
+	int _back;               // BeginFrame 选中的缓冲区
+	int64_t _dropped;
+};
+
+
+//---------------------------------------------------------------------
+// 查看器进程：映射共享内存，等待并读取最新一帧
+//---------------------------------------------------------------------
+class SharedFrameViewer
+{
+public:
+	inline SharedFrameViewer(): _base(NULL), _size(0), _holding(-1) {}
+	inline virtual ~SharedFrameViewer() { Close(); }
+
+	// 映射渲染进程创建的共享内存，不存在或者格式不对时返回 false
+	inline bool Open(const char *name) {
+		Close();
+	#ifdef SHARED_FRAME_POSIX
+		std::string path = shared_frame_name(name);
+		int fd = shm_open(path.c_str(), O_RDWR, 0);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHARED_FRAME_PAGE) {
+			close(fd);
+			return false;
+		}
+		void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED) return false;
+		_base = (uint8_t*)base;
+		_size = (size_t)st.st_size;
+		const SharedFrameHeader *header = GetHeader();
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (memcmp(header->magic, "RHFB", 4) != 0 || header->version != SHARED_FRAME_VERSION ||
+			header->buffers < 2 || header->buffers > SHARED_FRAME_MAX_BUFFERS ||
+			header->offset[header->buffers - 1] + (size_t)header->pitch * header->height > _size) {
+			Close();
+			return false;
+		}
+		return true;
+	#else
+		(void)name;
+		return false;
+	#endif
+	}
+
+	inline void Close() {
+		Release();
+	#ifdef SHARED_FRAME_POSIX
+		if (_base) munmap(_base, _size);
+	#endif
+		_base = NULL;
+		_size = 0;
+	}
+
+	inline bool IsOpen() const { return _base != NULL; }
+	inline int GetWidth() const { return _base? GetHeader()->width : 0; }
+	inline int GetHeight() const { return _base? GetHeader()->height : 0; }
+	inline int GetPitch() const { return _base? GetHeader()->pitch : 0; }
+	inline uint32_t GetSequence() const { return _base? GetHeader()->sequence.load() : 0; }
+
+	// 渲染进程已经关闭，之后不会再有新的帧
+	inline bool IsClosed() const { return _base == NULL || GetHeader()->closed.load() != 0; }
+
+	// 等待帧序号不再等于 last，超时 timeout 毫秒，返回当前的帧序号
+	inline uint32_t WaitFrame(uint32_t last, int timeout = 1000) {
+		if (_base == NULL) return last;
+		SharedFrameHeader *header = GetHeader();
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+		while (header->sequence.load() == last && !IsClosed()) {
+			auto now = std::chrono::steady_clock::now();
+			if (now >= deadline) break;
+			int remain = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+			shared_frame_wait(&header->sequence, last, Max(1, remain));
+		}
+		return header->sequence.load();
+	}
+
+	// 锁定最新一帧，返回它在共享内存里的地址，每行 GetPitch() 字节，调用
+	// Release 之前渲染进程不会覆盖它。sequence 返回这一帧的序号，还没有
+	// 任何帧时返回 NULL
+	inline const uint8_t *Acquire(uint32_t *sequence = NULL) {
+		if (_base == NULL) return NULL;
+		Release();
+		SharedFrameHeader *header = GetHeader();
+		while (true) {
+			int latest = header->latest.load();
+			if (latest < 0) return NULL;
+			header->reading = latest;
+			// 标记以后最新一帧没有变化，渲染进程之后一定能看到这个标记；
+			// 变化了说明标记之前它可能已经开始覆盖这个缓冲区，重新来过
+			if (header->latest.load() == latest) {
+				_holding = latest;
+				if (sequence) *sequence = header->frame[latest].load();
+				return _base + header->offset[latest];
+			}
+		}
+	}
+
+	inline void Release() {
+		if (_base == NULL || _holding < 0) return;
+		GetHeader()->reading = -1;
+		_holding = -1;
+	}
+
+	// 把最新一帧复制到 dst，尺寸不同时重新创建，没有帧时返回 false
+	inline bool Read(Bitmap& dst, uint32_t *sequence = NULL) {
+		const uint8_t *bits = Acquire(sequence);
+		if (bits == NULL) return false;
+		if (dst.GetW() != GetWidth() || dst.GetH() != GetHeight())
+			dst = Bitmap(GetWidth(), GetHeight(), false);
+		dst.Import(bits, GetPitch(), PIXEL_BGRA32);
+		Release();
+		return true;
+	}
+
+protected:
+	inline SharedFrameHeader *GetHeader() const { return (SharedFrameHeader*)_base; }
+
+	SharedFrameViewer(const SharedFrameViewer&) = delete;
+	SharedFrameViewer& operator=(const SharedFrameViewer&) = delete;
+
+protected:
+	uint8_t *_base;
+	size_t _size;
+	int _holding;            // Acquire 锁定的缓冲区，-1 表示没有
+};
+
+
+#endif
+
+
@@ -0,0 +1,453 @@
+//=====================================================================
+//
+// VirtualTexture.h - 稀疏虚拟纹理 (Sparse Virtual Texture)
+//
+// Created by agent on 2026/10/19
+//
+// - 纹理预先切成 tile x tile 的页，连同整个 mip 链保存在磁盘文件里，
+//   可以远大于内存 (比如 32k x 32k 的地形贴图)
+// - 运行时只有固定数量的物理页驻留在内存里，页表记录每个虚拟页
+//   所在的物理页，按最近最少使用 (LRU) 的顺序淘汰
+// - 绘制时缺失的页被记录下来，帧结束后交给后台线程读取，下一帧
+//   开始时放入缓存；在此之前用更低一级的 mip 代替，最低一级常驻内存
+//
+//=====================================================================
+#ifndef _VIRTUAL_TEXTURE_H_
+#define _VIRTUAL_TEXTURE_H_
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+#include "RenderHelp.h"
+
+
+//---------------------------------------------------------------------
+// 文件读写：偏移超过 2GB，需要 64 位的 seek
+//---------------------------------------------------------------------
+inline static bool vt_seek(FILE *fp, int64_t offset) {
+#if defined(_WIN32) || defined(WIN32)
+	return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+
+//---------------------------------------------------------------------
+// 虚拟纹理
+//---------------------------------------------------------------------
+class VirtualTexture
+{
+public:
+	inline VirtualTexture(): _width(0), _height(0), _tile(0), _levels(0), _pages(0),
+		_slots(0), _frame(1), _fp(NULL), _quit(false), _inflight(0),
+		_fallback(0), _last_fallback(0), _loaded(0), _max_requests(64) {}
+
+	inline virtual ~VirtualTexture() { Close(); }
+
+	// 生成虚拟纹理文件：texel(x, y) 返回第 0 级上的像素颜色，会被多个线程
+	// 同时调用。按 tile 大小切页后逐行写入，再依次生成每一级 mip，整个过程
+	// 只需要三行页的内存
+	inline static bool Build(const char *filename, int width, int height,
+			const std::function<uint32_t(int x, int y)>& texel,
+			int tile = 128, int threads = ParallelDefaultThreads()) {
+		if (width <= 0 || height <= 0 || tile <= 0) return false;
+		FILE *fp = fopen(filename, "w+b");
+		if (fp == NULL) return false;
+		std::vector<Level> levels;
+		SetupLevels(width, height, tile, levels);
+		int32_t head[6] = { VT_MAGIC, VT_VERSION, width, height, tile, (int32_t)levels.size() };
+		bool ok = fwrite(head, sizeof(head), 1, fp) == 1;
+		size_t page_size = (size_t)tile * tile;
+		std::vector<uint32_t> strip, src[2];
+		for (int l = 0; ok && l < (int)levels.size(); l++) {
+			const Level& level = levels[l];
+			strip.resize(page_size * level.tiles_x);
+			for (int ty = 0; ok && ty < level.tiles_y; ty++) {
+				if (l > 0) {
+					// 读取上一级对应的两行页
+					const Level& up = levels[l - 1];
+					for (int k = 0; ok && k < 2; k++) {
+						int row = Min(ty * 2 + k, up.tiles_y - 1);
+						src[k].resize(page_size * up.tiles_x);
+						ok = vt_seek(fp, up.offset + (int64_t)row * up.tiles_x * page_size * 4) &&
+							fread(&src[k][0], page_size * 4, up.tiles_x, fp) == (size_t)up.tiles_x;
+					}
+					if (!ok) break;
+				}
+				ParallelFor(tile, threads, [&] (int j) {
+						int y = Min(ty * tile + j, level.height - 1);
+						for (int x = 0; x < level.tiles_x * tile; x++) {
+							uint32_t *dst = &strip[(x / tile) * page_size + j * tile + x % tile];
+							int cx = Min(x, level.width - 1);
+							if (l == 0) {
+								*dst = texel(cx, y);
+								continue;
+							}
+							// 2x2 盒式滤波
+							const Level& up = levels[l - 1];
+							uint32_t c[4];
+							for (int k = 0; k < 4; k++) {
+								int sx = Min(cx * 2 + (k & 1), up.width - 1);
+								int sy = Min(y * 2 + (k >> 1), up.height - 1);
+								const std::vector<uint32_t>& row = src[(sy / tile) - ty * 2];
+								c[k] = row[(sx / tile) * page_size + (sy % tile) * tile + sx % tile];
+							}
+							uint32_t result = 0;
+							for (int shift = 0; shift < 32; shift += 8) {
+								uint32_t sum = 2;
+								for (int k = 0; k < 4; k++) sum += (c[k] >> shift) & 0xff;
+								result |= (sum >> 2) << shift;
+							}
+							*dst = result;
+						}
+					});
+				ok = vt_seek(fp, level.offset + (int64_t)ty * level.tiles_x * page_size * 4) &&
+					fwrite(&strip[0], page_size * 4, level.tiles_x, fp) == (size_t)level.tiles_x;
+			}
+		}
+		if (fclose(fp) != 0) ok = false;
+		if (!ok) remove(filename);
+		return ok;
+	}
+
+	// 打开虚拟纹理文件，最多 cache_pages 个物理页驻留在内存里，
+	// 最低一级 mip 同步读取并常驻，其他页由后台线程按需读取
+	inline bool Open(const char *filename, int cache_pages = 256) {
+		Close();
+		_fp = fopen(filename, "rb");
+		if (_fp == NULL) return false;
+		int32_t head[6];
+		if (fread(head, sizeof(head), 1, _fp) != 1 || head[0] != VT_MAGIC ||
+				head[1] != VT_VERSION || head[2] <= 0 || head[3] <= 0 || head[4] <= 0) {
+			fclose(_fp);
+			_fp = NULL;
+			return false;
+		}
+		_width = head[2];
+		_height = head[3];
+		_tile = head[4];
+		SetupLevels(_width, _height, _tile, _level);
+		_levels = (int)_level.size();
+		_pages = _level.back().base + 1;
+		_slots = Max(2, cache_pages);
+		_table.assign(_pages, -1);
+		_requested.reset(new std::atomic<uint8_t>[_pages]);
+		for (int i = 0; i < _pages; i++) _requested[i] = 0;
+		_cache.assign((size_t)_slots * _tile * _tile, 0);
+		_slot_page.assign(_slots, -1);
+		_slot_frame.reset(new std::atomic<uint32_t>[_slots]);
+		for (int i = 0; i < _slots; i++) _slot_frame[i] = 0;
+		// 物理页 0 固定存放最低一级 mip
+		int top = _pages - 1;
+		if (!ReadPage(top, &_cache[0])) {
+			Close();
+			return false;
+		}
+		_table[top] = 0;
+		_slot_page[0] = top;
+		_frame = 1;
+		_quit = false;
+		_loader = std::thread([this] () { LoaderThread(); });
+		return true;
+	}
+
+	inline void Close() {
+		if (_loader.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				_quit = true;
+			}
+			_cond.notify_all();
+			_loader.join();
+		}
+		if (_fp) fclose(_fp);
+		_fp = NULL;
+		_queue.clear();
+		_completed.clear();
+		_requests.clear();
+		_inflight = 0;
+		_levels = 0;
+	}
+
+public:
+
+	inline int GetWidth() const { return _width; }
+	inline int GetHeight() const { return _height; }
+	inline int GetTileSize() const { return _tile; }
+	inline int GetLevels() const { return _levels; }
+	inline int GetPageCount() const { return _pages; }
+	inline int GetCachePages() const { return _slots; }
+
+	// 物理页占用的内存字节数，不随纹理尺寸变化
+	inline size_t GetCacheBytes() const { return _cache.size() * sizeof(uint32_t); }
+
+	// 当前驻留的页数
+	inline int GetResidentCount() const {
+		int count = 0;
+		for (int page: _slot_page) count += (page >= 0)? 1 : 0;
+		return count;
+	}
+
+	// 上一帧因为页缺失而使用低一级 mip 的采样次数
+	inline int64_t GetFallbackCount() const { return _last_fallback; }
+
+	// 累计从磁盘读入的页数
+	inline int64_t GetLoadedCount() const { return _loaded; }
+
+	// 每帧最多提交给后台线程的页数，先提交粗糙的层级
+	inline void SetMaxRequests(int count) { _max_requests = Max(1, count); }
+
+	// 每帧绘制之前调用：把后台线程读好的页放入物理页，更新页表。
+	// 页表只在这里修改，绘制过程中多个线程可以同时采样
+	inline void BeginFrame() {
+		if (_levels == 0) return;
+		_frame++;
+		std::vector<LoadedPage> done;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			done.swap(_completed);
+		}
+		size_t page_size = (size_t)_tile * _tile;
+		for (LoadedPage& item: done) {
+			int slot = FindVictim();
+			// 所有物理页上一帧都用到了，再淘汰只会来回换页，放弃这一页
+			if (slot >= 0) {
+				if (_slot_page[slot] >= 0) _table[_slot_page[slot]] = -1;
+				std::copy(item.texels.begin(), item.texels.end(), _cache.begin() + slot * page_size);
+				_slot_page[slot] = item.page;
+				_slot_frame[slot] = _frame;
+				_table[item.page] = slot;
+			}
+			_requested[item.page] = 0;
+		}
+	}
+
+	// 每帧绘制之后调用：把这一帧缺失的页按照从粗到细的顺序提交给后台
+	// 线程，超过上限的部分清除请求标记，下一帧用到时重新请求
+	inline void EndFrame() {
+		if (_levels == 0) return;
+		_last_fallback = _fallback.exchange(0);
+		std::vector<int> requests;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			requests.swap(_requests);
+		}
+		// 页号越大层级越粗糙
+		std::sort(requests.begin(), requests.end(), std::greater<int>());
+		int count = Min((int)requests.size(), _max_requests);
+		for (int i = count; i < (int)requests.size(); i++) _requested[requests[i]] = 0;
+		if (count == 0) return;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_queue.insert(_queue.end(), requests.begin(), requests.begin() + count);
+		}
+		_cond.notify_one();
+	}
+
+	// 等待后台线程读完所有已经提交的页，用于测试和离线渲染
+	inline void WaitIdle() {
+		std::unique_lock<std::mutex> lock(_lock);
+		_idle.wait(lock, [this] () { return _queue.empty() && _inflight == 0; });
+	}
+
+	// 根据每个屏幕像素覆盖的第 0 级纹素数量计算 lod
+	inline static float ComputeLod(float texels_per_pixel) {
+		return (texels_per_pixel <= 1.0f)? 0.0f : log2f(texels_per_pixel);
+	}
+
+	// 按照 lod 选择最接近的一级做双线性采样，uv 超出 [0, 1] 时截断。
+	// 需要的页不在内存里时记录请求，并依次使用更粗糙的一级
+	inline uint32_t SampleBilinear(float u, float v, float lod) {
+		if (_levels == 0) return 0;
+		int level = Between(0, _levels - 1, (int)(lod + 0.5f));
+		u = Between(0.0f, 1.0f, u);
+		v = Between(0.0f, 1.0f, v);
+		uint32_t color = 0;
+		if (SampleLevel(u, v, level, color)) return color;
+		_fallback++;
+		for (level++; level < _levels; level++) {
+			if (SampleLevel(u, v, level, color)) break;
+		}
+		return color;
+	}
+
+	inline Vec4f Sample2D(const Vec2f& uv, float lod) {
+		return vector_from_color(SampleBilinear(uv.x, uv.y, lod));
+	}
+
+protected:
+
+	// 每一级 mip 的尺寸，页数，在文件里的偏移，以及第一页的全局页号
+	struct Level {
+		int width;
+		int height;
+		int tiles_x;
+		int tiles_y;
+		int base;
+		int64_t offset;
+	};
+
+	struct LoadedPage {
+		int page;
+		std::vector<uint32_t> texels;
+	};
+
+	enum { VT_MAGIC = 0x58455456, VT_VERSION = 1 };    // "VTEX"
+
+	// 计算 mip 链，直到一页能放下整级为止，返回文件总长度
+	inline static int64_t SetupLevels(int width, int height, int tile, std::vector<Level>& levels) {
+		levels.clear();
+		int64_t offset = sizeof(int32_t) * 6;
+		int base = 0;
+		for (int l = 0; ; l++) {
+			Level level;
+			level.width = Max(1, width >> l);
+			level.height = Max(1, height >> l);
+			level.tiles_x = (level.width + tile - 1) / tile;
+			level.tiles_y = (level.height + tile - 1) / tile;
+			level.base = base;
+			level.offset = offset;
+			levels.push_back(level);
+			base += level.tiles_x * level.tiles_y;
+			offset += (int64_t)level.tiles_x * level.tiles_y * tile * tile * 4;
+			if (level.tiles_x == 1 && level.tiles_y == 1) break;
+		}
+		return offset;
+	}
+
+	// 取得一个纹素，所在的页不在内存里时提交请求并返回 NULL
+	inline const uint32_t *Fetch(const Level& level, int x, int y) {
+		int page = level.base + (y / _tile) * level.tiles_x + x / _tile;
+		int slot = _table[page];
+		if (slot < 0) {
+			if (_requested[page].exchange(1) == 0) {
+				std::lock_guard<std::mutex> lock(_lock);
+				_requests.push_back(page);
+			}
+			return NULL;
+		}
+		if (_slot_frame[slot].load(std::memory_order_relaxed) != _frame)
+			_slot_frame[slot].store(_frame, std::memory_order_relaxed);
+		return &_cache[((size_t)slot * _tile + y % _tile) * _tile + x % _tile];
+	}
+
+	// 在某一级上双线性采样，用到的四个纹素都在内存里时返回 true
+	inline bool SampleLevel(float u, float v, int index, uint32_t& color) {
+		const Level& level = _level[index];
+		int32_t fx = (int32_t)((u * level.width - 0.5f) * 256.0f);
+		int32_t fy = (int32_t)((v * level.height - 0.5f) * 256.0f);
+		fx = Max(fx, 0);
+		fy = Max(fy, 0);
+		int x1 = Min(fx >> 8, level.width - 1);
+		int y1 = Min(fy >> 8, level.height - 1);
+		int x2 = Min(x1 + 1, level.width - 1);
+		int y2 = Min(y1 + 1, level.height - 1);
+		const uint32_t *c00 = Fetch(level, x1, y1);
+		const uint32_t *c01 = Fetch(level, x2, y1);
+		const uint32_t *c10 = Fetch(level, x1, y2);
+		const uint32_t *c11 = Fetch(level, x2, y2);
+		if (!c00 || !c01 || !c10 || !c11) return false;
+		color = Bitmap::BilinearInterp(*c00, *c01, *c10, *c11, fx & 0xff, fy & 0xff);
+		return true;
+	}
+
+	// 找一个可以替换的物理页：优先空闲的，否则选最久没有用到的，
+	// 上一帧还在用的页不淘汰，返回 -1
+	inline int FindVictim() const {
+		int victim = -1;
+		uint32_t oldest = _frame - 1;
+		for (int i = 1; i < _slots; i++) {
+			if (_slot_page[i] < 0) return i;
+			uint32_t frame = _slot_frame[i];
+			if (frame < oldest) {
+				oldest = frame;
+				victim = i;
+			}
+		}
+		return victim;
+	}
+
+	// 从文件读取一页，只在 Open 和后台线程里调用
+	inline bool ReadPage(int page, uint32_t *texels) {
+		int index = 0;
+		while (index + 1 < _levels && _level[index + 1].base <= page) index++;
+		const Level& level = _level[index];
+		size_t page_size = (size_t)_tile * _tile;
+		int64_t offset = level.offset + (int64_t)(page - level.base) * page_size * 4;
+		return vt_seek(_fp, offset) && fread(texels, page_size * 4, 1, _fp) == 1;
+	}
+
+	inline void LoaderThread() {
+		while (true) {
+			LoadedPage item;
+			{
+				std::unique_lock<std::mutex> lock(_lock);
+				_cond.wait(lock, [this] () { return _quit || !_queue.empty(); });
+				if (_quit) return;
+				item.page = _queue.front();
+				_queue.pop_front();
+				_inflight++;
+			}
+			item.texels.resize((size_t)_tile * _tile);
+			bool ok = ReadPage(item.page, &item.texels[0]);
+			{
+				std::lock_guard<std::mutex> lock(_lock);
+				if (ok) {
+					_completed.push_back(std::move(item));
+					_loaded++;
+				}
+				else {
+					_requested[item.page] = 0;
+				}
+				_inflight--;
+			}
+			_idle.notify_all();
+		}
+	}
+
+protected:
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+protected:
+	int _width;
+	int _height;
+	int _tile;
+	int _levels;
+	int _pages;                  // 所有层级的虚拟页总数
+	int _slots;                  // 物理页数量
+	uint32_t _frame;             // 当前帧序号，用于 LRU
+	std::vector<Level> _level;
+	std::vector<int> _table;     // 页表：虚拟页对应的物理页，-1 表示不在内存里
+	std::unique_ptr<std::atomic<uint8_t>[]> _requested;    // 虚拟页是否已经请求过
+	std::vector<uint32_t, MemoryAllocator<uint32_t, MEMORY_TEXTURE>> _cache;    // 物理页的像素，计入 MEMORY_TEXTURE
+	std::vector<int> _slot_page;     // 物理页存放的虚拟页，-1 表示空闲
+	std::unique_ptr<std::atomic<uint32_t>[]> _slot_frame;    // 物理页最后使用的帧
+	FILE *_fp;
+	std::thread _loader;
+	std::mutex _lock;
+	std::condition_variable _cond;
+	std::condition_variable _idle;
+	bool _quit;
+	int _inflight;                   // 后台线程正在读取的页数
+	std::vector<int> _requests;      // 本帧缺失的页
+	std::deque<int> _queue;          // 等待后台线程读取的页
+	std::vector<LoadedPage> _completed;    // 读取完成，等待放入物理页
+	std::atomic<int64_t> _fallback;
+	int64_t _last_fallback;
+	std::atomic<int64_t> _loaded;
+	int _max_requests;
+};
+
+
+#endif
+
+
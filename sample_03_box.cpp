@@ -46,12 +46,10 @@ int main(void)
 
 	// 定义一个纹理，并生成网格图案
 	Bitmap texture(256, 256);
-	for (int y = 0; y < 256; y++) {
-		for (int x = 0; x < 256; x++) {
+	texture.Transform([] (int x, int y, uint32_t) -> uint32_t {
 			int k = (x / 32 + y / 32) & 1;
-			texture.SetPixel(x, y, k? 0xffffffff : 0xff3fbcef);
-		}
-	}
+			return k? 0xffffffff : 0xff3fbcef;
+		});
 
 	// 定义变换矩阵：模型变换，摄像机变换，透视变换
 	Mat4x4f mat_model = matrix_set_rotate(-1, -0.5, 1, 1);	// 模型变换，旋转一定角度
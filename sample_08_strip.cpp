@@ -0,0 +1,70 @@
+#include <iostream>
+#include <vector>
+
+#include "RenderHelp.h"
+
+// 网格尺寸
+const int GRID_W = 32;
+const int GRID_H = 32;
+
+int main(void)
+{
+	RenderHelp rh(800, 600);
+
+	// 生成高度场地形网格的顶点
+	struct VertexAttrib { Vec3f pos; Vec3f color; };
+	std::vector<VertexAttrib> mesh;
+	for (int j = 0; j <= GRID_H; j++) {
+		for (int i = 0; i <= GRID_W; i++) {
+			float x = i * 2.0f / GRID_W - 1.0f;
+			float y = j * 2.0f / GRID_H - 1.0f;
+			float h = (float)(sin(x * 4.0f) * cos(y * 3.0f)) * 0.2f;
+			Vec3f color = { 0.2f + h * 2.0f, 0.6f + h, 0.3f };
+			mesh.push_back({ { x, y, h }, vector_clamp(color) });
+		}
+	}
+
+	// 每一行生成一条三角形带，行与行之间插入图元重启索引
+	std::vector<int> indices;
+	for (int j = 0; j < GRID_H; j++) {
+		for (int i = 0; i <= GRID_W; i++) {
+			indices.push_back(j * (GRID_W + 1) + i);
+			indices.push_back((j + 1) * (GRID_W + 1) + i);
+		}
+		indices.push_back(PRIMITIVE_RESTART);
+	}
+
+	// 定义变换矩阵：模型变换，摄像机变换，透视变换
+	Mat4x4f mat_model = matrix_set_identity();
+	Mat4x4f mat_view = matrix_set_lookat({0, -2.0, 1.5}, {0,0,0}, {0,0,1});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 800 / 600.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+
+	const int VARYING_COLOR = 0;
+
+	// 顶点着色器：index 直接就是网格顶点的序号
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			output.varying_vec3f[VARYING_COLOR] = mesh[index].color;
+			return mesh[index].pos.xyz1() * mat_mvp;
+		});
+
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			return input.varying_vec3f[VARYING_COLOR].xyz1();
+		});
+
+	// 一次调用绘制整个地形，带内每个三角形只需要变换一个新顶点
+	int count = rh.DrawIndexedPrimitive(TOPOLOGY_TRIANGLE_STRIP,
+			&indices[0], (int)indices.size());
+
+	std::cout << "triangles: " << count << "\n";
+
+	rh.SaveFile("output.bmp");
+
+#if defined(_WIN32) || defined(WIN32)
+	system("mspaint.exe output.bmp");
+#endif
+
+	return 0;
+}
+
+
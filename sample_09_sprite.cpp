@@ -0,0 +1,65 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "RenderHelp.h"
+
+
+int main(void)
+{
+	RenderHelp rh(800, 600);
+
+	// 生成一个带透明边缘的圆形粒子纹理
+	Bitmap texture(64, 64);
+	for (int y = 0; y < 64; y++) {
+		for (int x = 0; x < 64; x++) {
+			float dx = (x - 31.5f) / 32.0f, dy = (y - 31.5f) / 32.0f;
+			float a = Saturate(1.0f - sqrtf(dx * dx + dy * dy));
+			texture.SetPixel(x, y, Vec4f(1.0f, 1.0f, 1.0f, a));
+		}
+	}
+
+	// 随机生成一批粒子，用简单的线性同余生成器保证每次结果一致
+	uint32_t seed = 0x1234;
+	auto random = [&] () -> float {
+			seed = seed * 214013 + 2531011;
+			return ((seed >> 16) & 0x7fff) / 32767.0f;
+		};
+
+	std::vector<Sprite> sprites;
+	for (int i = 0; i < 20000; i++) {
+		Sprite sp;
+		sp.pos = { random() * 800.0f, random() * 600.0f };
+		float size = 4.0f + random() * 28.0f;
+		sp.size = { size, size };
+		sp.uv = { 0.0f, 0.0f, 1.0f, 1.0f };
+		sp.color = vector_to_color(Vec4f(random(), random(), random(), 0.6f));
+		sp.rotation = (i % 4 == 0)? random() * 3.1415926f : 0.0f;
+		sprites.push_back(sp);
+	}
+
+	// 测试吞吐量：重复绘制若干次取平均
+	const int ROUNDS = 10;
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < ROUNDS; i++) {
+		rh.Clear();
+		rh.DrawSprites(&sprites[0], (int)sprites.size(), &texture);
+	}
+	auto te = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double>(te - ts).count();
+
+	std::cout << "sprites/second: " << (sprites.size() * ROUNDS / seconds) << "\n";
+
+	// 当前使用的内核版本，可以用环境变量 RENDER_HELP_ISA 切换后对比
+	std::cout << "kernels: " << KernelRegistry::Get().Report() << "\n";
+
+	rh.SaveFile("output.bmp");
+
+#if defined(_WIN32) || defined(WIN32)
+	system("mspaint.exe output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "Model.h"
+
+
+// varying 的 key
+const int VARYING_UV = 0;
+const int VARYING_EYE = 1;
+const int VARYING_DEPTH = 2;
+
+// 材质参数：所有变体共享
+struct Material {
+	Model *model;
+	Vec3f light_dir;
+	Vec3f fog_color;
+	float fog_near;
+	float fog_far;
+	Mat4x4f mat_model_it;
+};
+
+
+// 像素着色器模板：FEATURES 是特性位集合，if constexpr 让每个变体
+// 在编译期裁掉关闭的特性，不再有运行时分支
+template <uint32_t FEATURES> struct ModelShader {
+	static Vec4f Shade(const Material& mtl, ShaderContext& input) {
+		Vec2f uv = input.varying_vec2f[VARYING_UV];
+		Vec3f l = vector_normalize(mtl.light_dir);
+		Vec3f n = { 0.0f, 0.0f, 1.0f };
+		if constexpr ((FEATURES & SHADER_FEATURE_NORMALMAP) != 0) {
+			n = (mtl.model->normal(uv).xyz1() * mtl.mat_model_it).xyz();
+		}
+		float intense = Saturate(vector_dot(n, l)) + 0.2f;
+		if constexpr ((FEATURES & SHADER_FEATURE_SPECULAR) != 0) {
+			Vec3f eye_dir = input.varying_vec3f[VARYING_EYE];
+			float s = mtl.model->Specular(uv);
+			Vec3f r = vector_normalize(n * vector_dot(n, l) * 2.0f - l);
+			float p = Saturate(vector_dot(r, eye_dir));
+			intense += Saturate(pow(p, s * 20) * 0.05);
+		}
+		Vec4f color = mtl.model->diffuse(uv) * intense;
+		if constexpr ((FEATURES & SHADER_FEATURE_FOG) != 0) {
+			float depth = input.varying_float[VARYING_DEPTH];
+			float f = Saturate((depth - mtl.fog_near) / (mtl.fog_far - mtl.fog_near));
+			color = vector_lerp(color, mtl.fog_color.xyz1(), f);
+		}
+		if constexpr ((FEATURES & SHADER_FEATURE_ALPHATEST) != 0) {
+			// 用漫反射贴图的亮度做镂空
+			Vec4f tc = mtl.model->diffuse(uv);
+			color.a = (tc.r + tc.g + tc.b > 0.3f)? 1.0f : 0.0f;
+		}
+		return color;
+	}
+};
+
+
+int main(void)
+{
+	RenderHelp rh(600, 800);
+
+	Model model("res/diablo3_pose.obj");
+
+	Vec3f eye_pos = {0, -0.5, 1.7};
+	Mat4x4f mat_model = matrix_set_scale(1, 1, 1);
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 0}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 6 / 8.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+
+	Material mtl;
+	mtl.model = &model;
+	mtl.light_dir = {1, 1, 0.85};
+	mtl.fog_color = {0.1f, 0.1f, 0.44f};
+	mtl.fog_near = 1.2f;
+	mtl.fog_far = 2.4f;
+	mtl.mat_model_it = matrix_invert(mat_model).Transpose();
+
+	// 所有变体在编译期生成，这里按特性位取出
+	ShaderPermutation<ModelShader, Material> shaders(mtl);
+
+	struct { Vec3f pos; Vec2f uv; } vs_input[3];
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			Vec4f pos = vs_input[index].pos.xyz1() * mat_mvp;
+			Vec3f pos_world = (vs_input[index].pos.xyz1() * mat_model).xyz();
+			output.varying_vec2f[VARYING_UV] = vs_input[index].uv;
+			output.varying_vec3f[VARYING_EYE] = eye_pos - pos_world;
+			output.varying_float[VARYING_DEPTH] = pos.w;
+			return pos;
+		});
+
+	// 依次用不同的特性组合渲染，比较耗时
+	uint32_t variants[] = {
+		0,
+		SHADER_FEATURE_NORMALMAP,
+		SHADER_FEATURE_NORMALMAP | SHADER_FEATURE_SPECULAR,
+		SHADER_FEATURE_NORMALMAP | SHADER_FEATURE_SPECULAR | SHADER_FEATURE_FOG,
+	};
+
+	for (uint32_t features: variants) {
+		rh.Clear();
+		rh.SetPixelShader(shaders.Get(features));
+		rh.SetAlphaTest((features & SHADER_FEATURE_ALPHATEST) != 0);
+		auto ts = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < model.nfaces(); i++) {
+			for (int j = 0; j < 3; j++) {
+				vs_input[j].pos = model.vert(i, j);
+				vs_input[j].uv = model.uv(i, j);
+			}
+			rh.DrawPrimitive();
+		}
+		auto te = std::chrono::high_resolution_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(te - ts).count();
+		std::cout << "features=" << features << " time=" << ms << "ms\n";
+	}
+
+	rh.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
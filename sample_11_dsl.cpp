@@ -0,0 +1,122 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "ShaderDSL.h"
+#include "Model.h"
+
+
+// 和 sample_07 的像素着色器等价的着色语言程序
+const char *shader_source = R"(
+	uv = texuv;
+	// 归一化光照方向
+	l = normalize(light_dir);
+	// 法向贴图取出法向并转换为世界坐标系
+	n = mul(vec4(sample(normalmap, uv).rgb * 2 - 1, 1), mat_model_it).xyz;
+	// 高光参数
+	s = sample(specularmap, uv).b;
+	// 反射光线和高光
+	r = normalize(n * dot(n, l) * 2 - l);
+	p = saturate(dot(r, eye_dir));
+	spec = saturate(pow(p, s * 20) * 0.05);
+	// 综合光照强度
+	intense = saturate(dot(n, l)) + 0.2 + spec;
+	return sample(diffuse, uv) * intense;
+)";
+
+
+int main(void) 
+{
+	RenderHelp rh(600, 800);
+
+	Model model("res/diablo3_pose.obj");
+
+	Vec3f eye_pos = {0, -0.5, 1.7};
+	Vec3f eye_at = {0, 0, 0};
+	Vec3f eye_up = {0, 1, 0};
+	Vec3f light_dir = {1, 1, 0.85};
+	float perspective = 3.1415926f * 0.5f;
+
+	Mat4x4f mat_model = matrix_set_scale(1, 1, 1);
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, eye_at, eye_up);
+	Mat4x4f mat_proj = matrix_set_perspective(perspective, 6 / 8.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+	Mat4x4f mat_model_it = matrix_invert(mat_model).Transpose();
+
+	struct { Vec3f pos; Vec2f uv; } vs_input[3];
+
+	const int VARYING_UV = 0;
+	const int VARYING_EYE = 1;
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			Vec4f pos = vs_input[index].pos.xyz1() * mat_mvp;
+			Vec3f pos_world = (vs_input[index].pos.xyz1() * mat_model).xyz();
+			output.varying_vec2f[VARYING_UV] = vs_input[index].uv;
+			output.varying_vec3f[VARYING_EYE] = eye_pos - pos_world;
+			return pos;
+		});
+
+	// C++ 版本的像素着色器，和 sample_07 相同
+	PixelShader ps = [&] (ShaderContext& input) -> Vec4f {
+			Vec2f uv = input.varying_vec2f[VARYING_UV];
+			Vec3f eye_dir = input.varying_vec3f[VARYING_EYE];
+			Vec3f l = vector_normalize(light_dir);
+			Vec3f n = (model.normal(uv).xyz1() * mat_model_it).xyz();
+			float s = model.Specular(uv);
+			Vec3f r = vector_normalize(n * vector_dot(n, l) * 2.0f - l);
+			float p = Saturate(vector_dot(r, eye_dir));
+			float spec = Saturate(pow(p, s * 20) * 0.05);
+			float intense = Saturate(vector_dot(n, l)) + 0.2f + spec;
+			Vec4f color = model.diffuse(uv);
+			return color * intense;
+		};
+
+	// 着色语言版本
+	ShaderProgram program;
+	program.SetVarying("texuv", 2, VARYING_UV);
+	program.SetVarying("eye_dir", 3, VARYING_EYE);
+	program.SetUniform("light_dir", light_dir.xyz1(), 3);
+	program.SetUniform("mat_model_it", mat_model_it);
+	program.SetTexture("diffuse", model.diffusemap());
+	program.SetTexture("normalmap", model.normalmap());
+	program.SetTexture("specularmap", model.specularmap());
+
+	if (!program.Compile(shader_source)) {
+		std::cout << "compile error: " << program.GetError() << "\n";
+		return 1;
+	}
+
+	std::cout << "instructions: " << program.GetInstructionCount() 
+		<< " registers: " << program.GetRegisterCount() << "\n";
+
+	auto render = [&] (const char *name) {
+			rh.Clear();
+			auto ts = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < model.nfaces(); i++) {
+				for (int j = 0; j < 3; j++) {
+					vs_input[j].pos = model.vert(i, j);
+					vs_input[j].uv = model.uv(i, j);
+				}
+				rh.DrawPrimitive();
+			}
+			auto te = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(te - ts).count();
+			std::cout << name << ": " << ms << "ms\n";
+		};
+
+	rh.SetPixelShader(ps);
+	render("c++ lambda");
+	rh.SaveFile("output_cpp.bmp");
+
+	rh.SetPixelPacketShader(program.GetShader());
+	render("shader dsl");
+	rh.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "RenderHelp.h"
+
+// 地面网格尺寸
+const int GRID_N = 16;
+const float GRID_SIZE = 8.0f;
+
+int main(void)
+{
+	RenderHelp rh(800, 600);
+
+	// 地面网格，用三角形带绘制
+	std::vector<Vec3f> mesh;
+	for (int j = 0; j <= GRID_N; j++) {
+		for (int i = 0; i <= GRID_N; i++) {
+			float x = (i / (float)GRID_N - 0.5f) * GRID_SIZE;
+			float y = (j / (float)GRID_N - 0.5f) * GRID_SIZE;
+			mesh.push_back({ x, y, 0.0f });
+		}
+	}
+	std::vector<int> indices;
+	for (int j = 0; j < GRID_N; j++) {
+		for (int i = 0; i <= GRID_N; i++) {
+			indices.push_back(j * (GRID_N + 1) + i);
+			indices.push_back((j + 1) * (GRID_N + 1) + i);
+		}
+		indices.push_back(PRIMITIVE_RESTART);
+	}
+
+	// 随机生成一批点光源，用简单的线性同余生成器保证每次结果一致
+	uint32_t seed = 0x5678;
+	auto random = [&] () -> float {
+			seed = seed * 214013 + 2531011;
+			return ((seed >> 16) & 0x7fff) / 32767.0f;
+		};
+	std::vector<PointLight> lights;
+	for (int i = 0; i < 256; i++) {
+		PointLight light;
+		light.pos = { (random() - 0.5f) * GRID_SIZE, (random() - 0.5f) * GRID_SIZE, 0.2f };
+		light.radius = 0.4f + random() * 0.6f;
+		light.color = { random(), random(), random() };
+		lights.push_back(light);
+	}
+
+	Vec3f eye_pos = { 0, -4.5, 3.0 };
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 0}, {0, 0, 1});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 800 / 600.0, 1.0, 500.0f);
+	Mat4x4f mat_vp = mat_view * mat_proj;
+
+	const int VARYING_POS = 0;
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			output.varying_vec3f[VARYING_POS] = mesh[index];
+			return mesh[index].xyz1() * mat_vp;
+		});
+
+	// 计算单个点光源对地面上一点的光照
+	auto shade = [&] (const PointLight& light, const Vec3f& pos) -> Vec3f {
+			Vec3f d = light.pos - pos;
+			float dist = vector_length(d);
+			if (dist >= light.radius) return Vec3f();
+			float att = 1.0f - dist / light.radius;
+			float ndotl = Saturate(d.z / dist);
+			return light.color * (att * att * ndotl);
+		};
+
+	uint64_t evaluated = 0;
+
+	// 深度预绘制：只为了得到深度缓存，不需要像素着色器
+	rh.SetPixelShader(NULL);
+	rh.DrawIndexedPrimitive(TOPOLOGY_TRIANGLE_STRIP, &indices[0], (int)indices.size());
+
+	// 方法一：每个像素遍历全部光源
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			Vec3f pos = input.varying_vec3f[VARYING_POS];
+			Vec3f color = { 0.05f, 0.05f, 0.05f };
+			for (auto &light: lights) color += shade(light, pos);
+			evaluated += lights.size();
+			return color.xyz1();
+		});
+
+	auto ts = std::chrono::high_resolution_clock::now();
+	rh.DrawIndexedPrimitive(TOPOLOGY_TRIANGLE_STRIP, &indices[0], (int)indices.size());
+	auto te = std::chrono::high_resolution_clock::now();
+	std::cout << "all lights: " << std::chrono::duration<double, std::milli>(te - ts).count()
+		<< "ms, " << evaluated << " light evaluations\n";
+	rh.SaveFile("output_all.bmp");
+
+	// 方法二：分块剔除后，每个像素只遍历所在块的光源
+	LightGrid grid(16);
+	evaluated = 0;
+	ts = std::chrono::high_resolution_clock::now();
+	grid.Build(lights, mat_view, mat_proj, rh);
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			Vec3f pos = input.varying_vec3f[VARYING_POS];
+			Vec3f color = { 0.05f, 0.05f, 0.05f };
+			const std::vector<int>& list = grid.GetLights(input.x, input.y);
+			for (int index: list) color += shade(lights[index], pos);
+			evaluated += list.size();
+			return color.xyz1();
+		});
+	rh.DrawIndexedPrimitive(TOPOLOGY_TRIANGLE_STRIP, &indices[0], (int)indices.size());
+	te = std::chrono::high_resolution_clock::now();
+	std::cout << "tiled lights: " << std::chrono::duration<double, std::milli>(te - ts).count()
+		<< "ms, " << evaluated << " light evaluations\n";
+
+	rh.SaveFile("output.bmp");
+
+#if defined(_WIN32) || defined(WIN32)
+	system("mspaint.exe output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "Model.h"
+#include "EnvMap.h"
+
+
+// varying 的 key
+const int VARYING_UV = 0;
+const int VARYING_EYE = 1;
+
+
+int main(void)
+{
+	RenderHelp rh(600, 800);
+
+	Model model("res/diablo3_pose.obj");
+
+	// 程序生成的天空：地平线附近的渐变，加上一个太阳
+	CubeMap sky(128);
+	Vec3f sun = vector_normalize(Vec3f(1, 1, 0.85f));
+	sky.Generate([&] (const Vec3f& d) -> Vec3f {
+			Vec3f ground = { 0.25f, 0.2f, 0.15f };
+			Vec3f horizon = { 0.8f, 0.85f, 0.9f };
+			Vec3f zenith = { 0.2f, 0.4f, 0.9f };
+			Vec3f c = (d.y < 0.0f)? vector_lerp(horizon, ground, Saturate(-d.y * 4.0f)) :
+				vector_lerp(horizon, zenith, Saturate(d.y));
+			float s = Saturate(vector_dot(d, sun));
+			return c + Vec3f(1.0f, 0.9f, 0.7f) * (powf(s, 200.0f) * 20.0f);
+		});
+
+	// 第一次运行时预滤波并写入缓存，之后直接加载
+	auto ts = std::chrono::high_resolution_clock::now();
+	EnvironmentMap env(sky, 6, "sky_env.cache");
+	auto te = std::chrono::high_resolution_clock::now();
+	double ms = std::chrono::duration<double, std::milli>(te - ts).count();
+	std::cout << (env.IsFromCache()? "load cache: " : "prefilter: ") << ms << "ms\n";
+
+	Vec3f eye_pos = {0, -0.5, 1.7};
+	Mat4x4f mat_model = matrix_set_scale(1, 1, 1);
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 0}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 6 / 8.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+	Mat4x4f mat_model_it = matrix_invert(mat_model).Transpose();
+
+	struct { Vec3f pos; Vec2f uv; } vs_input[3];
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			Vec4f pos = vs_input[index].pos.xyz1() * mat_mvp;
+			Vec3f pos_world = (vs_input[index].pos.xyz1() * mat_model).xyz();
+			output.varying_vec2f[VARYING_UV] = vs_input[index].uv;
+			output.varying_vec3f[VARYING_EYE] = eye_pos - pos_world;
+			return pos;
+		});
+
+	// 漫反射用球谐辐照度，高光沿反射方向采样预滤波的 mip
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			Vec2f uv = input.varying_vec2f[VARYING_UV];
+			Vec3f v = vector_normalize(input.varying_vec3f[VARYING_EYE]);
+			Vec3f n = vector_normalize((model.normal(uv).xyz1() * mat_model_it).xyz());
+			Vec3f r = n * vector_dot(n, v) * 2.0f - v;
+			float roughness = 1.0f - Saturate(model.Specular(uv) / 20.0f);
+			Vec3f albedo = model.diffuse(uv).xyz();
+			Vec3f color = albedo * env.Irradiance(n) + env.Specular(r, roughness) * 0.04f;
+			return vector_clamp(color).xyz1();
+		});
+
+	for (int i = 0; i < model.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			vs_input[j].pos = model.vert(i, j);
+			vs_input[j].uv = model.uv(i, j);
+		}
+		rh.DrawPrimitive();
+	}
+
+	rh.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "Model.h"
+
+
+// varying 的 key
+const int VARYING_UV = 0;
+const int VARYING_AO = 1;
+
+
+int main(void)
+{
+	RenderHelp rh(600, 800);
+
+	Model model("res/diablo3_pose.obj");
+
+	// 第一次运行时多线程烘焙并写入 res/diablo3_pose_ao.cache，之后直接读取
+	auto ts = std::chrono::high_resolution_clock::now();
+	model.BakeAO(128);
+	auto te = std::chrono::high_resolution_clock::now();
+	double ms = std::chrono::duration<double, std::milli>(te - ts).count();
+	std::cout << "bake ao: " << ms << "ms\n";
+
+	Vec3f eye_pos = {0, -0.5, 1.7};
+	Vec3f light_dir = {1, 1, 0.85};
+	Mat4x4f mat_model = matrix_set_scale(1, 1, 1);
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 0}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 6 / 8.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+	Mat4x4f mat_model_it = matrix_invert(mat_model).Transpose();
+
+	struct { Vec3f pos; Vec2f uv; float ao; } vs_input[3];
+
+	// AO 和 uv 一样只是一个顶点属性
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			output.varying_vec2f[VARYING_UV] = vs_input[index].uv;
+			output.varying_float[VARYING_AO] = vs_input[index].ao;
+			return vs_input[index].pos.xyz1() * mat_mvp;
+		});
+
+	// 环境光乘以遮蔽值，再加上方向光
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			Vec2f uv = input.varying_vec2f[VARYING_UV];
+			float ao = input.varying_float[VARYING_AO];
+			Vec3f n = (model.normal(uv).xyz1() * mat_model_it).xyz();
+			Vec3f l = vector_normalize(light_dir);
+			float intense = Saturate(vector_dot(n, l)) * 0.6f + ao * 0.6f;
+			return model.diffuse(uv) * intense;
+		});
+
+	for (int i = 0; i < model.nfaces(); i++) {
+		for (int j = 0; j < 3; j++) {
+			vs_input[j].pos = model.vert(i, j);
+			vs_input[j].uv = model.uv(i, j);
+			vs_input[j].ao = model.ao(i, j);
+		}
+		rh.DrawPrimitive();
+	}
+
+	rh.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <vector>
+
+#include "RenderHelp.h"
+
+
+// 单位立方体的 12 个三角形
+static std::vector<Vec3f> MakeCube() {
+	const int faces[6][4] = {
+		{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3},
+	};
+	std::vector<Vec3f> verts;
+	for (int f = 0; f < 6; f++) {
+		int quad[6] = { 0, 1, 2, 2, 3, 0 };
+		for (int k: quad) {
+			int c = faces[f][k];
+			verts.push_back({ (c & 1)? 0.5f : -0.5f, (c & 2)? 0.5f : -0.5f, (c & 4)? 0.5f : -0.5f });
+		}
+	}
+	return verts;
+}
+
+
+int main(void)
+{
+	RenderHelp rh(800, 600);
+
+	std::vector<Vec3f> cube = MakeCube();
+	MeshBVH mesh(cube);
+
+	// 30x30 个小方块，前方放一堵墙挡住一部分
+	const int GRID = 30;
+	SceneBVH scene;
+	std::vector<Vec3f> colors;
+	for (int j = 0; j < GRID; j++) {
+		for (int i = 0; i < GRID; i++) {
+			Mat4x4f m = matrix_set_translate(i - GRID * 0.5f, 0.0f, j * 1.5f + 4.0f);
+			scene.AddInstance(&mesh, m);
+			colors.push_back({ 0.3f + 0.7f * i / GRID, 0.4f, 0.3f + 0.7f * j / GRID });
+		}
+	}
+	scene.AddInstance(&mesh, matrix_set_scale(8.0f, 3.0f, 0.5f) * matrix_set_translate(-5.0f, 0.5f, 6.0f));
+	colors.push_back({ 0.8f, 0.8f, 0.8f });
+	scene.Build();
+
+	// 物体移动后只需要 Refit
+	for (int i = 0; i < GRID * GRID; i++) {
+		Mat4x4f m = scene.GetTransform(i);
+		scene.SetTransform(i, m * matrix_set_translate(0.0f, (float)sin(i * 0.3f) * 0.5f, 0.0f));
+	}
+	scene.Refit();
+
+	Vec3f eye_pos = { 0.0f, 4.0f, -2.0f };
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 10}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 800 / 600.0, 1.0, 500.0f);
+	Mat4x4f mat_vp = mat_view * mat_proj;
+
+	// 拾取屏幕中心像素：反投影近平面和远平面上的点得到世界空间射线
+	Mat4x4f inv_vp = matrix_invert(mat_vp);
+	Vec4f pn = Vec4f(0.0f, 0.0f, 0.0f, 1.0f) * inv_vp;
+	Vec4f pf = Vec4f(0.0f, 0.0f, 1.0f, 1.0f) * inv_vp;
+	Ray ray;
+	ray.origin = pn.xyz() / pn.w;
+	ray.dir = vector_normalize(pf.xyz() / pf.w - ray.origin);
+	ray.tmax = 1e30f;
+	RayHit hit;
+	int picked = -1;
+	if (scene.Intersect(ray, hit, picked)) {
+		std::cout << "picked: instance=" << picked << " prim=" << hit.prim
+			<< " t=" << hit.t << " uv=(" << hit.u << ", " << hit.v << ")\n";
+	}
+
+	Mat4x4f mat_mvp;
+	Vec3f color;
+	const int VARYING_SHADE = 0;
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			// 按照面的朝向给一点明暗
+			output.varying_float[VARYING_SHADE] = 0.6f + 0.4f * ((index / 6) % 3) / 2.0f;
+			return cube[index].xyz1() * mat_mvp;
+		});
+
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			return (color * input.varying_float[VARYING_SHADE]).xyz1();
+		});
+
+	// 视锥剔除后从近到远绘制，被已绘制物体完全挡住的实例跳过
+	std::vector<int> visible;
+	scene.CullFrustum(mat_vp, visible);
+	int drawn = 0;
+	for (int id: visible) {
+		if (scene.IsOccluded(id, mat_vp, rh)) continue;
+		mat_mvp = scene.GetTransform(id) * mat_vp;
+		color = (id == picked)? Vec3f(1.0f, 0.1f, 0.1f) : colors[id];
+		rh.DrawPrimitive(TOPOLOGY_TRIANGLE_LIST, (int)cube.size());
+		drawn++;
+	}
+
+	std::cout << "instances: " << scene.GetInstanceCount() << " in frustum: " << visible.size()
+		<< " drawn: " << drawn << "\n";
+
+	rh.SaveFile("output.bmp");
+
+#if defined(_WIN32) || defined(WIN32)
+	system("mspaint.exe output.bmp");
+#endif
+
+	return 0;
+}
+
+
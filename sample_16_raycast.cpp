@@ -0,0 +1,147 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+#include "RenderHelp.h"
+#include "PerfCounter.h"
+
+
+// 生成带起伏的球面，segments x segments 个四边形，每个拆成两个三角形
+static void MakeSphere(int segments, std::vector<Vec3f>& verts, std::vector<Vec3f>& norms) {
+	auto point = [&] (int i, int j) -> Vec3f {
+		float theta = 3.1415926f * j / segments;
+		float phi = 2.0f * 3.1415926f * i / segments;
+		float r = 1.0f + 0.05f * sinf(phi * 12.0f) * sinf(theta * 10.0f);
+		return { r * sinf(theta) * cosf(phi), r * cosf(theta), r * sinf(theta) * sinf(phi) };
+	};
+	for (int j = 0; j < segments; j++) {
+		for (int i = 0; i < segments; i++) {
+			Vec3f p00 = point(i, j), p10 = point(i + 1, j);
+			Vec3f p01 = point(i, j + 1), p11 = point(i + 1, j + 1);
+			Vec3f quad[6] = { p00, p10, p11, p00, p11, p01 };
+			for (int k = 0; k < 6; k++) {
+				verts.push_back(quad[k]);
+				norms.push_back(vector_normalize(quad[k]));
+			}
+		}
+	}
+}
+
+
+int main(void)
+{
+	RenderHelp rh(400, 300);
+
+	std::vector<Vec3f> verts, norms;
+	MakeSphere(700, verts, norms);
+	int triangles = (int)verts.size() / 3;
+
+	auto ts = std::chrono::high_resolution_clock::now();
+	MeshBVH bvh(verts);
+	auto te = std::chrono::high_resolution_clock::now();
+	std::cout << "triangles: " << triangles << " bvh build: " 
+		<< std::chrono::duration<double, std::milli>(te - ts).count() << "ms\n";
+
+	Mat4x4f mat_model = matrix_set_rotate(0, 1, 0, 0.5f);
+	Mat4x4f mat_view = matrix_set_lookat({0, 0.5f, -2.2f}, {0, 0, 0}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 400 / 300.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+	Vec3f light_dir = vector_normalize(Vec3f(1, 1, -1));
+
+	const int VARYING_NORMAL = 0;
+
+	// 两个后端共用同一套 VS/PS，index 为顶点数组的序号，密度扫描时换成其他网格
+	const std::vector<Vec3f> *mesh_verts = &verts, *mesh_norms = &norms;
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			output.varying_vec3f[VARYING_NORMAL] = ((*mesh_norms)[index].xyz1() * mat_model).xyz();
+			return (*mesh_verts)[index].xyz1() * mat_mvp;
+		});
+
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			Vec3f n = vector_normalize(input.varying_vec3f[VARYING_NORMAL]);
+			float intense = Saturate(vector_dot(n, light_dir)) * 0.8f + 0.2f;
+			return Vec4f(0.9f, 0.7f, 0.5f, 1.0f) * intense;
+		});
+
+	// 光栅化
+	// 同时统计硬件计数器，按三角形数量平均
+	PerfCounters perf;
+	rh.Clear();
+	ts = std::chrono::high_resolution_clock::now();
+	perf.Start();
+	rh.DrawPrimitive(TOPOLOGY_TRIANGLE_LIST, triangles * 3);
+	perf.Stop();
+	te = std::chrono::high_resolution_clock::now();
+	std::cout << "rasterize: " << std::chrono::duration<double, std::milli>(te - ts).count() << "ms\n";
+	std::cout << "  " << perf.Report("triangle", triangles) << "\n";
+	rh.SaveFile("output_raster.bmp");
+
+	// 光线投射
+	// 光线投射按像素数量平均
+	rh.Clear();
+	perf.Reset();
+	ts = std::chrono::high_resolution_clock::now();
+	perf.Start();
+	int covered = rh.RayCastPrimitive(bvh, mat_mvp);
+	perf.Stop();
+	te = std::chrono::high_resolution_clock::now();
+	std::cout << "ray cast: " << std::chrono::duration<double, std::milli>(te - ts).count() 
+		<< "ms, pixels: " << covered << "\n";
+	std::cout << "  " << perf.Report("pixel", 400 * 300) << "\n";
+
+	// 多路服务器上可以看到有多少条带被其他 NUMA 节点的线程执行
+	std::cout << "numa nodes: " << NumaTopology::Get().GetNodeCount() 
+		<< " cross-node scheduled: " << rh.GetNumaStats().GetCrossNodeRatio() * 100.0f << "%\n";
+
+	// 扫描不同的三角形密度（三角形数 / 像素数），两种后端耗时相同的位置就是
+	// RenderHelp 里 RAYCAST_MIN_DENSITY 的依据，建立 BVH 不计入耗时
+	int sweep[] = { 50, 100, 150, 175, 200, 225, 250, 300, 400 };
+	double last_density = 0.0, last_ratio = 0.0, crossover = -1.0;
+	for (int segments: sweep) {
+		std::vector<Vec3f> sv, sn;
+		MakeSphere(segments, sv, sn);
+		MeshBVH sbvh(sv);
+		mesh_verts = &sv;
+		mesh_norms = &sn;
+		int count = (int)sv.size() / 3;
+		rh.Clear();
+		ts = std::chrono::high_resolution_clock::now();
+		rh.DrawPrimitive(TOPOLOGY_TRIANGLE_LIST, count * 3);
+		te = std::chrono::high_resolution_clock::now();
+		double t_raster = std::chrono::duration<double, std::milli>(te - ts).count();
+		rh.Clear();
+		ts = std::chrono::high_resolution_clock::now();
+		rh.RayCastPrimitive(sbvh, mat_mvp);
+		te = std::chrono::high_resolution_clock::now();
+		double t_ray = std::chrono::duration<double, std::milli>(te - ts).count();
+		double density = count / (400.0 * 300.0);
+		double ratio = t_raster / t_ray;
+		std::cout << "density " << density << ": rasterize " << t_raster << "ms, ray cast " << t_ray << "ms\n";
+		// 光栅化和光线投射的耗时比第一次超过 1 时，在相邻两个密度之间线性插值
+		if (crossover < 0.0 && ratio >= 1.0 && last_ratio > 0.0 && last_ratio < 1.0)
+			crossover = last_density + (density - last_density) * (1.0 - last_ratio) / (ratio - last_ratio);
+		last_density = density;
+		last_ratio = ratio;
+	}
+	mesh_verts = &verts;
+	mesh_norms = &norms;
+	if (crossover > 0.0) 
+		std::cout << "crossover: " << crossover << " triangles per pixel\n";
+	else
+		std::cout << "crossover: not in the sweep range\n";
+
+	// 按照三角形数量自动选择
+	rh.Clear();
+	bool raycast = rh.DrawMesh(bvh, mat_mvp);
+	std::cout << "auto: " << (raycast? "ray cast" : "rasterize") << "\n";
+
+	rh.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <vector>
+
+#include "RenderHelp.h"
+#include "Model.h"
+
+
+int main(void)
+{
+	// 原图 600x800 的 1/4，用作低分辨率的遮挡缓存
+	RenderHelp rh(150, 200);
+
+	Model model("res/diablo3_pose.obj");
+
+	Vec3f eye_pos = {0, -0.5, 1.7};
+	Mat4x4f mat_model = matrix_set_scale(1, 1, 1);
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 0}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 6 / 8.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+
+	Vec3f vs_input[3];
+	int face = 0;
+	std::vector<bool> touched;
+	int pixels = 0, inner = 0;
+
+	rh.SetVertexShader([&] (int index, ShaderContext&) -> Vec4f {
+			return vs_input[index].xyz1() * mat_mvp;
+		});
+
+	// 统计着色的像素数，以及至少画了一个像素的三角形数
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			touched[face] = true;
+			pixels++;
+			inner += input.inner? 1 : 0;
+			return input.inner? Vec4f(1, 1, 1, 1) : Vec4f(0.5f, 0.5f, 0.5f, 1);
+		});
+
+	const char *names[] = { "normal", "outer", "inner" };
+	ConservativeMode modes[] = { CONSERVATIVE_NONE, CONSERVATIVE_OUTER, CONSERVATIVE_INNER };
+
+	for (int m = 0; m < 3; m++) {
+		rh.Clear();
+		rh.SetConservative(modes[m]);
+		touched.assign(model.nfaces(), false);
+		pixels = inner = 0;
+		for (face = 0; face < model.nfaces(); face++) {
+			for (int j = 0; j < 3; j++) vs_input[j] = model.vert(face, j);
+			rh.DrawPrimitive();
+		}
+		int count = 0;
+		for (bool t: touched) count += t? 1 : 0;
+		std::cout << names[m] << ": triangles drawn " << count << "/" << model.nfaces() 
+			<< " pixels " << pixels << " inner " << inner << "\n";
+		if (modes[m] == CONSERVATIVE_OUTER) rh.SaveFile("output.bmp");
+	}
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "PerfCounter.h"
+
+
+// 统计 /proc/self/smaps 里的 AnonHugePages 之和，单位 KB
+static long AnonHugePages() {
+	std::ifstream in("/proc/self/smaps");
+	std::string line;
+	long total = 0;
+	while (std::getline(in, line)) {
+		if (line.compare(0, 14, "AnonHugePages:") == 0)
+			total += atol(line.c_str() + 14);
+	}
+	return total;
+}
+
+
+// 在大纹理上随机双线性采样，每次访问大概率落在不同的 4KB 页上
+static double BenchSample(const Bitmap& texture, int count, uint32_t& checksum) {
+	uint32_t seed = 12345;
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		float u = (seed >> 8) * (1.0f / 16777216.0f);
+		seed = seed * 1664525u + 1013904223u;
+		float v = (seed >> 8) * (1.0f / 16777216.0f);
+		checksum += texture.SampleBilinear(u * texture.GetW(), v * texture.GetH());
+	}
+	auto te = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(te - ts).count();
+}
+
+
+static void Bench(bool huge) {
+	MemorySetHugePage(huge);
+	Bitmap texture(4096, 4096);
+	for (int y = 0; y < texture.GetH(); y++) {
+		for (int x = 0; x < texture.GetW(); x++)
+			texture.SetPixel(x, y, (uint32_t)(x * 2654435761u) ^ (uint32_t)y);
+	}
+	RenderHelp rh(3840, 2160);
+	uint32_t checksum = 0;
+	BenchSample(texture, 1000000, checksum);   // 预热
+	PerfCounters perf;
+	perf.Start();
+	double sample = BenchSample(texture, 8000000, checksum);
+	perf.Stop();
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < 20; i++) rh.Clear();
+	auto te = std::chrono::high_resolution_clock::now();
+	double clear = std::chrono::duration<double, std::milli>(te - ts).count() / 20;
+	std::cout << (huge? "huge page: " : "4k page:   ")
+		<< "sample " << sample << "ms, clear " << clear << "ms"
+		<< ", hugetlb " << (MemoryGetBytes(MEMORY_HUGETLB) >> 20) << "MB"
+		<< ", thp " << (MemoryGetBytes(MEMORY_TRANSPARENT) >> 20) << "MB"
+		<< ", AnonHugePages " << AnonHugePages() << "KB"
+		<< " (" << checksum << ")\n";
+	std::cout << "  sample: " << perf.Report("sample", 8000000) << "\n";
+}
+
+
+// 对比普通页和大页：随机纹理采样和 4K 帧缓存清屏的耗时
+int main(void)
+{
+	Bench(false);
+	Bench(true);
+	return 0;
+}
+
+
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+
+
+// 按列遍历纹理，模拟旋转绘制或者纵向模糊时的访问顺序
+static double BenchColumns(const Bitmap& bmp, uint32_t& checksum) {
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int k = 0; k < 20; k++) {
+		for (int x = 0; x < bmp.GetW(); x++) {
+			for (int y = 0; y < bmp.GetH(); y++)
+				checksum += ((const uint32_t*)bmp.GetLine(y))[x];
+		}
+	}
+	auto te = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(te - ts).count();
+}
+
+
+// 每帧创建并销毁几张临时图片
+static double BenchScratch(int frames) {
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < frames; i++) {
+		Bitmap target(1920, 1080, false);
+		Bitmap half(960, 540, false);
+		Bitmap quarter(480, 270, false);
+		target.GetLine(0)[0] = half.GetLine(0)[0] = quarter.GetLine(0)[0] = (uint8_t)i;
+	}
+	auto te = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(te - ts).count();
+}
+
+
+int main(void)
+{
+	uint32_t checksum = 0;
+	Bitmap plain(1024, 1024, true, false);
+	Bitmap padded(1024, 1024, true, true);
+	plain.Fill(0x01020304);
+	padded.Fill(0x01020304);
+	std::cout << "pitch " << plain.GetPitch() << ": " << BenchColumns(plain, checksum) << "ms\n";
+	std::cout << "pitch " << padded.GetPitch() << ": " << BenchColumns(padded, checksum) << "ms\n";
+
+	BitmapPool& pool = BitmapPool::Get();
+	size_t limit = pool.GetLimit();
+	pool.SetLimit(0);
+	std::cout << "scratch without pool: " << BenchScratch(500) << "ms\n";
+	pool.SetLimit(limit);
+	std::cout << "scratch with pool: " << BenchScratch(500) << "ms, hits "
+		<< pool.GetHits() << ", misses " << pool.GetMisses() << "\n";
+	std::cout << "(" << checksum << ")\n";
+	return 0;
+}
+
+
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "RenderHelp.h"
+#include "Model.h"
+
+
+// 计算一帧的校验和，模拟编码或者显示
+static uint32_t Checksum(const Bitmap& bmp) {
+	uint32_t sum = 0;
+	for (int y = 0; y < bmp.GetH(); y++) {
+		const uint32_t *line = (const uint32_t*)bmp.GetLine(y);
+		for (int x = 0; x < bmp.GetW(); x++) sum = sum * 31 + line[x];
+	}
+	return sum;
+}
+
+
+int main(void)
+{
+	// 复制模型只增加贴图的引用计数
+	Model model("res/diablo3_pose.obj");
+	Model copy = model;
+	std::cout << "texture shared: " << (copy.diffusemap() == model.diffusemap()? "yes" : "no")
+		<< ", refs " << model.diffusemap_shared().GetRefCount() - 1 << "\n";
+
+	// 移动到一个容器里，不复制帧缓存
+	std::vector<RenderHelp> renderers;
+	renderers.push_back(RenderHelp(400, 300));
+	RenderHelp& rh = renderers[0];
+
+	struct { Vec4f pos; Vec4f color; } vs_input[3] = {
+		{ {  0.0,  0.7, 0.90, 1}, {1, 0, 0, 1} },
+		{ { -0.6, -0.2, 0.01, 1}, {0, 1, 0, 1} },
+		{ { +0.6, -0.2, 0.01, 1}, {0, 0, 1, 1} },
+	};
+
+	const int VARYING_COLOR = 0;
+	float angle = 0.0f;
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			Vec4f pos = vs_input[index].pos;
+			float c = cosf(angle), s = sinf(angle);
+			output.varying_vec4f[VARYING_COLOR] = vs_input[index].color;
+			return { pos.x * c - pos.y * s, pos.x * s + pos.y * c, pos.z, pos.w };
+		});
+
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			return input.varying_vec4f[VARYING_COLOR];
+		});
+
+	// 每帧画完以后把句柄交给后台线程，渲染线程马上开始下一帧
+	std::vector<std::thread> workers;
+	std::vector<uint32_t> sums(8);
+	for (int i = 0; i < 8; i++) {
+		angle = i * 0.3f;
+		rh.Clear();
+		rh.DrawPrimitive();
+		SharedBitmap frame = rh.GetFrame();
+		workers.push_back(std::thread([frame, &sums, i] () { sums[i] = Checksum(*frame); }));
+	}
+	for (auto &t: workers) t.join();
+
+	for (int i = 0; i < 8; i++) std::cout << "frame " << i << ": " << sums[i] << "\n";
+
+	rh.SaveFile("output.bmp");
+
+	return 0;
+}
+
+
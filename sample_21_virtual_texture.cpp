@@ -0,0 +1,126 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "VirtualTexture.h"
+
+
+// 虚拟纹理尺寸和地面大小
+const int VT_SIZE = 16384;
+const float GROUND_SIZE = 400.0f;
+
+
+// 程序生成的地面纹理：大小两级棋盘格，加上一些高频的条纹
+static uint32_t GroundTexel(int x, int y) {
+	uint32_t h = (uint32_t)(x * 73856093) ^ (uint32_t)(y * 19349663);
+	h = (h ^ (h >> 13)) * 0x5bd1e995;
+	int noise = (int)((h >> 24) & 31);
+	bool big = ((x >> 10) ^ (y >> 10)) & 1;
+	bool small = ((x >> 5) ^ (y >> 5)) & 1;
+	int g = (big? 120 : 60) + (small? 40 : 0) + noise;
+	int r = g * 3 / 4 + ((x & 255) < 4? 80 : 0);
+	return 0xff000000 | (Min(r, 255) << 16) | (Min(g, 255) << 8) | (g / 2);
+}
+
+
+int main(void)
+{
+	const int width = 800, height = 600;
+	const char *filename = "ground.vt";
+	VirtualTexture vt;
+
+	// 第一次运行时生成纹理文件
+	if (!vt.Open(filename, 256)) {
+		auto ts = std::chrono::high_resolution_clock::now();
+		if (!VirtualTexture::Build(filename, VT_SIZE, VT_SIZE, GroundTexel)) {
+			std::cout << "build failed\n";
+			return 1;
+		}
+		auto te = std::chrono::high_resolution_clock::now();
+		std::cout << "build: " << std::chrono::duration<double, std::milli>(te - ts).count() << "ms\n";
+		vt.Open(filename, 256);
+	}
+	std::cout << "virtual texture: " << vt.GetWidth() << "x" << vt.GetHeight()
+		<< ", levels " << vt.GetLevels() << ", pages " << vt.GetPageCount()
+		<< ", cache " << (vt.GetCacheBytes() >> 20) << "MB\n";
+
+	RenderHelp rh(width, height);
+
+	// 渲染器遇到超出视锥的顶点会丢弃整个三角形，这里画一个覆盖全屏的矩形，
+	// 在 PS 里用视线和地面求交得到纹理坐标和距离
+	Vec2f corners[4] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+	int indices[6] = { 0, 1, 2, 0, 2, 3 };
+	int first = 0;
+
+	float fov = 3.1415926f * 0.4f;
+	Mat4x4f mat_proj = matrix_set_perspective(fov, width / (float)height, 0.5f, 1000.0f);
+	Mat4x4f mat_inv;
+	Vec3f eye;
+
+	const int VARYING_NDC = 0;
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			Vec2f ndc = corners[indices[first + index]];
+			output.varying_vec2f[VARYING_NDC] = ndc;
+			return { ndc.x, ndc.y, 0.5f, 1.0f };
+		});
+
+	// 每个像素覆盖的纹素数量：像素对应的世界尺寸除以纹素的世界尺寸，
+	// 视线越贴近地面，像素在地面上拉得越长
+	float pixel_angle = 2.0f * tanf(fov * 0.5f) / height;
+	float texel_density = VT_SIZE / GROUND_SIZE;
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			Vec2f ndc = input.varying_vec2f[VARYING_NDC];
+			Vec4f p = Vec4f(ndc.x, ndc.y, 1.0f, 1.0f) * mat_inv;
+			Vec3f dir = vector_normalize(p.xyz() / p.w - eye);
+			if (dir.y > -0.001f) return { 0.55f, 0.7f, 0.9f, 1.0f };
+			float dist = -eye.y / dir.y;
+			Vec3f hit = eye + dir * dist;
+			Vec2f uv = { hit.x / GROUND_SIZE + 0.5f, hit.z / GROUND_SIZE + 0.5f };
+			float lod = VirtualTexture::ComputeLod(dist * pixel_angle * texel_density / sqrtf(-dir.y));
+			return vt.Sample2D(uv, lod);
+		});
+
+	// 摄像机沿地面飞行，每帧开始时装入上一帧读好的页，结束后提交缺失的页
+	double total = 0;
+	int frames = 60;
+	for (int frame = 0; frame < frames; frame++) {
+		float t = frame / (float)frames;
+		eye = { -150.0f + 300.0f * t, 6.0f, -120.0f + 80.0f * t };
+		Vec3f at = eye + Vec3f(20.0f, -4.0f, 30.0f);
+		mat_inv = matrix_invert(matrix_set_lookat(eye, at, {0, 1, 0}) * mat_proj);
+		auto ts = std::chrono::high_resolution_clock::now();
+		vt.BeginFrame();
+		rh.Clear();
+		for (first = 0; first < 6; first += 3) rh.DrawPrimitive();
+		vt.EndFrame();
+		auto te = std::chrono::high_resolution_clock::now();
+		total += std::chrono::duration<double, std::milli>(te - ts).count();
+		if (frame % 10 == 0) {
+			std::cout << "frame " << frame << ": resident " << vt.GetResidentCount()
+				<< ", fallback samples " << vt.GetFallbackCount()
+				<< ", loaded " << vt.GetLoadedCount() << "\n";
+		}
+	}
+	std::cout << "average frame: " << total / frames << "ms\n";
+
+	// 等待所有页读完，最后一帧全部使用需要的精度
+	for (int i = 0; i < 4; i++) {
+		vt.WaitIdle();
+		vt.BeginFrame();
+		rh.Clear();
+		for (first = 0; first < 6; first += 3) rh.DrawPrimitive();
+		vt.EndFrame();
+	}
+	std::cout << "final fallback samples: " << vt.GetFallbackCount() << "\n";
+
+	rh.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
@@ -0,0 +1,130 @@
+#include <iostream>
+
+#include "RenderHelp.h"
+#include "ShaderDSL.h"
+#include "Model.h"
+#include "FrameCapture.h"
+#include "PerfCounter.h"
+
+
+// 和 sample_11 相同的着色程序
+const char *shader_source = R"(
+	uv = texuv;
+	l = normalize(light_dir);
+	n = mul(vec4(sample(normalmap, uv).rgb * 2 - 1, 1), mat_model_it).xyz;
+	s = sample(specularmap, uv).b;
+	r = normalize(n * dot(n, l) * 2 - l);
+	p = saturate(dot(r, eye_dir));
+	spec = saturate(pow(p, s * 20) * 0.05);
+	intense = saturate(dot(n, l)) + 0.2 + spec;
+	return sample(diffuse, uv) * intense;
+)";
+
+
+// 捕获一帧：用着色程序绘制模型，保存到 filename
+static bool CaptureFrame(const char *filename) {
+	RenderHelp rh(600, 800);
+	Model model("res/diablo3_pose.obj");
+
+	Vec3f eye_pos = {0, -0.5, 1.7};
+	Mat4x4f mat_model = matrix_set_scale(1, 1, 1);
+	Mat4x4f mat_view = matrix_set_lookat(eye_pos, {0, 0, 0}, {0, 1, 0});
+	Mat4x4f mat_proj = matrix_set_perspective(3.1415926f * 0.5f, 6 / 8.0, 1.0, 500.0f);
+	Mat4x4f mat_mvp = mat_model * mat_view * mat_proj;
+	Mat4x4f mat_model_it = matrix_invert(mat_model).Transpose();
+
+	const int VARYING_UV = 0;
+	const int VARYING_EYE = 1;
+
+	ShaderProgram program;
+	program.SetVarying("texuv", 2, VARYING_UV);
+	program.SetVarying("eye_dir", 3, VARYING_EYE);
+	program.SetUniform("light_dir", Vec4f(1, 1, 0.85f, 1), 3);
+	program.SetUniform("mat_model_it", mat_model_it);
+	program.SetTexture("diffuse", model.diffusemap());
+	program.SetTexture("normalmap", model.normalmap());
+	program.SetTexture("specularmap", model.specularmap());
+	if (!program.Compile(shader_source)) {
+		std::cout << "compile error: " << program.GetError() << "\n";
+		return false;
+	}
+
+	// 整个模型用一次索引绘制提交
+	std::vector<int> indices;
+	for (int i = 0; i < model.nfaces() * 3; i++) indices.push_back(i);
+
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			int face = index / 3, vert = index % 3;
+			Vec3f pos = model.vert(face, vert);
+			output.varying_vec2f[VARYING_UV] = model.uv(face, vert);
+			output.varying_vec3f[VARYING_EYE] = eye_pos - (pos.xyz1() * mat_model).xyz();
+			return pos.xyz1() * mat_mvp;
+		});
+	rh.SetPixelPacketShader(program.GetShader());
+
+	FrameCapture capture;
+	capture.SetProgram(&program);
+	rh.SetCapture(&capture);
+	rh.Clear();
+	rh.DrawIndexedPrimitive(TOPOLOGY_TRIANGLE_LIST, &indices[0], (int)indices.size());
+	rh.SetCapture(NULL);
+
+	std::cout << "captured: " << capture.GetCommandCount() << " commands, "
+		<< capture.GetVertexCount() << " vertices, " << capture.GetTextureCount() << " textures\n";
+	rh.SaveFile("output.bmp");
+	return capture.Save(filename, rh);
+}
+
+
+// 用法：sample_22_replay [capture_file]，不带参数时先捕获一帧再重放
+int main(int argc, char *argv[])
+{
+	const char *filename = (argc > 1)? argv[1] : "frame.capture";
+	if (argc <= 1 && !CaptureFrame(filename)) return 1;
+
+	FrameCapture capture;
+	if (!capture.Load(filename)) {
+		std::cout << "load failed: " << filename << "\n";
+		return 1;
+	}
+
+	struct { const char *name; int rasterizer; int threads; bool packet; } modes[] = {
+		{ "halfspace scalar ", RASTERIZER_HALFSPACE, 1, false },
+		{ "halfspace packet ", RASTERIZER_HALFSPACE, 1, true },
+		{ "scanline  packet ", RASTERIZER_SCANLINE, 1, true },
+		{ "auto      threads", RASTERIZER_AUTO, ParallelDefaultThreads(), true },
+	};
+
+	const char *stages[CAPTURE_TYPE_COUNT] = { "clear", "triangles", "sprites", "raycast" };
+	int pixels = capture.GetWidth() * capture.GetHeight();
+
+	RenderHelp rh;
+	for (auto &mode: modes) {
+		// 每个阶段一组计数器，分开看清屏和三角形各自的缺失
+		PerfCounters perf[CAPTURE_TYPE_COUNT];
+		ReplayOptions options;
+		options.rasterizer = mode.rasterizer;
+		options.threads = mode.threads;
+		options.packet = mode.packet;
+		options.perf = perf;
+		ReplayStats stats;
+		bool ok = capture.Replay(rh, options, stats);
+		if (!ok) {
+			std::cout << "replay failed\n";
+			return 1;
+		}
+		std::cout << mode.name << ": total " << stats.total << "ms, clear " << stats.clear
+			<< "ms, triangles " << stats.triangles << "ms, sprites " << stats.sprites
+			<< "ms, raycast " << stats.raycast << "ms, diff pixels " << stats.diff_pixels
+			<< " (max " << stats.max_diff << ")\n";
+		double times[CAPTURE_TYPE_COUNT] = { stats.clear, stats.triangles, stats.sprites, stats.raycast };
+		for (int i = 0; i < CAPTURE_TYPE_COUNT; i++) {
+			if (times[i] <= 0.0) continue;
+			std::cout << "  " << stages[i] << ": " << perf[i].Report("pixel", pixels) << "\n";
+		}
+	}
+
+	return 0;
+}
+
+
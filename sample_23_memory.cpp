@@ -0,0 +1,63 @@
+#include <iostream>
+
+#include "RenderHelp.h"
+#include "Model.h"
+
+
+static void PrintUsage(const char *name, const MemoryUsage& usage) {
+	std::cout << name << ": " << (usage.Total() >> 10) << "KB";
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+		if (usage.bytes[i] == 0) continue;
+		std::cout << ", " << MemoryCategoryName((MemoryCategory)i) << " " << (usage.bytes[i] >> 10) << "KB";
+	}
+	std::cout << "\n";
+}
+
+
+// 模拟渲染服务的一个请求：按尺寸创建渲染器，画一帧，返回该请求的峰值
+static int64_t RenderRequest(Model& model, int width, int height) {
+	MemoryResetPeak();
+	RenderHelp rh(width, height);
+	Mat4x4f mat_mvp = matrix_set_lookat({0, -0.5, 1.7}, {0, 0, 0}, {0, 1, 0}) *
+		matrix_set_perspective(3.1415926f * 0.5f, width / (float)height, 1.0, 500.0f);
+	const int VARYING_UV = 0;
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			output.varying_vec2f[VARYING_UV] = model.uv(index / 3, index % 3);
+			return model.vert(index / 3, index % 3).xyz1() * mat_mvp;
+		});
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f {
+			return model.diffuse(input.varying_vec2f[VARYING_UV]);
+		});
+	rh.DrawPrimitive(TOPOLOGY_TRIANGLE_LIST, model.nfaces() * 3);
+	PrintUsage("  renderer", rh.GetMemoryUsage());
+	return MemoryGetTotalPeak();
+}
+
+
+int main(void)
+{
+	// 每 50 毫秒在后台输出一次全局统计，也可以传入回调检查预算
+	MemoryMonitor monitor(50);
+
+	Model model("res/diablo3_pose.obj");
+	model.bvh();
+	PrintUsage("model", model.GetMemoryUsage());
+
+	// 不同尺寸的请求：峰值减去请求开始前的用量，就是该请求需要的内存
+	int sizes[3][2] = { { 400, 300 }, { 800, 600 }, { 1920, 1080 } };
+	for (auto &size: sizes) {
+		int64_t base = MemoryGetTotal();
+		std::cout << "request " << size[0] << "x" << size[1] << ":\n";
+		int64_t peak = RenderRequest(model, size[0], size[1]);
+		std::cout << "  peak " << ((peak - base) >> 10) << "KB over base " << (base >> 10) << "KB\n";
+	}
+
+	// 渲染器释放以后帧缓存回到 BitmapPool，计入 cached
+	std::cout << MemoryReport() << "\n";
+	BitmapPool::Get().Trim();
+	std::cout << MemoryReport() << "\n";
+
+	return 0;
+}
+
+
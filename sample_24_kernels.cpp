@@ -0,0 +1,81 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+
+
+// 后处理：暗角加上偏暖的色调
+static uint32_t PostProcess(int x, int y, uint32_t color, int w, int h) {
+	float dx = (x - w * 0.5f) / w, dy = (y - h * 0.5f) / h;
+	float k = Saturate(1.2f - (dx * dx + dy * dy) * 2.0f);
+	Vec4f c = vector_from_color(color);
+	return vector_to_color({ Saturate(c.r * k * 1.1f), c.g * k, c.b * k * 0.9f, c.a });
+}
+
+
+int main(void)
+{
+	const int width = 1920, height = 1080;
+	Bitmap source(width, height);
+	source.Transform([] (int x, int y, uint32_t) -> uint32_t {
+			return 0xff000000 | ((x & 255) << 16) | ((y & 255) << 8) | ((x ^ y) & 255);
+		});
+
+	// 逐像素 GetPixel/SetPixel 串行处理
+	Bitmap serial(source);
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++)
+			serial.SetPixel(x, y, PostProcess(x, y, serial.GetPixel(x, y), width, height));
+	}
+	auto te = std::chrono::high_resolution_clock::now();
+	std::cout << "serial:    " << std::chrono::duration<double, std::milli>(te - ts).count() << "ms\n";
+
+	// Transform 按行并行，直接访问像素
+	Bitmap parallel(source);
+	ts = std::chrono::high_resolution_clock::now();
+	parallel.Transform([&] (int x, int y, uint32_t color) -> uint32_t {
+			return PostProcess(x, y, color, width, height);
+		});
+	te = std::chrono::high_resolution_clock::now();
+	std::cout << "transform: " << std::chrono::duration<double, std::milli>(te - ts).count() << "ms, "
+		<< (parallel.Hash() == serial.Hash()? "same" : "different") << "\n";
+
+	// ForEachTile：3x3 均值模糊，按块读取源图写入目标图
+	Bitmap blur(width, height);
+	ts = std::chrono::high_resolution_clock::now();
+	blur.ForEachTile([&] (const BitmapTile& tile) {
+			for (int j = 0; j < tile.h; j++) {
+				int y = tile.y + j;
+				const uint32_t *rows[3];
+				for (int k = 0; k < 3; k++)
+					rows[k] = (const uint32_t*)parallel.GetLine(Between(0, height - 1, y + k - 1));
+				uint32_t *dst = tile.Row(j);
+				for (int i = 0; i < tile.w; i++) {
+					int x = tile.x + i;
+					int x0 = Max(0, x - 1), x2 = Min(width - 1, x + 1);
+					uint32_t sum[4] = { 0, 0, 0, 0 };
+					for (int k = 0; k < 3; k++) {
+						uint32_t c[3] = { rows[k][x0], rows[k][x], rows[k][x2] };
+						for (int n = 0; n < 3; n++) {
+							sum[0] += c[n] & 0xff; sum[1] += (c[n] >> 8) & 0xff;
+							sum[2] += (c[n] >> 16) & 0xff; sum[3] += c[n] >> 24;
+						}
+					}
+					dst[i] = (sum[0] / 9) | ((sum[1] / 9) << 8) | ((sum[2] / 9) << 16) | ((sum[3] / 9) << 24);
+				}
+			}
+		});
+	te = std::chrono::high_resolution_clock::now();
+	std::cout << "blur tiles: " << std::chrono::duration<double, std::milli>(te - ts).count() << "ms\n";
+
+	blur.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
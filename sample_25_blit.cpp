@@ -0,0 +1,86 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+
+
+// 计时 func 运行 count 次的平均耗时，毫秒
+template <typename F> static double Bench(int count, F&& func) {
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++) func();
+	auto te = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(te - ts).count() / count;
+}
+
+
+int main(void)
+{
+	Bitmap texture("res/diablo3_pose_diffuse.bmp");
+	int w = texture.GetW(), h = texture.GetH();
+	std::cout << "kernels: " << KernelRegistry::Get().Report() << "\n";
+
+	// 水平翻转：逐点 GetPixel/SetPixel 交换对比按行反转
+	Bitmap a(texture), b(texture);
+	double t0 = Bench(10, [&] () {
+			for (int y = 0; y < h; y++) {
+				for (int i = 0, j = w - 1; i < j; i++, j--) {
+					uint32_t c1 = a.GetPixel(i, y), c2 = a.GetPixel(j, y);
+					a.SetPixel(i, y, c2);
+					a.SetPixel(j, y, c1);
+				}
+			}
+		});
+	double t1 = Bench(10, [&] () { b.FlipHorizontal(); });
+	std::cout << "flip horizontal: " << t0 << "ms -> " << t1 << "ms, "
+		<< (a.Hash() == b.Hash()? "ok" : "FAILED") << "\n";
+
+	// 旋转 90 度：逐点读取对比分块转置，转四次应该回到原图
+	Bitmap naive(h, w);
+	t0 = Bench(10, [&] () {
+			for (int y = 0; y < w; y++) {
+				for (int x = 0; x < h; x++) naive.SetPixel(x, y, texture.GetPixel(y, h - 1 - x));
+			}
+		});
+	Bitmap rotated(0, 0);
+	t1 = Bench(10, [&] () { rotated = texture.Rotate(1); });
+	bool full_turn = (rotated.Rotate(1).Rotate(1).Rotate(1).Hash() == texture.Hash());
+	bool back = (rotated.Rotate(3).Hash() == texture.Hash());
+	std::cout << "rotate 90: " << t0 << "ms -> " << t1 << "ms, "
+		<< (naive.Hash() == rotated.Hash() && full_turn && back? "ok" : "FAILED") << "\n";
+
+	// 格式转换：导出再导入应该得到原图，灰度只检查耗时
+	std::vector<uint8_t> buffer((size_t)w * h * 4);
+	PixelFormat formats[] = { PIXEL_RGBA32, PIXEL_BGR24, PIXEL_RGB24, PIXEL_GRAY8 };
+	const char *names[] = { "rgba32", "bgr24 ", "rgb24 ", "gray8 " };
+	for (int i = 0; i < 4; i++) {
+		int pitch = w * PixelFormatSize(formats[i]);
+		Bitmap copy(w, h);
+		double te = Bench(10, [&] () { texture.Export(&buffer[0], pitch, formats[i]); });
+		double ti = Bench(10, [&] () { copy.Import(&buffer[0], pitch, formats[i]); });
+		std::cout << "convert " << names[i] << ": export " << te << "ms, import " << ti << "ms";
+		if (formats[i] != PIXEL_GRAY8)
+			std::cout << ", " << (copy.Hash() == texture.Hash()? "ok" : "FAILED");
+		std::cout << "\n";
+	}
+
+	// 子区域复制：超出边界的部分被裁掉，拼出一张四宫格的图
+	Bitmap canvas(w, h);
+	canvas.Fill(0xff202020);
+	Bitmap gray(w, h);
+	texture.Export(&buffer[0], w, PIXEL_GRAY8);
+	gray.Import(&buffer[0], w, PIXEL_GRAY8);
+	canvas.Blit(-w / 2, -h / 2, texture);
+	canvas.Blit(w / 2, -h / 2, gray);
+	canvas.Blit(-w / 2, h / 2, rotated);
+	canvas.Blit(w / 2, h / 2, b);
+	canvas.Blit(w / 4, h / 4, canvas, 0, 0, w / 2, h / 2);
+	canvas.SaveFile("output.bmp");
+
+#if defined(WIN32) || defined(_WIN32)
+	system("mspaint output.bmp");
+#endif
+
+	return 0;
+}
+
+
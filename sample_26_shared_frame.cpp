@@ -0,0 +1,114 @@
+#include <iostream>
+#include <chrono>
+
+#include "RenderHelp.h"
+#include "SharedFrame.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#endif
+
+
+const char *SHM_NAME = "/renderhelp_sample";
+const int FRAMES = 120;
+
+
+// 查看器：等待新的帧，直接读取共享内存里的像素。渲染进程把帧序号写在
+// 第一个和最后一个像素里，两者相同说明读到的不是写了一半的帧
+static int Viewer(void) {
+	SharedFrameViewer viewer;
+	for (int i = 0; i < 100 && !viewer.Open(SHM_NAME); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	if (!viewer.IsOpen()) {
+		std::cout << "viewer: open failed\n";
+		return 1;
+	}
+	int shown = 0, torn = 0;
+	uint32_t last = 0;
+	while (!viewer.IsClosed()) {
+		last = viewer.WaitFrame(last, 1000);
+		uint32_t sequence = 0;
+		const uint8_t *bits = viewer.Acquire(&sequence);
+		if (bits == NULL) continue;
+		uint32_t first, tail;
+		memcpy(&first, bits, 4);
+		memcpy(&tail, bits + (size_t)viewer.GetPitch() * (viewer.GetHeight() - 1) + (viewer.GetWidth() - 1) * 4, 4);
+		if (first != tail) torn++;
+		shown++;
+		// 模拟显示的耗时，这期间渲染进程继续写其他缓冲区
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		viewer.Release();
+	}
+	Bitmap frame(0, 0);
+	if (viewer.Read(frame)) frame.SaveFile("output.bmp");
+	std::cout << "viewer: shown " << shown << " frames, torn " << torn << "\n";
+	return 0;
+}
+
+
+// 渲染进程：画旋转的三角形，每帧发布到共享内存
+static int Renderer(int buffers) {
+	SharedFrameBuffer shared;
+	if (!shared.Create(SHM_NAME, 800, 600, buffers)) {
+		std::cout << "create shared memory failed\n";
+		return 1;
+	}
+	RenderHelp rh(800, 600);
+	float angle = 0.0f;
+	Vec4f colors[3] = { {1, 0, 0, 1}, {0, 1, 0, 1}, {0, 0, 1, 1} };
+	rh.SetVertexShader([&] (int index, ShaderContext& output) -> Vec4f {
+			float a = angle + index * 3.1415926f * 2.0f / 3.0f;
+			output.varying_vec4f[0] = colors[index];
+			return { cosf(a) * 0.7f, sinf(a) * 0.7f, 0.5f, 1.0f };
+		});
+	rh.SetPixelShader([&] (ShaderContext& input) -> Vec4f { return input.varying_vec4f[0]; });
+
+	auto ts = std::chrono::high_resolution_clock::now();
+	for (int i = 1; i <= FRAMES; i++) {
+		angle = i * 0.05f;
+		rh.Clear();
+		rh.DrawPrimitive();
+		// 相当于 shared.Present(rh)，这里拆开写是为了在共享内存里加上帧序号
+		uint8_t *bits = shared.BeginFrame();
+		if (bits) {
+			int pitch = shared.GetPitch();
+			rh.GetFrame()->Export(bits, pitch, PIXEL_BGRA32);
+			uint32_t mark = (uint32_t)i;
+			memcpy(bits, &mark, 4);
+			memcpy(bits + (size_t)pitch * 599 + 799 * 4, &mark, 4);
+			shared.EndFrame();
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	auto te = std::chrono::high_resolution_clock::now();
+	std::cout << "renderer: " << buffers << " buffers, presented " << shared.GetSequence()
+		<< " frames, dropped " << shared.GetDropped() << ", "
+		<< std::chrono::duration<double, std::milli>(te - ts).count() / FRAMES << "ms per frame\n";
+	shared.Close();
+	return 0;
+}
+
+
+// 用法：sample_26_shared_frame [view]。不带参数时先启动一个查看器子进程，
+// 然后分别用三缓冲和双缓冲渲染；带 view 参数时只作为查看器运行
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "view") == 0) return Viewer();
+#if defined(__unix__) || defined(__APPLE__)
+	for (int buffers = 3; buffers >= 2; buffers--) {
+		shm_unlink(SHM_NAME);
+		std::cout.flush();    // 避免缓冲区里的输出被子进程再输出一次
+		pid_t pid = fork();
+		if (pid == 0) return Viewer();
+		Renderer(buffers);
+		int status = 0;
+		waitpid(pid, &status, 0);
+	}
+	return 0;
+#else
+	std::cout << "shared memory is not supported on this platform\n";
+	return 0;
+#endif
+}
+
+